@@ -0,0 +1,71 @@
+/**
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "AddBatchingHandler.h"
+
+AddBatchingHandler::AddBatchingHandler(EventBase* eventBase, const AddBatchingConfig& config) :
+        config_(config),
+        lingerTimeout_(std::max<int64_t>(1, (config.maxLinger.count() + 999) / 1000)),
+        batch_(),
+        batchBytes_(0),
+        timeout_(eventBase, *this) {
+    batch_.reserve(config.maxCount);
+}
+
+Future<Unit> AddBatchingHandler::write(Context* ctx, Request request) {
+    if (request.opCode != BookieOperation::AddEntry) {
+        return ctx->fireWrite(std::move(request));
+    }
+
+    if (request.data) {
+        batchBytes_ += request.data->computeChainDataLength();
+    }
+    batch_.push_back(std::move(request));
+
+    if (batch_.size() >= config_.maxCount || batchBytes_ >= config_.maxBytes) {
+        flush();
+    } else if (batch_.size() == 1) {
+        timeout_.scheduleTimeout(lingerTimeout_);
+    }
+
+    // Write failures are reported to the connection through the pipeline read path
+    return makeFuture();
+}
+
+Future<Unit> AddBatchingHandler::close(Context* ctx) {
+    timeout_.cancelTimeout();
+    batch_.clear();
+    batchBytes_ = 0;
+    return ctx->fireClose();
+}
+
+void AddBatchingHandler::flush() {
+    timeout_.cancelTimeout();
+
+    std::vector<Request> batch;
+    batch.reserve(config_.maxCount);
+    batch.swap(batch_);
+    batchBytes_ = 0;
+
+    auto ctx = getContext();
+    for (auto& request : batch) {
+        ctx->fireWrite(std::move(request));
+    }
+}
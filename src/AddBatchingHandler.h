@@ -0,0 +1,91 @@
+/**
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#pragma once
+
+#include "BookieProtocol.h"
+
+#include <chrono>
+#include <vector>
+
+#include <folly/io/async/AsyncTimeout.h>
+#include <folly/io/async/EventBase.h>
+#include <wangle/channel/Handler.h>
+
+using namespace wangle;
+using namespace folly;
+using namespace std::chrono;
+
+struct AddBatchingConfig {
+    // Flush the batch when it reaches this number of entries. Batching is disabled when set to 1.
+    size_t maxCount = 1;
+
+    // Flush the batch when the entries payload reaches this size
+    size_t maxBytes = 64 * 1024;
+
+    // Maximum time an entry is held in the batch. The timer resolution is 1 millisecond.
+    microseconds maxLinger = microseconds(1000);
+
+    bool enabled() const {
+        return maxCount > 1;
+    }
+};
+
+/**
+ * Client pipeline handler that holds the add entry requests of a connection and writes them in batches, when the batch
+ * reaches the max count or size, or when the oldest entry has waited for the max linger time.
+ *
+ * The requests of a batch are written during the same event loop iteration, so with an OutputBufferingHandler in the
+ * pipeline each batch goes out in a single socket write. Other requests are not delayed.
+ */
+class AddBatchingHandler: public OutboundHandler<Request> {
+public:
+    AddBatchingHandler(EventBase* eventBase, const AddBatchingConfig& config);
+
+    Future<Unit> write(Context* ctx, Request request) override;
+
+    Future<Unit> close(Context* ctx) override;
+
+private:
+    void flush();
+
+    class LingerTimeout: public AsyncTimeout {
+    public:
+        LingerTimeout(EventBase* eventBase, AddBatchingHandler& handler) :
+                AsyncTimeout(eventBase),
+                handler_(handler) {
+        }
+
+        void timeoutExpired() noexcept override {
+            handler_.flush();
+        }
+
+    private:
+        AddBatchingHandler& handler_;
+    };
+
+    const AddBatchingConfig config_;
+    const milliseconds lingerTimeout_;
+
+    std::vector<Request> batch_;
+    size_t batchBytes_;
+
+    LingerTimeout timeout_;
+};
@@ -0,0 +1,94 @@
+/**
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "AdmissionPersistentCache.h"
+
+#include "Logging.h"
+
+#include <stdexcept>
+
+#include <folly/Hash.h>
+#include <rocksdb/env.h>
+
+DECLARE_LOG_OBJECT();
+
+using namespace rocksdb;
+
+AdmissionPersistentCache::AdmissionPersistentCache(std::shared_ptr<PersistentCache> cache,
+        MetricsManager& metricsManager) :
+        cache_(cache),
+        admissionTable_(new std::atomic<uint64_t>[AdmissionTableSize]),
+        hit_(metricsManager.createMetric("persistentCacheHit")),
+        miss_(metricsManager.createMetric("persistentCacheMiss")),
+        admitted_(metricsManager.createMetric("persistentCacheAdmitted")),
+        rejected_(metricsManager.createMetric("persistentCacheRejected")) {
+    for (size_t i = 0; i < AdmissionTableSize; i++) {
+        admissionTable_[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+std::shared_ptr<PersistentCache> AdmissionPersistentCache::open(const std::string& directory, uint64_t sizeBytes,
+        MetricsManager& metricsManager) {
+    Env* env = Env::Default();
+    Status status = env->CreateDirIfMissing(directory);
+
+    std::shared_ptr<Logger> logger;
+    if (status.ok()) {
+        status = env->NewLogger(directory + "/LOG", &logger);
+    }
+
+    std::shared_ptr<PersistentCache> cache;
+    if (status.ok()) {
+        status = NewPersistentCache(env, directory, sizeBytes, logger, false /* optimized for nvm */, &cache);
+    }
+
+    if (!status.ok()) {
+        throw std::runtime_error("Failed to open persistent cache at " + directory + ": " + status.ToString());
+    }
+
+    LOG_INFO("Opened persistent cache at " << directory << " -- size: " << sizeBytes / 1024 / 1024 << " MB");
+    return std::make_shared<AdmissionPersistentCache>(cache, metricsManager);
+}
+
+Status AdmissionPersistentCache::Insert(const Slice& key, const char* data, const size_t size) {
+    uint64_t hash = folly::hash::SpookyHashV2::Hash64(key.data(), key.size(), 0);
+    // 0 marks an empty slot
+    uint64_t fingerprint = hash | 1;
+
+    std::atomic<uint64_t>& slot = admissionTable_[hash % AdmissionTableSize];
+    if (slot.load(std::memory_order_relaxed) != fingerprint) {
+        slot.store(fingerprint, std::memory_order_relaxed);
+        rejected_->addValueSample(1);
+        return Status::OK();
+    }
+
+    admitted_->addValueSample(1);
+    return cache_->Insert(key, data, size);
+}
+
+Status AdmissionPersistentCache::Lookup(const Slice& key, std::unique_ptr<char[]>* data, size_t* size) {
+    Status status = cache_->Lookup(key, data, size);
+    if (status.ok()) {
+        hit_->addValueSample(1);
+    } else {
+        miss_->addValueSample(1);
+    }
+    return status;
+}
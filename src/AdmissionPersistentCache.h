@@ -0,0 +1,83 @@
+/**
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#pragma once
+
+#include "Metrics.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include <rocksdb/persistent_cache.h>
+#include <rocksdb/version.h>
+
+/**
+ * Persistent (SSD) cache tier behind the RocksDB block cache, only admitting the blocks read a second time.
+ *
+ * The blocks are looked up in this tier on a block cache miss, and inserted after they're read from the data files.
+ * Inserting every block read would churn the SSD with one-off reads (eg: a catch-up reader scanning an old ledger), so
+ * the first insert of a block only records its fingerprint in a fixed-size table, and the block is admitted when it
+ * is inserted again while its fingerprint is still there.
+ */
+class AdmissionPersistentCache: public rocksdb::PersistentCache {
+public:
+    AdmissionPersistentCache(std::shared_ptr<rocksdb::PersistentCache> cache, MetricsManager& metricsManager);
+
+    /**
+     * Open a persistent cache in a local directory
+     */
+    static std::shared_ptr<rocksdb::PersistentCache> open(const std::string& directory, uint64_t sizeBytes,
+            MetricsManager& metricsManager);
+
+    rocksdb::Status Insert(const rocksdb::Slice& key, const char* data, const size_t size) override;
+
+    rocksdb::Status Lookup(const rocksdb::Slice& key, std::unique_ptr<char[]>* data, size_t* size) override;
+
+    bool IsCompressed() override {
+        return cache_->IsCompressed();
+    }
+
+    StatsType Stats() override {
+        return cache_->Stats();
+    }
+
+    std::string GetPrintableOptions() const override {
+        return cache_->GetPrintableOptions();
+    }
+
+#if ROCKSDB_MAJOR > 6 || (ROCKSDB_MAJOR == 6 && ROCKSDB_MINOR >= 27)
+    uint64_t NewId() override {
+        return cache_->NewId();
+    }
+#endif
+
+private:
+    std::shared_ptr<rocksdb::PersistentCache> cache_;
+
+    // Fingerprints of the blocks inserted once, indexed by their hash. Collisions just overwrite the slot.
+    static const size_t AdmissionTableSize = 1 << 20;
+    std::unique_ptr<std::atomic<uint64_t>[]> admissionTable_;
+
+    MetricPtr hit_;
+    MetricPtr miss_;
+    MetricPtr admitted_;
+    MetricPtr rejected_;
+};
@@ -19,33 +19,119 @@
  *
  */
 #include "Bookie.h"
+#include "LocalMetadataStore.h"
+#include "LocalSegmentStore.h"
 #include "Logging.h"
+#include "ZooKeeper.h"
 
 #include <folly/io/async/EventBaseManager.h>
 #include <wangle/channel/EventBaseHandler.h>
 #include <folly/Bits.h>
 
+#include <cerrno>
+#include <cstring>
+#include <sys/statvfs.h>
+
 DECLARE_LOG_OBJECT();
 
 Bookie::Bookie(const BookieConfig& conf) :
         conf_(conf),
         metricsManager_(conf.statsReportingInterval()),
-        zk_(conf.zkServers(), milliseconds(conf.zkSessionTimeout())),
-        bookieRegistration_(&zk_, conf),
-        storage_(conf, metricsManager_) {
+        metadataCallbackExecutor_(1),
+        storage_(conf, metricsManager_),
+        addEntryLatency_(metricsManager_.createMetric("addEntry")),
+        readOnly_(false),
+        freeDiskBytes_(0) {
+    checkDiskSpace();
+
+    if (conf.zkRegistration()) {
+        if (conf.metadataStore() == "zookeeper") {
+            metadataStore_ = make_unique<ZooKeeper>(conf.zkServers(), milliseconds(conf.zkSessionTimeout()),
+                    &metadataCallbackExecutor_);
+        } else if (conf.metadataStore() == "local") {
+            metadataStore_ = make_unique<LocalMetadataStore>(conf.metadataStoreFile(), &metadataCallbackExecutor_);
+        } else {
+            throw std::invalid_argument("Invalid metadata store: " + conf.metadataStore());
+        }
+
+        bookieRegistration_ = make_unique<BookieRegistration>(metadataStore_.get(), conf, [this]() {
+            return loadStats();
+        });
+        ledgerMetadataCache_ = std::make_shared<LedgerMetadataCache>(*metadataStore_, metricsManager_,
+                conf.ledgerMetadataCacheSize());
+    } else {
+        LOG_INFO("Registration is disabled");
+    }
+
+    if (conf.autoRecovery()) {
+        if (metadataStore_) {
+            recoveryWorker_ = make_unique<RecoveryWorker>(*metadataStore_, *ledgerMetadataCache_, storage_,
+                    metricsManager_, conf);
+        } else {
+            LOG_WARN("Auto-recovery requires a metadata store -- Ignoring it");
+        }
+    }
+
+    if (!conf.tieringStore().empty()) {
+        if (conf.tieringStore() != "local") {
+            throw std::invalid_argument("Invalid tiering store: " + conf.tieringStore());
+        }
+
+        if (metadataStore_) {
+            auto segmentStore = make_unique<LocalSegmentStore>(conf.tieringDirectory(), conf.tieringMmapReads(),
+                    conf.tieringDropPageCache());
+            tieringService_ = make_unique<TieringService>(std::move(segmentStore), storage_, *ledgerMetadataCache_,
+                    metricsManager_, conf);
+        } else {
+            LOG_WARN("Tiering requires a metadata store -- Ignoring it");
+        }
+    }
+
+    if (!conf.captureFile().empty()) {
+        trafficCapture_ = make_unique<TrafficCapture>(conf.captureFile(), conf.capturePayloads());
+    }
+
     server_.childPipeline(std::make_shared<BookiePipelineFactory>(*this));
 }
 
 void Bookie::start() {
-    SocketAddress bookieAddress("0.0.0.0", conf_.bookiePort());
+    SocketAddress bookieAddress(conf_.bookieBindAddress(), conf_.bookiePort());
     LOG_INFO("Starting bookie on " << bookieAddress);
     server_.bind(bookieAddress);
 
-    zk_.startSession();
-    LOG_INFO("Started bookie");
+    scheduler_.addFunction(std::bind(&Bookie::checkDiskSpace, this), seconds(10), "checkDiskSpace");
+    if (conf_.statsReportingInterval().count() > 0) {
+        scheduler_.addFunction(std::bind(&Storage::logBlockCacheStats, &storage_), conf_.statsReportingInterval(),
+                "logBlockCacheStats", conf_.statsReportingInterval());
+    }
+    scheduler_.addFunction(std::bind(&Storage::saveHotRanges, &storage_), conf_.hotRangesSaveInterval(),
+            "saveHotRanges", conf_.hotRangesSaveInterval());
+    scheduler_.start();
+
+    if (metadataStore_) {
+        metadataStore_->startSession();
+    }
+
+    if (recoveryWorker_) {
+        recoveryWorker_->start();
+    }
+
+    if (tieringService_) {
+        tieringService_->start();
+    }
+    LOG_INFO("Started bookie on " << getAddress());
 }
 
 void Bookie::stop() {
+    if (recoveryWorker_) {
+        recoveryWorker_->stop();
+    }
+
+    if (tieringService_) {
+        tieringService_->stop();
+    }
+
+    scheduler_.shutdown();
     server_.stop();
 }
 
@@ -53,17 +139,69 @@ void Bookie::waitForStop() {
     server_.waitForStop();
 }
 
+SocketAddress Bookie::getAddress() const {
+    SocketAddress address;
+    server_.getSockets().front()->getAddress(&address);
+    return address;
+}
+
 BookieHandler Bookie::newHandler() {
-    return BookieHandler(*this, metricsManager_);
+    return BookieHandler(*this, metricsManager_, trafficCapture_.get());
 }
 
-Future<Unit> Bookie::addEntry(int64_t ledgerId, int64_t entryId, IOBufPtr data) {
-    return storage_.put(ledgerId, entryId, std::move(data));
+Future<Unit> Bookie::addEntry(int64_t ledgerId, int64_t entryId, IOBufPtr data, bool recovery) {
+    return storage_.put(ledgerId, entryId, std::move(data), recovery);
 }
 
 Future<IOBufPtr> Bookie::getLastEntry(int64_t ledgerId) {
+    return storage_.getLastEntry(ledgerId);
 }
 
 Future<IOBufPtr> Bookie::readEntry(int64_t ledgerId, int64_t entryId) {
+    // Tailing reads are served right away, without a hop to the storage read threads
+    IOBufPtr cached = storage_.getFromTailCache(ledgerId, entryId);
+    if (cached) {
+        return makeFuture(std::move(cached));
+    }
+
+    if (tieringService_ && tieringService_->isOffloaded(ledgerId)) {
+        return tieringService_->readEntry(ledgerId, entryId);
+    }
+
+    if (entryId == BookieConstant::LastAddConfirmed) {
+        return getLastEntry(ledgerId);
+    }
+
+    return storage_.get(ledgerId, entryId);
+}
+
+Future<Unit> Bookie::fenceLedger(int64_t ledgerId) {
+    return storage_.fenceLedger(ledgerId);
+}
+
+BookieLoadStats Bookie::loadStats() {
+    return {storage_.journalQueueSize(), addEntryLatency_->currentPercentile(0.99), freeDiskBytes_, readOnly_};
+}
+
+void Bookie::checkDiskSpace() {
+    struct statvfs stat;
+    if (statvfs(conf_.dataDirectory().c_str(), &stat) != 0) {
+        LOG_WARN("Failed to get free disk space of " << conf_.dataDirectory() << ": " << strerror(errno));
+        return;
+    }
+
+    int64_t freeDiskBytes = (int64_t) stat.f_bavail * stat.f_frsize;
+    freeDiskBytes_ = freeDiskBytes;
 
+    int64_t threshold = conf_.readOnlyFreeDiskThresholdBytes();
+    if (threshold > 0) {
+        bool readOnly = freeDiskBytes < threshold;
+        if (readOnly_.exchange(readOnly) != readOnly) {
+            if (readOnly) {
+                LOG_WARN("Free disk space is " << freeDiskBytes << " bytes -- Switching to read-only mode");
+            } else {
+                LOG_INFO("Free disk space is " << freeDiskBytes << " bytes -- Switching back to read-write mode");
+            }
+        }
+    }
 }
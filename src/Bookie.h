@@ -21,15 +21,23 @@
 #pragma once
 
 #include <wangle/bootstrap/ServerBootstrap.h>
+#include <wangle/concurrent/CPUThreadPoolExecutor.h>
+#include <folly/experimental/FunctionScheduler.h>
+#include <atomic>
 #include <iostream>
+#include <memory>
 
 #include "BookiePipeline.h"
 #include "BookieRegistration.h"
-#include "ZooKeeper.h"
+#include "MetadataStore.h"
 #include "BookieHandler.h"
 #include "BookieConfig.h"
 #include "Metrics.h"
+#include "LedgerMetadataCache.h"
+#include "RecoveryWorker.h"
 #include "Storage.h"
+#include "TieringService.h"
+#include "TrafficCapture.h"
 
 using namespace wangle;
 
@@ -43,21 +51,92 @@ public:
 
     void waitForStop();
 
+    /**
+     * @return the address the bookie server is bound to. Useful when binding on an ephemeral port.
+     */
+    SocketAddress getAddress() const;
+
     BookieHandler newHandler();
 
-    Future<Unit> addEntry(int64_t ledgerId, int64_t entryId, IOBufPtr data);
+    /**
+     * @return a future completing when the entry is persisted, or failed with a LedgerFencedException if the ledger
+     *         was fenced in the meantime
+     */
+    Future<Unit> addEntry(int64_t ledgerId, int64_t entryId, IOBufPtr data, bool recovery = false);
 
     Future<IOBufPtr> getLastEntry(int64_t ledgerId);
 
+    /**
+     * @return a future yielding the entry data, or a null buffer if the entry does not exist
+     */
     Future<IOBufPtr> readEntry(int64_t ledgerId, int64_t entryId);
 
+    /**
+     * Fence a ledger, so that no more entries are accepted from the current writer.
+     *
+     * @return a future completing when the fenced state is persisted
+     */
+    Future<Unit> fenceLedger(int64_t ledgerId);
+
+    bool isFenced(int64_t ledgerId) const {
+        return storage_.isFenced(ledgerId);
+    }
+
+    /**
+     * @return true if the ledger was moved to the tiering store, its reads are then served from there
+     */
+    bool isOffloaded(int64_t ledgerId) const {
+        return storage_.isOffloaded(ledgerId);
+    }
+
+    /**
+     * @return false if the ledger was created with a different master key
+     */
+    bool verifyMasterKey(int64_t ledgerId, const MasterKey& masterKey) {
+        return storage_.verifyMasterKey(ledgerId, masterKey);
+    }
+
+    /**
+     * @return true if the bookie is rejecting new entries, because the disk is almost full
+     */
+    bool isReadOnly() const {
+        return readOnly_;
+    }
+
+    BookieLoadStats loadStats();
+
 private:
+    void checkDiskSpace();
+
     const BookieConfig& conf_;
     MetricsManager metricsManager_;
     ServerBootstrap<BookiePipeline> server_;
 
-    ZooKeeper zk_;
-    BookieRegistration bookieRegistration_;
+    // Runs the metadata store callbacks, off the ZooKeeper client thread. Single thread to preserve their ordering.
+    wangle::CPUThreadPoolExecutor metadataCallbackExecutor_;
+
+    // Only set when registration is enabled
+    std::unique_ptr<MetadataStore> metadataStore_;
+    std::unique_ptr<BookieRegistration> bookieRegistration_;
+
+    // Shared by the recovery worker and the tiering service. Destroyed before the metadata store.
+    std::shared_ptr<LedgerMetadataCache> ledgerMetadataCache_;
+
     Storage storage_;
+
+    // Only set when auto-recovery is enabled
+    std::unique_ptr<RecoveryWorker> recoveryWorker_;
+
+    // Only set when tiering is enabled
+    std::unique_ptr<TieringService> tieringService_;
+
+    // Only set when traffic capture is enabled
+    std::unique_ptr<TrafficCapture> trafficCapture_;
+
+    MetricPtr addEntryLatency_;
+    std::atomic<bool> readOnly_;
+    std::atomic<int64_t> freeDiskBytes_;
+
+    FunctionScheduler scheduler_;
 };
 
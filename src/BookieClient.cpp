@@ -0,0 +1,686 @@
+/**
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "BookieClient.h"
+#include "BookieCodecV2.h"
+#include "Logging.h"
+
+#include <mutex>
+#include <random>
+#include <sstream>
+
+#include <folly/MoveWrapper.h>
+#include <folly/io/async/AsyncSocket.h>
+#include <folly/stats/Histogram.h>
+#include <wangle/channel/AsyncSocketHandler.h>
+#include <wangle/channel/OutputBufferingHandler.h>
+#include <wangle/codec/LengthFieldBasedFrameDecoder.h>
+
+DECLARE_LOG_OBJECT();
+
+typedef Pipeline<IOBufQueue&, Request> BookieClientPipeline;
+
+BookieException::BookieException(BookieError error, const std::string& msg) :
+        error_(error) {
+    std::ostringstream s;
+    s << msg << " - " << error;
+    msg_ = s.str();
+}
+
+const char* BookieException::what() const noexcept {
+    return msg_.c_str();
+}
+
+/**
+ * Responses are matched to requests by operation, ledgerId and entryId
+ */
+struct RequestKey {
+    BookieOperation opCode;
+    int64_t ledgerId;
+    int64_t entryId;
+
+    bool operator==(const RequestKey& other) const {
+        return opCode == other.opCode && ledgerId == other.ledgerId && entryId == other.entryId;
+    }
+};
+
+struct RequestKeyHash {
+    size_t operator()(const RequestKey& key) const {
+        size_t h = std::hash<int64_t>()(key.ledgerId);
+        h = h * 31 + std::hash<int64_t>()(key.entryId);
+        return h * 31 + (size_t) key.opCode;
+    }
+};
+
+/**
+ * Single connection to a bookie. All the state is only accessed from the connection event base thread.
+ */
+class BookieConnection: public AsyncSocket::ConnectCallback {
+public:
+    BookieConnection(const SocketAddress& address, EventBase* eventBase, const BookieClientConfig& config);
+
+    /**
+     * Thread-safe. Requests issued while the connection is not established are sent once it is.
+     */
+    Future<Response> send(Request request);
+
+    /**
+     * Close the connection and fail all the outstanding requests. Blocks until done.
+     */
+    void shutdown();
+
+    void onResponse(uint64_t generation, Response response);
+
+    void onDisconnected(uint64_t generation, const std::string& reason);
+
+    void connectSuccess() noexcept override;
+
+    void connectErr(const AsyncSocketException& ex) noexcept override;
+
+private:
+    struct PendingRequest {
+        Promise<Response> promise;
+        steady_clock::time_point deadline;
+    };
+
+    void sendNow(Request request, Promise<Response> promise);
+
+    void connect();
+    void scheduleConnect();
+    void backoff();
+
+    void failWaiting(const std::string& reason);
+    void failPending(const std::string& reason);
+
+    void scheduleTimeoutCheck();
+    void checkTimeouts();
+
+    enum class State {
+        Disconnected, Connecting, Connected, Closed,
+    };
+
+    const SocketAddress address_;
+    EventBase* const eventBase_;
+    const BookieClientConfig& config_;
+
+    State state_;
+
+    // Incremented on each new connection, to ignore the callbacks from previous ones
+    uint64_t generation_;
+
+    std::shared_ptr<AsyncSocket> socket_;
+    BookieClientPipeline::Ptr pipeline_;
+
+    // Requests waiting for the connection to be established
+    std::vector<std::pair<Request, Promise<Response>>> waiting_;
+
+    // Requests sent and waiting for a response. The same key can be outstanding more than once.
+    std::unordered_map<RequestKey, std::vector<PendingRequest>, RequestKeyHash> pending_;
+
+    milliseconds backoff_;
+    steady_clock::time_point nextConnectAttempt_;
+    bool connectScheduled_;
+    bool timeoutCheckScheduled_;
+};
+
+/**
+ * Last handler of a connection pipeline, forwarding the events to the connection
+ */
+class ResponseHandler: public HandlerAdapter<Response, Request> {
+public:
+    ResponseHandler(BookieConnection* connection, uint64_t generation) :
+            connection_(connection),
+            generation_(generation) {
+    }
+
+    void read(Context* ctx, Response response) override {
+        LOG_DEBUG("Received response: " << response);
+        connection_->onResponse(generation_, std::move(response));
+    }
+
+    void readEOF(Context* ctx) override {
+        close(ctx);
+        connection_->onDisconnected(generation_, "Connection closed by bookie");
+    }
+
+    void readException(Context* ctx, exception_wrapper e) override {
+        close(ctx);
+        connection_->onDisconnected(generation_, e.what().toStdString());
+    }
+
+private:
+    BookieConnection* const connection_;
+    const uint64_t generation_;
+};
+
+BookieConnection::BookieConnection(const SocketAddress& address, EventBase* eventBase,
+        const BookieClientConfig& config) :
+        address_(address),
+        eventBase_(eventBase),
+        config_(config),
+        state_(State::Disconnected),
+        generation_(0),
+        backoff_(config.reconnectBackoffInitial),
+        nextConnectAttempt_(),
+        connectScheduled_(false),
+        timeoutCheckScheduled_(false) {
+}
+
+Future<Response> BookieConnection::send(Request request) {
+    Promise<Response> promise;
+    Future<Response> future = promise.getFuture();
+
+    auto req = makeMoveWrapper(std::move(request));
+    auto pr = makeMoveWrapper(std::move(promise));
+    eventBase_->runInEventBaseThread([this, req, pr]() mutable {
+        sendNow(std::move(*req), std::move(*pr));
+    });
+
+    return future;
+}
+
+void BookieConnection::sendNow(Request request, Promise<Response> promise) {
+    switch (state_) {
+    case State::Connected: {
+        RequestKey key { request.opCode, request.ledgerId, request.entryId };
+        pending_[key].push_back( { std::move(promise), steady_clock::now() + config_.requestTimeout });
+        scheduleTimeoutCheck();
+
+        LOG_DEBUG("Sending request " << request << " to " << address_);
+        pipeline_->write(std::move(request));
+        break;
+    }
+
+    case State::Disconnected:
+        waiting_.emplace_back(std::move(request), std::move(promise));
+        scheduleConnect();
+        break;
+
+    case State::Connecting:
+        waiting_.emplace_back(std::move(request), std::move(promise));
+        break;
+
+    case State::Closed:
+        promise.setException(BookieException(BookieError::IOError, "Bookie client is closed"));
+        break;
+    }
+}
+
+void BookieConnection::onResponse(uint64_t generation, Response response) {
+    if (generation != generation_) {
+        return;
+    }
+
+    auto it = pending_.find( { response.opCode, response.ledgerId, response.entryId });
+    if (it == pending_.end()) {
+        LOG_WARN("Received unexpected response from " << address_ << ": " << response);
+        return;
+    }
+
+    Promise<Response> promise = std::move(it->second.front().promise);
+    it->second.erase(it->second.begin());
+    if (it->second.empty()) {
+        pending_.erase(it);
+    }
+
+    promise.setValue(std::move(response));
+}
+
+void BookieConnection::onDisconnected(uint64_t generation, const std::string& reason) {
+    if (generation != generation_ || state_ != State::Connected) {
+        return;
+    }
+
+    LOG_WARN("Disconnected from bookie " << address_ << ": " << reason);
+    state_ = State::Disconnected;
+
+    // The pipeline is still on the stack, release it in the next loop iteration
+    BookieClientPipeline::Ptr pipeline = std::move(pipeline_);
+    eventBase_->runInLoop([pipeline]() {});
+    socket_.reset();
+
+    failPending(reason);
+    backoff();
+
+    if (!waiting_.empty()) {
+        scheduleConnect();
+    }
+}
+
+void BookieConnection::connect() {
+    LOG_INFO("Connecting to bookie " << address_);
+    state_ = State::Connecting;
+    socket_ = AsyncSocket::newSocket(eventBase_);
+    socket_->connect(this, address_, config_.connectTimeout.count());
+}
+
+void BookieConnection::scheduleConnect() {
+    if (connectScheduled_ || state_ != State::Disconnected) {
+        return;
+    }
+
+    auto delay = duration_cast<milliseconds>(nextConnectAttempt_ - steady_clock::now());
+    if (delay.count() <= 0) {
+        connect();
+        return;
+    }
+
+    connectScheduled_ = true;
+    eventBase_->runAfterDelay([this]() {
+        connectScheduled_ = false;
+        if (state_ == State::Disconnected && !waiting_.empty()) {
+            connect();
+        }
+    }, delay.count());
+}
+
+void BookieConnection::backoff() {
+    // Use a random delay between half and the full backoff time, so that clients don't reconnect all at once
+    static thread_local std::mt19937 generator(std::random_device { }());
+    int64_t delay = std::uniform_int_distribution<int64_t>(backoff_.count() / 2, backoff_.count())(generator);
+
+    nextConnectAttempt_ = steady_clock::now() + milliseconds(delay);
+    backoff_ = std::min(backoff_ * 2, config_.reconnectBackoffMax);
+}
+
+void BookieConnection::connectSuccess() noexcept {
+    if (state_ == State::Closed) {
+        return;
+    }
+
+    LOG_INFO("Connected to bookie " << address_);
+    state_ = State::Connected;
+    backoff_ = config_.reconnectBackoffInitial;
+    ++generation_;
+
+    pipeline_ = BookieClientPipeline::create();
+    pipeline_->addBack(AsyncSocketHandler(socket_));
+    pipeline_->addBack(OutputBufferingHandler());
+    pipeline_->addBack(LengthFieldBasedFrameDecoder(4, BookieConstant::MaxFrameSize));
+    pipeline_->addBack(BookieClientCodecV2());
+    if (config_.addBatching.enabled()) {
+        pipeline_->addBack(std::make_shared<AddBatchingHandler>(eventBase_, config_.addBatching));
+    }
+    pipeline_->addBack(std::make_shared<ResponseHandler>(this, generation_));
+    pipeline_->finalize();
+    pipeline_->transportActive();
+
+    std::vector<std::pair<Request, Promise<Response>>> waiting;
+    waiting.swap(waiting_);
+    for (auto& request : waiting) {
+        sendNow(std::move(request.first), std::move(request.second));
+    }
+}
+
+void BookieConnection::connectErr(const AsyncSocketException& ex) noexcept {
+    LOG_WARN("Failed to connect to bookie " << address_ << ": " << ex.what());
+    socket_.reset();
+
+    if (state_ != State::Closed) {
+        state_ = State::Disconnected;
+        backoff();
+    }
+
+    failWaiting(ex.what());
+}
+
+void BookieConnection::shutdown() {
+    eventBase_->runInEventBaseThreadAndWait([this]() {
+        state_ = State::Closed;
+
+        if (pipeline_) {
+            pipeline_->close();
+            pipeline_.reset();
+        } else if (socket_) {
+            // Still connecting
+            socket_->closeNow();
+        }
+        socket_.reset();
+
+        failPending("Bookie client is closed");
+        failWaiting("Bookie client is closed");
+    });
+}
+
+void BookieConnection::failWaiting(const std::string& reason) {
+    std::vector<std::pair<Request, Promise<Response>>> waiting;
+    waiting.swap(waiting_);
+
+    for (auto& request : waiting) {
+        request.second.setException(BookieException(BookieError::IOError, reason));
+    }
+}
+
+void BookieConnection::failPending(const std::string& reason) {
+    std::unordered_map<RequestKey, std::vector<PendingRequest>, RequestKeyHash> pending;
+    pending.swap(pending_);
+
+    for (auto& entry : pending) {
+        for (auto& request : entry.second) {
+            request.promise.setException(BookieException(BookieError::IOError, reason));
+        }
+    }
+}
+
+void BookieConnection::scheduleTimeoutCheck() {
+    if (timeoutCheckScheduled_) {
+        return;
+    }
+
+    timeoutCheckScheduled_ = true;
+    eventBase_->runAfterDelay([this]() {
+        timeoutCheckScheduled_ = false;
+        checkTimeouts();
+    }, 1000);
+}
+
+void BookieConnection::checkTimeouts() {
+    if (state_ == State::Closed) {
+        return;
+    }
+
+    steady_clock::time_point now = steady_clock::now();
+    std::vector<Promise<Response>> expired;
+
+    for (auto it = pending_.begin(); it != pending_.end();) {
+        auto& requests = it->second;
+        while (!requests.empty() && requests.front().deadline <= now) {
+            expired.push_back(std::move(requests.front().promise));
+            requests.erase(requests.begin());
+        }
+
+        if (requests.empty()) {
+            it = pending_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    if (!pending_.empty()) {
+        scheduleTimeoutCheck();
+    }
+
+    for (auto& promise : expired) {
+        promise.setException(BookieException(BookieError::IOError, "Request timed out"));
+    }
+}
+
+/**
+ * Tracks the recent read latency of a bookie, to derive its speculative read timeout
+ */
+class ReadLatencyTracker {
+public:
+    explicit ReadLatencyTracker(const BookieClientConfig& config) :
+            config_(config),
+            histogram_(BucketSize, 0, microseconds(config.speculativeReadTimeoutMax).count()),
+            windowSamples_(0),
+            windowStart_(steady_clock::now()),
+            timeoutMillis_(config.speculativeReadTimeoutMax.count()) {
+    }
+
+    void addSample(steady_clock::duration latency) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        histogram_.addValue(duration_cast<microseconds>(latency).count());
+        ++windowSamples_;
+
+        // Recompute the timeout once per window, so that it follows the changes in the bookie latency
+        steady_clock::time_point now = steady_clock::now();
+        if (windowSamples_ < MaxWindowSamples && (windowSamples_ < MinWindowSamples || now - windowStart_ < seconds(1))) {
+            return;
+        }
+
+        int64_t estimateMicros = histogram_.getPercentileEstimate(config_.speculativeReadLatencyPercentile);
+        milliseconds timeout((estimateMicros + 999) / 1000);
+        timeout = std::max(config_.speculativeReadTimeoutMin, std::min(timeout, config_.speculativeReadTimeoutMax));
+        timeoutMillis_.store(timeout.count(), std::memory_order_relaxed);
+
+        histogram_.clear();
+        windowSamples_ = 0;
+        windowStart_ = now;
+    }
+
+    milliseconds speculativeTimeout() const {
+        return milliseconds(timeoutMillis_.load(std::memory_order_relaxed));
+    }
+
+private:
+    static constexpr int64_t BucketSize = 250;
+    static constexpr uint64_t MinWindowSamples = 100;
+    static constexpr uint64_t MaxWindowSamples = 10000;
+
+    const BookieClientConfig& config_;
+
+    std::mutex mutex_;
+    Histogram<int64_t> histogram_;
+    uint64_t windowSamples_;
+    steady_clock::time_point windowStart_;
+
+    std::atomic<int64_t> timeoutMillis_;
+};
+
+struct BookieClient::BookieState {
+    BookieState(const SocketAddress& address, const BookieClientConfig& config) :
+            address(address),
+            latency(config) {
+    }
+
+    const SocketAddress address;
+    std::vector<std::unique_ptr<BookieConnection>> connections;
+    ReadLatencyTracker latency;
+};
+
+struct BookieClient::EnsembleRead {
+    std::vector<BookieState*> bookies;
+    int64_t ledgerId;
+    int64_t entryId;
+
+    Promise<IOBufPtr> promise;
+
+    std::mutex mutex;
+    bool completed = false;
+    size_t nextBookie = 0;
+    int outstanding = 0;
+    exception_wrapper lastError;
+};
+
+// Maximum number of speculative requests that can be sent in a burst
+static const int64_t MaxSpeculativeReadTokens = 100 * 1000;
+
+BookieClient::BookieClient(const BookieClientConfig& config) :
+        config_(config),
+        ioExecutor_(std::make_shared<wangle::IOThreadPoolExecutor>(config.numIoThreads)),
+        speculativeReadTokens_(0),
+        speculativeReadCount_(0) {
+}
+
+BookieClient::~BookieClient() {
+    for (auto& bookie : bookies_) {
+        for (auto& connection : bookie.second->connections) {
+            connection->shutdown();
+        }
+    }
+
+    // Stop the IO threads before releasing the connections, since they might still have timers scheduled
+    ioExecutor_->join();
+}
+
+Future<Unit> BookieClient::addEntry(const SocketAddress& bookie, int64_t ledgerId, int64_t entryId, IOBufPtr data,
+        const MasterKey& masterKey) {
+    Request request { 2, BookieOperation::AddEntry, ledgerId, entryId, 0, std::move(data), masterKey };
+
+    return sendRequest(getBookie(bookie), std::move(request)).then([](Response response) {
+        if (response.errorCode != BookieError::OK) {
+            throw BookieException(response.errorCode, "Failed to add entry");
+        }
+    });
+}
+
+Future<IOBufPtr> BookieClient::readEntry(const SocketAddress& bookie, int64_t ledgerId, int64_t entryId) {
+    return readEntry(getBookie(bookie), ledgerId, entryId);
+}
+
+Future<IOBufPtr> BookieClient::readEntry(BookieState& bookie, int64_t ledgerId, int64_t entryId) {
+    Request request { 2, BookieOperation::ReadEntry, ledgerId, entryId, 0 };
+    steady_clock::time_point startTime = steady_clock::now();
+
+    return sendRequest(bookie, std::move(request)).then([&bookie, startTime](Response response) {
+        bookie.latency.addSample(steady_clock::now() - startTime);
+
+        if (response.errorCode != BookieError::OK) {
+            throw BookieException(response.errorCode, "Failed to read entry");
+        }
+
+        return response.data ? std::move(response.data) : IOBuf::create(0);
+    });
+}
+
+Future<IOBufPtr> BookieClient::readEntry(const std::vector<SocketAddress>& ensemble, int64_t ledgerId,
+        int64_t entryId) {
+    if (ensemble.empty()) {
+        return makeFuture<IOBufPtr>(BookieException(BookieError::BadRequest, "Empty ensemble"));
+    }
+
+    auto read = std::make_shared<EnsembleRead>();
+    for (const SocketAddress& bookie : ensemble) {
+        read->bookies.push_back(&getBookie(bookie));
+    }
+    read->ledgerId = ledgerId;
+    read->entryId = entryId;
+    Future<IOBufPtr> future = read->promise.getFuture();
+
+    // Each read adds a fraction of a speculative request to the budget
+    int64_t increment = config_.speculativeReadBudget * 1000;
+    int64_t tokens = speculativeReadTokens_.load();
+    while (tokens < MaxSpeculativeReadTokens
+            && !speculativeReadTokens_.compare_exchange_weak(tokens,
+                    std::min(tokens + increment, MaxSpeculativeReadTokens))) {
+    }
+
+    sendEnsembleRead(read);
+    return future;
+}
+
+void BookieClient::sendEnsembleRead(std::shared_ptr<EnsembleRead> read) {
+    BookieState* bookie;
+    {
+        std::lock_guard<std::mutex> lock(read->mutex);
+        if (read->completed || read->nextBookie == read->bookies.size()) {
+            return;
+        }
+
+        bookie = read->bookies[read->nextBookie++];
+        ++read->outstanding;
+    }
+
+    readEntry(*bookie, read->ledgerId, read->entryId).then([this, read](Try<IOBufPtr>&& result) {
+        {
+            std::unique_lock<std::mutex> lock(read->mutex);
+            --read->outstanding;
+
+            if (read->completed) {
+                // Reply from a slower bookie, after another one already answered
+                return;
+            }
+
+            if (result.hasValue()) {
+                read->completed = true;
+                lock.unlock();
+                read->promise.setValue(std::move(result.value()));
+                return;
+            }
+
+            read->lastError = result.exception();
+            if (read->nextBookie == read->bookies.size()) {
+                if (read->outstanding == 0) {
+                    read->completed = true;
+                    lock.unlock();
+                    read->promise.setException(read->lastError);
+                }
+                return;
+            }
+        }
+
+        // Failed on this bookie, try the next one right away
+        sendEnsembleRead(read);
+    });
+
+    if (config_.speculativeReads) {
+        scheduleSpeculativeRead(read, bookie->latency.speculativeTimeout());
+    }
+}
+
+void BookieClient::scheduleSpeculativeRead(std::shared_ptr<EnsembleRead> read, milliseconds timeout) {
+    EventBase* eventBase = ioExecutor_->getEventBase();
+    eventBase->runInEventBaseThread([this, eventBase, read, timeout]() {
+        eventBase->runAfterDelay([this, read]() {
+            {
+                std::lock_guard<std::mutex> lock(read->mutex);
+                if (read->completed || read->nextBookie == read->bookies.size()) {
+                    return;
+                }
+            }
+
+            if (!acquireSpeculativeReadPermit()) {
+                return;
+            }
+
+            LOG_DEBUG("Sending speculative read for " << read->ledgerId << "@" << read->entryId);
+            ++speculativeReadCount_;
+            sendEnsembleRead(read);
+        }, timeout.count());
+    });
+}
+
+bool BookieClient::acquireSpeculativeReadPermit() {
+    int64_t tokens = speculativeReadTokens_.load();
+    while (tokens >= 1000) {
+        if (speculativeReadTokens_.compare_exchange_weak(tokens, tokens - 1000)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+Future<Response> BookieClient::sendRequest(BookieState& bookie, Request request) {
+    size_t idx = (uint64_t) request.ledgerId % bookie.connections.size();
+    return bookie.connections[idx]->send(std::move(request));
+}
+
+BookieClient::BookieState& BookieClient::getBookie(const SocketAddress& address) {
+    {
+        SharedMutex::ReadHolder lock(mutex_);
+        auto it = bookies_.find(address);
+        if (it != bookies_.end()) {
+            return *it->second;
+        }
+    }
+
+    SharedMutex::WriteHolder lock(mutex_);
+    auto& bookie = bookies_[address];
+    if (!bookie) {
+        bookie = make_unique<BookieState>(address, config_);
+        for (int i = 0; i < config_.connectionsPerBookie; i++) {
+            bookie->connections.push_back(make_unique<BookieConnection>(address, ioExecutor_->getEventBase(), config_));
+        }
+    }
+
+    return *bookie;
+}
@@ -0,0 +1,161 @@
+/**
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#pragma once
+
+#include "AddBatchingHandler.h"
+#include "BookieProtocol.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <folly/SharedMutex.h>
+#include <folly/SocketAddress.h>
+#include <folly/futures/Future.h>
+#include <wangle/concurrent/IOThreadPoolExecutor.h>
+
+using namespace folly;
+using namespace std::chrono;
+
+/**
+ * Error returned by a bookie, or failure to communicate with it
+ */
+class BookieException: public std::exception {
+public:
+    BookieException(BookieError error, const std::string& msg);
+
+    const char* what() const noexcept override;
+
+    BookieError error() const {
+        return error_;
+    }
+
+private:
+    BookieError error_;
+    std::string msg_;
+};
+
+struct BookieClientConfig {
+    // Number of IO threads shared by all the connections
+    int numIoThreads = std::thread::hardware_concurrency();
+
+    // Requests for a given ledger always go through the same connection, to preserve their ordering
+    int connectionsPerBookie = 1;
+
+    milliseconds connectTimeout = seconds(10);
+    milliseconds requestTimeout = seconds(30);
+
+    // Delay before reconnecting after a connection failure. Doubles after each consecutive failure, with jitter.
+    milliseconds reconnectBackoffInitial = milliseconds(100);
+    milliseconds reconnectBackoffMax = seconds(10);
+
+    // Speculative reads: when reading from an ensemble, if a bookie has not replied within a timeout derived from its
+    // recent read latency, the entry is also requested from the next bookie and the first reply wins
+    bool speculativeReads = true;
+    double speculativeReadLatencyPercentile = 0.95;
+    milliseconds speculativeReadTimeoutMin = milliseconds(2);
+    milliseconds speculativeReadTimeoutMax = milliseconds(500);
+
+    // Maximum number of speculative requests, as a fraction of the ensemble reads
+    double speculativeReadBudget = 0.05;
+
+    // Coalesce the add entry requests of each connection. Disabled by default.
+    AddBatchingConfig addBatching;
+};
+
+class BookieConnection;
+
+/**
+ * Asynchronous client for the bookie V2 protocol.
+ *
+ * Keeps a pool of connections for each bookie. Requests are pipelined: any number of requests can be outstanding on
+ * each connection. Each connection is confined to a single IO thread, which owns its table of pending requests, so no
+ * locking is needed on the request path. Requests issued during the same event loop iteration are coalesced into a
+ * single socket write.
+ *
+ * All methods are thread-safe.
+ */
+class BookieClient {
+public:
+    explicit BookieClient(const BookieClientConfig& config = BookieClientConfig());
+    ~BookieClient();
+
+    BookieClient(const BookieClient&) = delete;
+    BookieClient& operator=(const BookieClient&) = delete;
+
+    /**
+     * Add an entry to a bookie. The bookie records the master key with the first entry of the ledger, and rejects the
+     * following adds with a different key (BookieError::UnauthorizedAccesss).
+     *
+     * @return a future completed when the bookie has persisted the entry, or failed with a BookieException
+     */
+    Future<Unit> addEntry(const SocketAddress& bookie, int64_t ledgerId, int64_t entryId, IOBufPtr data,
+            const MasterKey& masterKey = MasterKey());
+
+    /**
+     * Read an entry from a bookie. Use BookieConstant::LastAddConfirmed as entryId to read the last entry of the ledger.
+     *
+     * @return a future yielding the entry data, or failed with a BookieException (eg: BookieError::NoEntry)
+     */
+    Future<IOBufPtr> readEntry(const SocketAddress& bookie, int64_t ledgerId, int64_t entryId);
+
+    /**
+     * Read an entry from any of the bookies of an ensemble, trying them in order.
+     *
+     * The request is sent to the next bookie when the previous one fails or, with speculative reads enabled, when it
+     * is slower than usual. The first successful reply wins, and the late replies are discarded.
+     */
+    Future<IOBufPtr> readEntry(const std::vector<SocketAddress>& ensemble, int64_t ledgerId, int64_t entryId);
+
+    /**
+     * Number of speculative read requests sent so far
+     */
+    uint64_t speculativeReadCount() const {
+        return speculativeReadCount_.load();
+    }
+
+private:
+    struct BookieState;
+    struct EnsembleRead;
+
+    Future<Response> sendRequest(BookieState& bookie, Request request);
+
+    Future<IOBufPtr> readEntry(BookieState& bookie, int64_t ledgerId, int64_t entryId);
+
+    void sendEnsembleRead(std::shared_ptr<EnsembleRead> read);
+    void scheduleSpeculativeRead(std::shared_ptr<EnsembleRead> read, milliseconds timeout);
+    bool acquireSpeculativeReadPermit();
+
+    BookieState& getBookie(const SocketAddress& bookie);
+
+    const BookieClientConfig config_;
+    std::shared_ptr<wangle::IOThreadPoolExecutor> ioExecutor_;
+
+    SharedMutex mutex_;
+    std::unordered_map<SocketAddress, std::unique_ptr<BookieState>> bookies_;
+
+    // Token bucket for speculative reads, in thousandths of request
+    std::atomic<int64_t> speculativeReadTokens_;
+    std::atomic<uint64_t> speculativeReadCount_;
+};
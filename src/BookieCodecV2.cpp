@@ -54,7 +54,7 @@ void BookieServerCodecV2::read(Context* ctx, IOBufPtr buf) {
         return;
     }
 
-    Request request;
+    Request request { };
     PacketHeader hdr = PacketHeader::fromInt(reader.readBE<int32_t>());
     request.protocolVersion = hdr.version;
     request.opCode = hdr.opCode;
@@ -69,7 +69,7 @@ void BookieServerCodecV2::read(Context* ctx, IOBufPtr buf) {
             ctx->fireClose();
             return;
         }
-        reader.skip(BookieConstant::MasterKeyLength);
+        reader.pull(request.masterKey.data(), request.masterKey.size());
         request.ledgerId = reader.readBE<int64_t>();
         request.entryId = reader.readBE<int64_t>();
 
@@ -90,8 +90,7 @@ void BookieServerCodecV2::read(Context* ctx, IOBufPtr buf) {
         request.entryId = reader.readBE<int64_t>();
 
         if (request.isFencing()) {
-            // Fencing reads will provide the master key which we'll ignore
-            reader.skip(BookieConstant::MasterKeyLength);
+            reader.pull(request.masterKey.data(), request.masterKey.size());
         }
         break;
     }
@@ -106,9 +105,10 @@ void BookieServerCodecV2::read(Context* ctx, IOBufPtr buf) {
 Future<Unit> BookieServerCodecV2::write(Context* ctx, Response response) {
     LOG_DEBUG("Serializing response: " << response);
 
-    const int headerSize = 4 + 24;
-    const int frameSize = headerSize /* + sizeof(data) */;
-    const int bufferSize = frameSize + 4;
+    // Packet header, error code, ledgerId and entryId. Read responses are followed by the entry data.
+    const int headerSize = sizeof(int32_t) + sizeof(int32_t) + 2 * sizeof(int64_t);
+    const int frameSize = headerSize + (response.data ? response.data->computeChainDataLength() : 0);
+    const int bufferSize = headerSize + 4;
     IOBufPtr buf = IOBuf::create(bufferSize);
     buf->append(bufferSize);
 
@@ -131,8 +131,8 @@ Future<Unit> BookieServerCodecV2::write(Context* ctx, Response response) {
         writer.writeBE<int64_t>(response.entryId);
 
         if (response.data) {
-            // Also write data
-//            buf->
+            // Entry data is appended without copying
+            buf->prependChain(std::move(response.data));
         }
 
         break;
@@ -174,7 +174,10 @@ void BookieClientCodecV2::read(Context* ctx, IOBufPtr buf) {
         response.errorCode = (BookieError) reader.readBE<int32_t>();
         response.ledgerId = reader.readBE<int64_t>();
         response.entryId = reader.readBE<int64_t>();
-        // TODO
+
+        if (response.errorCode == BookieError::OK && reader.totalLength() > 0) {
+            reader.clone(response.data, reader.totalLength());
+        }
         break;
     }
     case BookieOperation::Auth:
@@ -189,8 +192,23 @@ void BookieClientCodecV2::read(Context* ctx, IOBufPtr buf) {
 Future<Unit> BookieClientCodecV2::write(Context* ctx, Request request) {
     LOG_DEBUG("Serializing request: " << request);
 
-    constexpr int headerSize = sizeof(int32_t) + BookieConstant::MasterKeyLength + 2 * sizeof(int64_t);
-    const int frameSize = headerSize + request.data->length();
+    int headerSize;
+    switch (request.opCode) {
+    case BookieOperation::AddEntry:
+        headerSize = sizeof(int32_t) + BookieConstant::MasterKeyLength + 2 * sizeof(int64_t);
+        break;
+
+    case BookieOperation::ReadEntry:
+        headerSize = sizeof(int32_t) + 2 * sizeof(int64_t)
+                + (request.isFencing() ? BookieConstant::MasterKeyLength : 0);
+        break;
+
+    default:
+        headerSize = sizeof(int32_t);
+        break;
+    }
+
+    const int frameSize = headerSize + (request.data ? request.data->computeChainDataLength() : 0);
     const int bufferSize = headerSize + 4;
 
     IOBufPtr buffer = IOBuf::create(bufferSize);
@@ -204,14 +222,18 @@ Future<Unit> BookieClientCodecV2::write(Context* ctx, Request request) {
 
     switch (request.opCode) {
     case BookieOperation::AddEntry:
-        writer.skip(BookieConstant::MasterKeyLength);
+        writer.push(request.masterKey.data(), request.masterKey.size());
         writer.writeBE<int64_t>(request.ledgerId);
         writer.writeBE<int64_t>(request.entryId);
         writer.insert(std::move(request.data));
         break;
 
     case BookieOperation::ReadEntry:
-        // TODO
+        writer.writeBE<int64_t>(request.ledgerId);
+        writer.writeBE<int64_t>(request.entryId);
+        if (request.isFencing()) {
+            writer.push(request.masterKey.data(), request.masterKey.size());
+        }
         break;
 
     case BookieOperation::Auth:
@@ -221,4 +243,3 @@ Future<Unit> BookieClientCodecV2::write(Context* ctx, Request request) {
 
     return ctx->fireWrite(std::move(buffer));
 }
-
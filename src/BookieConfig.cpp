@@ -20,12 +20,17 @@
  */
 #include "BookieConfig.h"
 #include <iostream>
+#include <stdexcept>
 
 #include <unistd.h>
 
+// The rate limiters count KB permits, and support less than 1M permits per second
+static const double MaxRateLimitMb = 976;
+
 BookieConfig::BookieConfig() :
         zkServers_(),
         zkSessionTimeout_(0),
+        zkRegistration_(true),
         bookiePort_(),
         dataDirectory_(),
         walDirectory_(),
@@ -40,12 +45,95 @@ BookieConfig::BookieConfig() :
     ("help,h", "This help message") //
     ("zkServers,z", po::value<std::string>(&zkServers_)->default_value("localhost:2181"), "List of ZooKeeper servers") //
     ("zkSessionTimeout", po::value<int>(&zkSessionTimeout_)->default_value(30000), "ZooKeeper session timeout") //
+    ("zkRegistration", po::value<bool>(&zkRegistration_)->default_value(true),
+            "Register the bookie in the metadata store. When disabled, no metadata store is used") //
+    ("metadataStore", po::value<std::string>(&metadataStore_)->default_value("zookeeper"),
+            "Metadata store backend: zookeeper, or local for single-node deployments and benchmarks") //
+    ("metadataStoreFile", po::value<std::string>(&metadataStoreFile_)->default_value(""),
+            "File where the local metadata store saves its data. In memory only when empty") //
     ("bookieHost", po::value<std::string>(&bookieHost_)->default_value(defaultHostname), "Boookie hostname") //
     ("bookiePort,p", po::value<int>(&bookiePort_)->default_value(3181), "Bookie TCP port") //
+    ("bookieBindAddress", po::value<std::string>(&bookieBindAddress_)->default_value("0.0.0.0"),
+            "Address the bookie listens on. All the interfaces by default") //
+    ("registrationUpdateIntervalSeconds", po::value<int>(&registrationUpdateIntervalSeconds_)->default_value(10),
+            "Interval to refresh the load stats published in the registration z-node. 0 to disable") //
+    ("registrationUpdateThreshold", po::value<double>(&registrationUpdateThreshold_)->default_value(0.2),
+            "Minimum relative change of the load stats to update the registration z-node") //
+    ("readOnlyFreeDiskThresholdMb", po::value<int64_t>(&readOnlyFreeDiskThresholdMb_)->default_value(0),
+            "Switch to read-only mode when the free disk space falls below this size. 0 to disable") //
     ("dataDir,d", po::value<std::string>(&dataDirectory_)->default_value("./data"), "Location where to store data") //
     ("walDir,w", po::value<std::string>(&walDirectory_)->default_value("./wal"),
             "Location where to put RocksDB Write-ahead-log") //
     ("fsyncWal,s", po::value<bool>(&fsyncWal_)->default_value(true), "Fsync the WAL before acking the entry") //
+    ("numReadThreads", po::value<int>(&numReadThreads_)->default_value(8), "Number of threads serving reads") //
+    ("ledgerMetadataCacheSize", po::value<int>(&ledgerMetadataCacheSize_)->default_value(100000),
+            "Max number of ledgers whose metadata is cached") //
+    ("partitionedIndexFilters", po::value<bool>(&partitionedIndexFilters_)->default_value(true),
+            "Split the index and filter of each database file into partitions loaded on demand in the block cache, "
+            "pinning only the top-level index") //
+    ("filterType", po::value<std::string>(&filterType_)->default_value("ribbon"),
+            "Filter of the database files: ribbon or bloom. Ribbon filters take ~30% less memory for the same false "
+            "positive rate") //
+    ("directIo", po::value<bool>(&directIo_)->default_value(false),
+            "Use direct IO for the database reads, flushes and compactions, bypassing the page cache. The block "
+            "cache is then the only cache of the stored entries") //
+    ("persistentCacheDir", po::value<std::string>(&persistentCacheDirectory_)->default_value(""),
+            "Directory on a local SSD for a second tier of block cache, behind the memory block cache. Disabled when "
+            "empty") //
+    ("persistentCacheSizeMb", po::value<uint64_t>(&persistentCacheSizeMb_)->default_value(64 * 1024),
+            "Size of the SSD block cache") //
+    ("warmUpRateMb", po::value<double>(&warmUpRateMb_)->default_value(200),
+            "Rate at which the block cache is warmed up on start, with the entries read before the restart, in MB/s. "
+            "0 to disable") //
+    ("hotRangesSaveIntervalSeconds", po::value<int>(&hotRangesSaveIntervalSeconds_)->default_value(300),
+            "Interval to save the ranges of entries recently read, used to warm up the block cache") //
+    ("tailCacheEntriesPerLedger", po::value<int>(&tailCacheEntriesPerLedger_)->default_value(64),
+            "Number of recently added entries cached for each ledger, for the tailing reads. 0 to disable") //
+    ("tailCacheMaxLedgers", po::value<int>(&tailCacheMaxLedgers_)->default_value(4096),
+            "Max number of ledgers in the tail cache") //
+    ("tailCacheMaxSizeMb", po::value<int>(&tailCacheMaxSizeMb_)->default_value(1024),
+            "Max memory held by the entries of the tail cache") //
+    ("autoRecovery", po::value<bool>(&autoRecovery_)->default_value(false),
+            "Run the auto-recovery worker, re-replicating into this bookie the ledgers of the lost bookies") //
+    ("recoveryRateLimitMb", po::value<double>(&recoveryRateLimitMb_)->default_value(20),
+            "Max rate at which the auto-recovery worker copies entries, in MB/s") //
+    ("recoveryReadWindow", po::value<int>(&recoveryReadWindow_)->default_value(64),
+            "Max number of outstanding entry reads while re-replicating a ledger") //
+    ("tieringStore", po::value<std::string>(&tieringStore_)->default_value(""),
+            "Secondary storage where the cold ledgers are offloaded: local. Disabled when empty") //
+    ("tieringDirectory", po::value<std::string>(&tieringDirectory_)->default_value("./tiered"),
+            "Location of the offloaded ledgers, with the local tiering store") //
+    ("tieringMmapReads", po::value<bool>(&tieringMmapReads_)->default_value(true),
+            "Read the offloaded segments through read-only memory mappings instead of pread, with the local tiering "
+            "store") //
+    ("tieringDropPageCache", po::value<bool>(&tieringDropPageCache_)->default_value(true),
+            "Drop the offloaded segments from the page cache once written and once read, relying on the tiering "
+            "block cache instead") //
+    ("tieringLedgerAgeHours", po::value<int>(&tieringLedgerAgeHours_)->default_value(168),
+            "Offload the ledgers closed for longer than this") //
+    ("tieringScanIntervalSeconds", po::value<int>(&tieringScanIntervalSeconds_)->default_value(3600),
+            "Interval between the scans for ledgers to offload") //
+    ("tieringCacheSizeMb", po::value<int64_t>(&tieringCacheSizeMb_)->default_value(256),
+            "Size of the cache of blocks read from the offloaded ledgers") //
+    ("captureFile", po::value<std::string>(&captureFile_)->default_value(""),
+            "Record the received requests into this file, to be replayed with replayClient") //
+    ("capturePayloads", po::value<bool>(&capturePayloads_)->default_value(false),
+            "Include the entries payload in the capture file. Otherwise only the payload sizes are recorded") //
+
+    ("faultWriteDelayProbability", po::value<double>(&faultWriteDelayProbability_)->default_value(0),
+            "Testing: probability for each disk write to be delayed") //
+    ("faultWriteDelayMillis", po::value<int>(&faultWriteDelayMillis_)->default_value(50),
+            "Testing: delay injected into disk writes") //
+    ("faultSyncDelayProbability", po::value<double>(&faultSyncDelayProbability_)->default_value(0),
+            "Testing: probability for each disk sync to be delayed") //
+    ("faultSyncDelayMillis", po::value<int>(&faultSyncDelayMillis_)->default_value(500),
+            "Testing: delay injected into disk syncs") //
+    ("faultDelayDistribution", po::value<std::string>(&faultDelayDistribution_)->default_value("fixed"),
+            "Testing: distribution of the injected delays: fixed, uniform or exponential") //
+    ("faultStallIntervalSeconds", po::value<int>(&faultStallIntervalSeconds_)->default_value(0),
+            "Testing: interval between simulated disk stalls") //
+    ("faultStallMillis", po::value<int>(&faultStallMillis_)->default_value(0),
+            "Testing: duration of the simulated disk stalls, blocking all writes and syncs") //
 
     ("statsReportingIntervalSeconds,r", po::value<int>(&statsReportingIntervalSeconds_)->default_value(60),
             "Interval for stats reporting") //
@@ -53,22 +141,84 @@ BookieConfig::BookieConfig() :
             ;
 }
 
+FaultInjectionOptions BookieConfig::faultInjectionOptions() const {
+    LatencyFault::Distribution distribution = LatencyFault::parseDistribution(faultDelayDistribution_);
+
+    FaultInjectionOptions options;
+    options.writeFault = { faultWriteDelayProbability_, milliseconds(faultWriteDelayMillis_), distribution };
+    options.syncFault = { faultSyncDelayProbability_, milliseconds(faultSyncDelayMillis_), distribution };
+    options.stallInterval = seconds(faultStallIntervalSeconds_);
+    options.stallDuration = milliseconds(faultStallMillis_);
+    return options;
+}
+
+void BookieConfig::validate() const {
+    if (filterType_ != "ribbon" && filterType_ != "bloom") {
+        throw std::invalid_argument("Invalid filter type: " + filterType_);
+    }
+
+    if (metadataStore_ != "zookeeper" && metadataStore_ != "local") {
+        throw std::invalid_argument("Invalid metadata store: " + metadataStore_);
+    }
+
+    if (!tieringStore_.empty() && tieringStore_ != "local") {
+        throw std::invalid_argument("Invalid tiering store: " + tieringStore_);
+    }
+
+    if (warmUpRateMb_ < 0 || warmUpRateMb_ >= MaxRateLimitMb) {
+        throw std::invalid_argument("warmUpRateMb must be at least 0 and less than 976");
+    }
+
+    if (hotRangesSaveIntervalSeconds_ <= 0) {
+        throw std::invalid_argument("hotRangesSaveIntervalSeconds must be positive");
+    }
+
+    if (autoRecovery_ && (recoveryRateLimitMb_ <= 0 || recoveryRateLimitMb_ >= MaxRateLimitMb)) {
+        throw std::invalid_argument("recoveryRateLimitMb must be more than 0 and less than 976");
+    }
+
+    if (ledgerMetadataCacheSize_ < 0) {
+        throw std::invalid_argument("ledgerMetadataCacheSize must not be negative");
+    }
+
+    if (tailCacheEntriesPerLedger_ < 0 || tailCacheMaxLedgers_ < 0) {
+        throw std::invalid_argument("tailCacheEntriesPerLedger and tailCacheMaxLedgers must not be negative");
+    }
+
+    if (tailCacheMaxSizeMb_ <= 0) {
+        throw std::invalid_argument("tailCacheMaxSizeMb must be positive");
+    }
+
+    LatencyFault::parseDistribution(faultDelayDistribution_);
+}
+
 bool BookieConfig::parse(int argc, char** argv) {
+    return parse(argc, argv, po::options_description());
+}
+
+bool BookieConfig::parse(int argc, char** argv, const po::options_description& extraOptions) {
+    po::options_description allOptions;
+    allOptions.add(options_);
+    if (!extraOptions.options().empty()) {
+        allOptions.add(extraOptions);
+    }
+
     po::variables_map map;
     try {
-        po::store(po::command_line_parser(argc, argv).options(options_).run(), map);
+        po::store(po::command_line_parser(argc, argv).options(allOptions).run(), map);
         po::notify(map);
 
         if (map.count("help")) {
-            std::cerr << options_ << std::endl;
+            std::cerr << allOptions << std::endl;
             exit(1);
         }
 
+        validate();
         return true;
     }
     catch (const std::exception& e) {
         std::cerr << "Error parsing parameters -- " << e.what() << std::endl << std::endl;
-        std::cerr << options_ << std::endl;
+        std::cerr << allOptions << std::endl;
         return false;
     }
 }
@@ -24,6 +24,8 @@
 #include <string>
 #include <boost/program_options.hpp>
 
+#include "FaultInjectionEnv.h"
+
 namespace po = boost::program_options;
 
 using namespace std::chrono;
@@ -34,6 +36,12 @@ public:
 
     bool parse(int argc, char** argv);
 
+    /**
+     * Parse the bookie options together with additional options defined by the caller (eg: a benchmark tool
+     * embedding the bookie). The additional options are stored into the caller-provided variables.
+     */
+    bool parse(int argc, char** argv, const po::options_description& extraOptions);
+
     const std::string& zkServers() const {
         return zkServers_;
     }
@@ -50,6 +58,50 @@ public:
         return bookiePort_;
     }
 
+    void setBookiePort(int bookiePort) {
+        bookiePort_ = bookiePort;
+    }
+
+    const std::string& bookieBindAddress() const {
+        return bookieBindAddress_;
+    }
+
+    void setBookieBindAddress(const std::string& bookieBindAddress) {
+        bookieBindAddress_ = bookieBindAddress;
+    }
+
+    const std::string& metadataStore() const {
+        return metadataStore_;
+    }
+
+    const std::string& metadataStoreFile() const {
+        return metadataStoreFile_;
+    }
+
+    void setMetadataStore(const std::string& metadataStore) {
+        metadataStore_ = metadataStore;
+    }
+
+    bool zkRegistration() const {
+        return zkRegistration_;
+    }
+
+    void setZkRegistration(bool zkRegistration) {
+        zkRegistration_ = zkRegistration;
+    }
+
+    seconds registrationUpdateInterval() const {
+        return seconds(registrationUpdateIntervalSeconds_);
+    }
+
+    double registrationUpdateThreshold() const {
+        return registrationUpdateThreshold_;
+    }
+
+    int64_t readOnlyFreeDiskThresholdBytes() const {
+        return readOnlyFreeDiskThresholdMb_ * 1024 * 1024;
+    }
+
     const std::string& dataDirectory() const {
         return dataDirectory_;
     }
@@ -62,20 +114,169 @@ public:
         return fsyncWal_;
     }
 
+    int numReadThreads() const {
+        return numReadThreads_;
+    }
+
+    int ledgerMetadataCacheSize() const {
+        return ledgerMetadataCacheSize_;
+    }
+
+    bool autoRecovery() const {
+        return autoRecovery_;
+    }
+
+    double recoveryRateLimitMb() const {
+        return recoveryRateLimitMb_;
+    }
+
+    int recoveryReadWindow() const {
+        return recoveryReadWindow_;
+    }
+
+    bool partitionedIndexFilters() const {
+        return partitionedIndexFilters_;
+    }
+
+    const std::string& filterType() const {
+        return filterType_;
+    }
+
+    bool directIo() const {
+        return directIo_;
+    }
+
+    const std::string& persistentCacheDirectory() const {
+        return persistentCacheDirectory_;
+    }
+
+    uint64_t persistentCacheSizeBytes() const {
+        return persistentCacheSizeMb_ * 1024 * 1024;
+    }
+
+    double warmUpRateMb() const {
+        return warmUpRateMb_;
+    }
+
+    seconds hotRangesSaveInterval() const {
+        return seconds(hotRangesSaveIntervalSeconds_);
+    }
+
+    int tailCacheEntriesPerLedger() const {
+        return tailCacheEntriesPerLedger_;
+    }
+
+    int tailCacheMaxLedgers() const {
+        return tailCacheMaxLedgers_;
+    }
+
+    uint64_t tailCacheMaxSizeBytes() const {
+        return static_cast<uint64_t>(tailCacheMaxSizeMb_) * 1024 * 1024;
+    }
+
+    const std::string& tieringStore() const {
+        return tieringStore_;
+    }
+
+    const std::string& tieringDirectory() const {
+        return tieringDirectory_;
+    }
+
+    bool tieringMmapReads() const {
+        return tieringMmapReads_;
+    }
+
+    bool tieringDropPageCache() const {
+        return tieringDropPageCache_;
+    }
+
+    hours tieringLedgerAge() const {
+        return hours(tieringLedgerAgeHours_);
+    }
+
+    seconds tieringScanInterval() const {
+        return seconds(tieringScanIntervalSeconds_);
+    }
+
+    int64_t tieringCacheSizeBytes() const {
+        return tieringCacheSizeMb_ * 1024 * 1024;
+    }
+
+    const std::string& captureFile() const {
+        return captureFile_;
+    }
+
+    bool capturePayloads() const {
+        return capturePayloads_;
+    }
+
+    /**
+     * Latency to inject into the disk writes and syncs, for testing
+     */
+    FaultInjectionOptions faultInjectionOptions() const;
+
     seconds statsReportingInterval() const {
         return seconds(statsReportingIntervalSeconds_);
     }
 
 private:
+    /**
+     * Reject the values the bookie would only fail on after its threads are started
+     */
+    void validate() const;
+
     std::string zkServers_;
     int zkSessionTimeout_;
+    bool zkRegistration_;
+    std::string metadataStore_;
+    std::string metadataStoreFile_;
 
     std::string bookieHost_;
     int bookiePort_;
+    std::string bookieBindAddress_;
+
+    int registrationUpdateIntervalSeconds_;
+    double registrationUpdateThreshold_;
+    int64_t readOnlyFreeDiskThresholdMb_;
 
     std::string dataDirectory_;
     std::string walDirectory_;
     bool fsyncWal_;
+    int numReadThreads_;
+    int ledgerMetadataCacheSize_;
+    int tailCacheEntriesPerLedger_;
+    bool partitionedIndexFilters_;
+    std::string filterType_;
+    bool directIo_;
+    std::string persistentCacheDirectory_;
+    double warmUpRateMb_;
+    int hotRangesSaveIntervalSeconds_;
+    uint64_t persistentCacheSizeMb_;
+    int tailCacheMaxLedgers_;
+    int tailCacheMaxSizeMb_;
+
+    bool autoRecovery_;
+    double recoveryRateLimitMb_;
+    int recoveryReadWindow_;
+
+    std::string tieringStore_;
+    std::string tieringDirectory_;
+    bool tieringMmapReads_;
+    bool tieringDropPageCache_;
+    int tieringLedgerAgeHours_;
+    int tieringScanIntervalSeconds_;
+    int64_t tieringCacheSizeMb_;
+
+    std::string captureFile_;
+    bool capturePayloads_;
+
+    double faultWriteDelayProbability_;
+    int faultWriteDelayMillis_;
+    double faultSyncDelayProbability_;
+    int faultSyncDelayMillis_;
+    std::string faultDelayDistribution_;
+    int faultStallIntervalSeconds_;
+    int faultStallMillis_;
 
     int statsReportingIntervalSeconds_;
 
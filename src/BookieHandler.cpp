@@ -21,12 +21,18 @@
 #include "Logging.h"
 #include "BookieHandler.h"
 #include "Bookie.h"
+#include "TrafficCapture.h"
 
 DECLARE_LOG_OBJECT();
 
-BookieHandler::BookieHandler(Bookie& bookie, MetricsManager& metricsManager) :
+static std::atomic<uint32_t> connectionIdGenerator;
+
+BookieHandler::BookieHandler(Bookie& bookie, MetricsManager& metricsManager, TrafficCapture* trafficCapture) :
         bookie_(bookie),
-        addEntryLatency_(metricsManager.createMetric("addEntry")) {
+        trafficCapture_(trafficCapture),
+        connectionId_(connectionIdGenerator++),
+        addEntryLatency_(metricsManager.createMetric("addEntry")),
+        readEntryLatency_(metricsManager.createMetric("readEntry")) {
 }
 
 void BookieHandler::transportActive(Context* ctx) {
@@ -41,6 +47,19 @@ void BookieHandler::readEOF(Context* ctx) {
 }
 
 void BookieHandler::read(Context* ctx, Request request) {
+    if (trafficCapture_) {
+        trafficCapture_->record(connectionId_, request);
+    }
+
+    // Negative ids are reserved (eg: BookieConstant::InvalidLedgerId), they never reach the ledger state tables
+    if (UNLIKELY(request.ledgerId < 0)
+            && (request.opCode == BookieOperation::AddEntry || request.opCode == BookieOperation::ReadEntry)) {
+        LOG_WARN("Rejecting request with invalid ledger id " << request.ledgerId << " from " << peerAddress_);
+        Response response {2, request.opCode, BookieError::BadRequest, request.ledgerId, request.entryId};
+        write(ctx, std::move(response));
+        return;
+    }
+
     switch (request.opCode) {
     case BookieOperation::AddEntry:
         handleAddEntry(ctx, std::move(request));
@@ -58,9 +77,31 @@ void BookieHandler::handleAddEntry(Context* ctx, Request request) {
     int64_t entryId = request.entryId;
     uint64_t entryLength = request.data->length();
 
+    if (UNLIKELY(bookie_.isReadOnly())) {
+        Response response {2, BookieOperation::AddEntry, BookieError::ReadOnly, ledgerId, entryId};
+        write(ctx, std::move(response));
+        return;
+    }
+
+    if (UNLIKELY(!bookie_.verifyMasterKey(ledgerId, request.masterKey))) {
+        LOG_WARN("Rejecting add entry " << ledgerId << ":" << entryId << " from " << peerAddress_ << " -- Wrong master key");
+        Response response {2, BookieOperation::AddEntry, BookieError::UnauthorizedAccesss, ledgerId, entryId};
+        write(ctx, std::move(response));
+        return;
+    }
+
+    // Recovery adds are still accepted, to let the recovery process re-replicate the tail of the ledger
+    if (UNLIKELY(bookie_.isFenced(ledgerId)) && !request.isRecovery()) {
+        LOG_DEBUG("Rejecting add entry " << ledgerId << ":" << entryId << " on fenced ledger");
+        Response response {2, BookieOperation::AddEntry, BookieError::Fenced, ledgerId, entryId};
+        write(ctx, std::move(response));
+        return;
+    }
+
     Clock::time_point start = Clock::now();
 
-    Future<Unit> future = bookie_.addEntry(request.ledgerId, request.entryId, std::move(request.data)); //
+    Future<Unit> future = bookie_.addEntry(request.ledgerId, request.entryId, std::move(request.data),
+            request.isRecovery()); //
     future.then(ctx->getTransport()->getEventBase(), [=](Unit u) {
         LOG_DEBUG("Entry persisted at " << ledgerId << ":" << entryId << " -- size: " << entryLength);
         Response response {2, BookieOperation::AddEntry, BookieError::OK, ledgerId, entryId};
@@ -69,6 +110,12 @@ void BookieHandler::handleAddEntry(Context* ctx, Request request) {
 
         addEntryLatency_->addLatencySample(Clock::now() - start);
     }) //
+    .onError([=](const LedgerFencedException& e) {
+        LOG_DEBUG("Rejecting add entry " << ledgerId << ":" << entryId << " on fenced ledger");
+        Response response {2, BookieOperation::AddEntry, BookieError::Fenced, ledgerId, entryId};
+
+        write(ctx, std::move(response));
+    }) //
     .onError([=](const std::exception& e) {
         LOG_WARN("Failed to persist entry at " << ledgerId << ":" << entryId << " : " << e.what());
         Response response {2, BookieOperation::AddEntry, BookieError::IOError, ledgerId, entryId};
@@ -78,5 +125,39 @@ void BookieHandler::handleAddEntry(Context* ctx, Request request) {
 }
 
 void BookieHandler::handleReadEntry(Context* ctx, Request request) {
+    int64_t ledgerId = request.ledgerId;
+    int64_t entryId = request.entryId;
+
+    if (request.isFencing() && UNLIKELY(!bookie_.verifyMasterKey(ledgerId, request.masterKey))) {
+        LOG_WARN("Rejecting fencing read on ledger " << ledgerId << " from " << peerAddress_ << " -- Wrong master key");
+        Response response {2, BookieOperation::ReadEntry, BookieError::UnauthorizedAccesss, ledgerId, entryId};
+        write(ctx, std::move(response));
+        return;
+    }
+
+    Clock::time_point start = Clock::now();
+
+    // Fencing reads only return the entry once the fenced state is persisted
+    Future<IOBufPtr> future = request.isFencing() ? bookie_.fenceLedger(ledgerId).then([this, ledgerId, entryId]() {
+        return bookie_.readEntry(ledgerId, entryId);
+    }) : bookie_.readEntry(ledgerId, entryId);
+
+    future.then(ctx->getTransport()->getEventBase(), [=](IOBufPtr data) {
+        if (data) {
+            LOG_DEBUG("Read entry " << ledgerId << ":" << entryId << " -- size: " << data->length());
+            Response response {2, BookieOperation::ReadEntry, BookieError::OK, ledgerId, entryId, std::move(data)};
+            write(ctx, std::move(response));
+        } else {
+            Response response {2, BookieOperation::ReadEntry, BookieError::NoEntry, ledgerId, entryId};
+            write(ctx, std::move(response));
+        }
+
+        readEntryLatency_->addLatencySample(Clock::now() - start);
+    }) //
+    .onError([=](const std::exception& e) {
+        LOG_WARN("Failed to read entry at " << ledgerId << ":" << entryId << " : " << e.what());
+        Response response {2, BookieOperation::ReadEntry, BookieError::IOError, ledgerId, entryId};
 
+        write(ctx, std::move(response));
+    });
 }
@@ -30,10 +30,11 @@ using namespace wangle;
 using namespace folly;
 
 class Bookie;
+class TrafficCapture;
 
 class BookieHandler: public HandlerAdapter<Request, Response> {
 public:
-    BookieHandler(Bookie& bookie, MetricsManager& metricsManager);
+    BookieHandler(Bookie& bookie, MetricsManager& metricsManager, TrafficCapture* trafficCapture);
 
     virtual void transportActive(Context* ctx) override;
 
@@ -48,5 +49,9 @@ private:
     Bookie& bookie_;
     SocketAddress peerAddress_;
 
+    TrafficCapture* trafficCapture_;
+    const uint32_t connectionId_;
+
     MetricPtr addEntryLatency_;
+    MetricPtr readEntryLatency_;
 };
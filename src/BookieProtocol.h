@@ -22,6 +22,7 @@
 
 #include <folly/io/IOBuf.h>
 
+#include <array>
 #include <iosfwd>
 
 using folly::IOBuf;
@@ -120,6 +121,9 @@ enum class BookieFlag
 struct BookieConstant {
     static const int64_t InvalidLedgerId = -1L;
     static const int64_t InvalidEntryId = -1L;
+
+    // Reading this entryId returns the last entry stored for the ledger
+    static const int64_t LastAddConfirmed = -1L;
     static const uint32_t MasterKeyLength = 20;
 
     static constexpr uint32_t MaxFrameSize = 5 * 1024 * 1024;
@@ -127,6 +131,11 @@ struct BookieConstant {
 
 typedef std::unique_ptr<IOBuf> IOBufPtr;
 
+/**
+ * Key derived by the client from the ledger password, sent with the adds and the fencing reads
+ */
+typedef std::array<uint8_t, BookieConstant::MasterKeyLength> MasterKey;
+
 struct Request {
     int8_t protocolVersion;
     BookieOperation opCode;
@@ -136,8 +145,8 @@ struct Request {
 
     IOBufPtr data;
 
-    // Master key not supported
-    // int8_t[] masterKey;
+    // All zeros when not set
+    MasterKey masterKey;
 
     bool isRecovery() const {
         return flags & (int16_t) BookieFlag::Recovery;
@@ -21,41 +21,191 @@
 #include "Bookie.h"
 #include "BookieRegistration.h"
 #include "Logging.h"
-#include "ZooKeeper.h"
+#include "MetadataStore.h"
 
-#include <folly/io/async/EventBaseManager.h>
-using folly::EventBaseManager;
+#include <cmath>
+#include <random>
+
+#include <folly/dynamic.h>
+#include <folly/json.h>
 
 DECLARE_LOG_OBJECT();
 
-BookieRegistration::BookieRegistration(ZooKeeper* zk, const BookieConfig& conf) :
-        zk_(zk) {
+static const milliseconds RetryBackoffInitial = seconds(1);
+static const milliseconds RetryBackoffMax = seconds(30);
+
+// Even when the stats don't change, the z-node content is refreshed at this multiple of the update interval
+static const int MaxSkippedUpdates = 10;
+
+BookieRegistration::BookieRegistration(MetadataStore* metadataStore, const BookieConfig& conf,
+        LoadStatsProvider loadStatsProvider) :
+        metadataStore_(metadataStore),
+        loadStatsProvider_(loadStatsProvider),
+        updateInterval_(conf.registrationUpdateInterval()),
+        updateThreshold_(conf.registrationUpdateThreshold()),
+        registered_(false),
+        sessionGeneration_(0),
+        retryBackoff_(RetryBackoffInitial),
+        lastPublished_(),
+        lastPublishTime_(),
+        eventBaseThread_() {
     registrationPath_ = format("/ledgers/available/{}:{}", conf.bookieHost(), conf.bookiePort()).str();
-    zk_->registerSessionListener(std::bind(&BookieRegistration::handleNewZooKeeperSession, this));
+    metadataStore_->registerSessionListener(std::bind(&BookieRegistration::handleNewSession, this));
+
+    if (updateInterval_.count() > 0) {
+        eventBaseThread_.getEventBase()->runInEventBaseThread([this]() {
+            scheduleUpdate();
+        });
+    }
 }
 
-void BookieRegistration::handleNewZooKeeperSession() {
-    LOG_INFO("Registering bookie on new ZK session");
-    registerBookie();
+void BookieRegistration::handleNewSession() {
+    eventBaseThread_.getEventBase()->runInEventBaseThread([this]() {
+        LOG_INFO("Registering bookie on new metadata store session");
+        ++sessionGeneration_;
+        registered_ = false;
+        retryBackoff_ = RetryBackoffInitial;
+        registerBookie();
+    });
 }
 
 void BookieRegistration::registerBookie() {
-    zk_->create(registrationPath_, "", { ZooKeeper::CreateFlag::Ephemeral }) //
-    .onError([this](const ZooKeeperException& e) {
-        // TODO: deferred task is not working
-        LOG_FATAL("Error registering bookie: " << e.what() << " -- Exiting");
-        std::exit(1);
-//        LOG_WARN("Error registering bookie: " << e.what() << " -- Retrying later");
-//
-//            EventBaseManager::get()->getEventBase()->runAfterDelay([this]() {
-//                        LOG_INFO("Retrying bookie registration after error");
-//                        this->registerBookie();
-//                    }, std::chrono::milliseconds(10000).count());
-            return std::string("");
-        }) //
-    .then([](std::string path) {
-        if (!path.empty()) {
-            LOG_INFO("Registered bookie at " << path);
+    BookieLoadStats stats = loadStatsProvider_();
+    uint64_t generation = sessionGeneration_;
+
+    metadataStore_->create(registrationPath_, serialize(stats), { MetadataStore::CreateFlag::Ephemeral }) //
+    .then(eventBaseThread_.getEventBase(), [this, stats, generation](Try<std::string>&& path) {
+        if (generation != sessionGeneration_) {
+            // A new session was established in the meantime
+            return;
+        }
+
+        if (path.hasValue()) {
+            LOG_INFO("Registered bookie at " << path.value());
+            registrationCompleted(stats);
+        } else {
+            handleRegistrationError(path.exception(), stats);
+        }
+    });
+}
+
+void BookieRegistration::handleRegistrationError(const exception_wrapper& error, const BookieLoadStats& stats) {
+    MetadataError zkError = MetadataError::SystemError;
+    error.with_exception<MetadataException>([&](const MetadataException& e) {
+        zkError = e.error();
+    });
+
+    if (zkError == MetadataError::NodeExists) {
+        checkExistingRegistration(stats);
+    } else {
+        LOG_WARN("Error registering bookie: " << error.what());
+        scheduleRetry();
+    }
+}
+
+void BookieRegistration::checkExistingRegistration(const BookieLoadStats& stats) {
+    uint64_t generation = sessionGeneration_;
+
+    metadataStore_->exists(registrationPath_).then(eventBaseThread_.getEventBase(),
+            [this, stats, generation](Try<Optional<NodeStat>>&& stat) {
+                if (generation != sessionGeneration_) {
+                    return;
+                }
+
+                if (stat.hasException()) {
+                    LOG_WARN("Error checking existing bookie registration: " << stat.exception().what());
+                    scheduleRetry();
+                } else if (!stat.value()) {
+                    // Removed in the meantime
+                    registerBookie();
+                } else if (stat.value()->ephemeralOwner == metadataStore_->sessionId()) {
+                    LOG_INFO("Bookie is already registered at " << registrationPath_);
+                    registrationCompleted(stats);
+                } else {
+                    LOG_WARN("Bookie registration z-node " << registrationPath_ << " is owned by session "
+                            << format("0x{0:x}", stat.value()->ephemeralOwner) << " -- Waiting for it to expire");
+                    scheduleRetry();
+                }
+            });
+}
+
+void BookieRegistration::registrationCompleted(const BookieLoadStats& stats) {
+    registered_ = true;
+    retryBackoff_ = RetryBackoffInitial;
+    lastPublished_ = stats;
+    lastPublishTime_ = steady_clock::now();
+}
+
+void BookieRegistration::scheduleRetry() {
+    static thread_local std::mt19937 generator(std::random_device { }());
+    int64_t delay = std::uniform_int_distribution<int64_t>(retryBackoff_.count() / 2, retryBackoff_.count())(generator);
+    retryBackoff_ = std::min(retryBackoff_ * 2, RetryBackoffMax);
+
+    LOG_INFO("Retrying bookie registration in " << delay << " ms");
+    uint64_t generation = sessionGeneration_;
+    eventBaseThread_.getEventBase()->runAfterDelay([this, generation]() {
+        if (generation == sessionGeneration_) {
+            registerBookie();
         }
+    }, delay);
+}
+
+void BookieRegistration::scheduleUpdate() {
+    eventBaseThread_.getEventBase()->runAfterDelay([this]() {
+        updateLoadStats();
+        scheduleUpdate();
+    }, milliseconds(updateInterval_).count());
+}
+
+void BookieRegistration::updateLoadStats() {
+    if (!registered_) {
+        // The stats will be published with the registration
+        return;
+    }
+
+    BookieLoadStats stats = loadStatsProvider_();
+    if (!hasChanged(stats) && steady_clock::now() - lastPublishTime_ < updateInterval_ * MaxSkippedUpdates) {
+        return;
+    }
+
+    LOG_DEBUG("Publishing bookie load stats: " << serialize(stats));
+    lastPublished_ = stats;
+    lastPublishTime_ = steady_clock::now();
+
+    metadataStore_->setData(registrationPath_, serialize(stats)).onError([](const MetadataException& e) {
+        // The registration z-node is re-created, with fresh stats, when the session is re-established
+        LOG_WARN("Failed to publish bookie load stats: " << e.what());
+        return NodeStat();
     });
 }
+
+/**
+ * Relative change check, ignoring the changes below a minimum absolute value
+ */
+static bool hasChanged(double current, double previous, double threshold, double minValue) {
+    return std::abs(current - previous) > threshold * std::max(std::abs(previous), minValue);
+}
+
+bool BookieRegistration::hasChanged(const BookieLoadStats& stats) const {
+    if (!lastPublished_) {
+        return true;
+    }
+
+    const BookieLoadStats& last = *lastPublished_;
+    return stats.readOnly != last.readOnly //
+            || ::hasChanged(stats.journalQueueDepth, last.journalQueueDepth, updateThreshold_, 100) //
+            || ::hasChanged(stats.addLatencyP99Millis, last.addLatencyP99Millis, updateThreshold_, 1.0) //
+            || ::hasChanged(stats.freeDiskBytes, last.freeDiskBytes, updateThreshold_, 1024.0 * 1024 * 1024);
+}
+
+std::string BookieRegistration::serialize(const BookieLoadStats& stats) {
+    dynamic json = dynamic::object //
+            ("journalQueueDepth", stats.journalQueueDepth) //
+            ("addLatencyP99Ms", stats.addLatencyP99Millis) //
+            ("freeDiskBytes", stats.freeDiskBytes) //
+            ("readOnly", stats.readOnly);
+
+    json::serialization_opts opts;
+    opts.sort_keys = true;
+    return json::serialize(json, opts);
+}
@@ -20,23 +20,77 @@
  */
 #pragma once
 
-class ZooKeeper;
+class MetadataStore;
 class BookieConfig;
 
+#include <chrono>
+#include <functional>
 #include <string>
 
+#include <folly/ExceptionWrapper.h>
+#include <folly/Optional.h>
+#include <folly/io/async/ScopedEventBaseThread.h>
+
+using namespace std::chrono;
+
 /**
- * Register the bookie under /ledgers/available and makes sure the z-node is re-created after the session expires
+ * Load indicators published in the bookie registration z-node, for the clients placement policies
+ */
+struct BookieLoadStats {
+    int64_t journalQueueDepth;
+    double addLatencyP99Millis;
+    int64_t freeDiskBytes;
+    bool readOnly;
+};
+
+/**
+ * Register the bookie under /ledgers/available and makes sure the z-node is re-created after the session expires.
+ *
+ * Registration failures are retried with a jittered exponential backoff, and never stop the bookie: entries keep being
+ * served while the metadata store is unavailable. If the z-node already exists, the registration completes if it belongs to the
+ * current session, otherwise it waits for the previous owner session to expire.
+ *
+ * The z-node content is a JSON document with the bookie load stats. It is refreshed periodically, but only written
+ * when the stats have changed significantly, to limit the load on the metadata store.
  */
 class BookieRegistration {
 public:
-    BookieRegistration(ZooKeeper* zk_, const BookieConfig& conf);
+    typedef std::function<BookieLoadStats()> LoadStatsProvider;
+
+    BookieRegistration(MetadataStore* metadataStore, const BookieConfig& conf, LoadStatsProvider loadStatsProvider);
 
 private:
-    void handleNewZooKeeperSession();
+    void handleNewSession();
 
     void registerBookie();
+    void handleRegistrationError(const folly::exception_wrapper& error, const BookieLoadStats& stats);
+    void checkExistingRegistration(const BookieLoadStats& stats);
+    void registrationCompleted(const BookieLoadStats& stats);
+    void scheduleRetry();
 
-    ZooKeeper* zk_;
+    void scheduleUpdate();
+    void updateLoadStats();
+
+    bool hasChanged(const BookieLoadStats& stats) const;
+
+    static std::string serialize(const BookieLoadStats& stats);
+
+    MetadataStore* metadataStore_;
     std::string registrationPath_;
+    LoadStatsProvider loadStatsProvider_;
+
+    const seconds updateInterval_;
+    const double updateThreshold_;
+
+    // Only accessed from the registration event base thread
+    bool registered_;
+
+    // Incremented on each new session, to discard the retries of the previous sessions
+    uint64_t sessionGeneration_;
+    milliseconds retryBackoff_;
+
+    folly::Optional<BookieLoadStats> lastPublished_;
+    steady_clock::time_point lastPublishTime_;
+
+    folly::ScopedEventBaseThread eventBaseThread_;
 };
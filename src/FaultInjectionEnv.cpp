@@ -0,0 +1,224 @@
+/**
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "FaultInjectionEnv.h"
+#include "Logging.h"
+
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+using namespace rocksdb;
+
+DECLARE_LOG_OBJECT();
+
+LatencyFault::Distribution LatencyFault::parseDistribution(const std::string& name) {
+    if (name == "fixed") {
+        return Distribution::Fixed;
+    } else if (name == "uniform") {
+        return Distribution::Uniform;
+    } else if (name == "exponential") {
+        return Distribution::Exponential;
+    } else {
+        throw std::invalid_argument("Invalid latency distribution: " + name);
+    }
+}
+
+/**
+ * Forward all the operations to the wrapped file, delaying the writes and syncs
+ */
+class FaultInjectionWritableFile: public WritableFile {
+public:
+    FaultInjectionWritableFile(std::unique_ptr<WritableFile> target, FaultInjectionEnv& env) :
+            target_(std::move(target)),
+            env_(env) {
+    }
+
+    Status Append(const Slice& data) override {
+        env_.beforeWrite();
+        return target_->Append(data);
+    }
+
+    Status PositionedAppend(const Slice& data, uint64_t offset) override {
+        env_.beforeWrite();
+        return target_->PositionedAppend(data, offset);
+    }
+
+    Status Truncate(uint64_t size) override {
+        return target_->Truncate(size);
+    }
+
+    Status Close() override {
+        return target_->Close();
+    }
+
+    Status Flush() override {
+        return target_->Flush();
+    }
+
+    Status Sync() override {
+        env_.beforeSync();
+        return target_->Sync();
+    }
+
+    Status Fsync() override {
+        env_.beforeSync();
+        return target_->Fsync();
+    }
+
+    Status RangeSync(uint64_t offset, uint64_t nbytes) override {
+        env_.beforeSync();
+        return target_->RangeSync(offset, nbytes);
+    }
+
+    bool IsSyncThreadSafe() const override {
+        return target_->IsSyncThreadSafe();
+    }
+
+    bool use_direct_io() const override {
+        return target_->use_direct_io();
+    }
+
+    size_t GetRequiredBufferAlignment() const override {
+        return target_->GetRequiredBufferAlignment();
+    }
+
+    uint64_t GetFileSize() override {
+        return target_->GetFileSize();
+    }
+
+    Status InvalidateCache(size_t offset, size_t length) override {
+        return target_->InvalidateCache(offset, length);
+    }
+
+    Status Allocate(uint64_t offset, uint64_t len) override {
+        return target_->Allocate(offset, len);
+    }
+
+    void PrepareWrite(size_t offset, size_t len) override {
+        target_->PrepareWrite(offset, len);
+    }
+
+    size_t GetUniqueId(char* id, size_t maxSize) const override {
+        return target_->GetUniqueId(id, maxSize);
+    }
+
+private:
+    std::unique_ptr<WritableFile> target_;
+    FaultInjectionEnv& env_;
+};
+
+FaultInjectionEnv::FaultInjectionEnv(Env* base, const FaultInjectionOptions& options, MetricsManager& metricsManager) :
+        EnvWrapper(base),
+        options_(options),
+        startTime_(steady_clock::now()),
+        injectedWriteDelay_(metricsManager.createMetric("faultInjectedWriteDelay")),
+        injectedSyncDelay_(metricsManager.createMetric("faultInjectedSyncDelay")),
+        injectedStall_(metricsManager.createMetric("faultInjectedStall")) {
+    LOG_WARN("Disk fault injection is enabled -- write: p=" << options.writeFault.probability //
+            << " delay=" << options.writeFault.delay.count() << "ms" //
+            << " -- sync: p=" << options.syncFault.probability //
+            << " delay=" << options.syncFault.delay.count() << "ms" //
+            << " -- stall: " << options.stallDuration.count() << "ms every " << options.stallInterval.count() << "s");
+}
+
+Status FaultInjectionEnv::NewWritableFile(const std::string& fname, std::unique_ptr<WritableFile>* result,
+        const EnvOptions& options) {
+    Status status = target()->NewWritableFile(fname, result, options);
+    if (status.ok()) {
+        result->reset(new FaultInjectionWritableFile(std::move(*result), *this));
+    }
+    return status;
+}
+
+Status FaultInjectionEnv::ReopenWritableFile(const std::string& fname, std::unique_ptr<WritableFile>* result,
+        const EnvOptions& options) {
+    Status status = target()->ReopenWritableFile(fname, result, options);
+    if (status.ok()) {
+        result->reset(new FaultInjectionWritableFile(std::move(*result), *this));
+    }
+    return status;
+}
+
+Status FaultInjectionEnv::ReuseWritableFile(const std::string& fname, const std::string& oldFname,
+        std::unique_ptr<WritableFile>* result, const EnvOptions& options) {
+    Status status = target()->ReuseWritableFile(fname, oldFname, result, options);
+    if (status.ok()) {
+        result->reset(new FaultInjectionWritableFile(std::move(*result), *this));
+    }
+    return status;
+}
+
+void FaultInjectionEnv::beforeWrite() {
+    waitForStall();
+    inject(options_.writeFault, injectedWriteDelay_.get());
+}
+
+void FaultInjectionEnv::beforeSync() {
+    waitForStall();
+    inject(options_.syncFault, injectedSyncDelay_.get());
+}
+
+static std::mt19937_64& randomGenerator() {
+    static thread_local std::mt19937_64 generator(std::random_device { }());
+    return generator;
+}
+
+void FaultInjectionEnv::inject(const LatencyFault& fault, Metric* metric) {
+    if (!fault.enabled()) {
+        return;
+    }
+
+    auto& generator = randomGenerator();
+    if (std::uniform_real_distribution<double>(0, 1)(generator) >= fault.probability) {
+        return;
+    }
+
+    double delayMillis = fault.delay.count();
+    switch (fault.distribution) {
+    case LatencyFault::Distribution::Fixed:
+        break;
+    case LatencyFault::Distribution::Uniform:
+        delayMillis = std::uniform_real_distribution<double>(0, 2 * delayMillis)(generator);
+        break;
+    case LatencyFault::Distribution::Exponential:
+        delayMillis = std::exponential_distribution<double>(1 / delayMillis)(generator);
+        break;
+    }
+
+    microseconds delay((int64_t) (delayMillis * 1000));
+    std::this_thread::sleep_for(delay);
+    metric->addLatencySample(delay);
+}
+
+void FaultInjectionEnv::waitForStall() {
+    if (options_.stallInterval.count() <= 0 || options_.stallDuration.count() <= 0) {
+        return;
+    }
+
+    // Stalls happen at the end of each interval
+    auto sinceStart = steady_clock::now() - startTime_;
+    auto inInterval = sinceStart % options_.stallInterval;
+    if (inInterval >= options_.stallInterval - options_.stallDuration) {
+        auto remaining = options_.stallInterval - inInterval;
+        std::this_thread::sleep_for(remaining);
+        injectedStall_->addLatencySample(duration_cast<Clock::duration>(remaining));
+    }
+}
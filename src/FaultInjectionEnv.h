@@ -0,0 +1,100 @@
+/**
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#pragma once
+
+#include <rocksdb/env.h>
+
+#include <chrono>
+#include <string>
+
+#include "Metrics.h"
+
+using namespace std::chrono;
+
+/**
+ * Latency injected into a class of file operations
+ */
+struct LatencyFault {
+    enum class Distribution {
+        // Always inject the configured delay
+        Fixed,
+        // Uniformly distributed between 0 and 2x the configured delay
+        Uniform,
+        // Exponentially distributed with the configured delay as mean. Produces a long tail.
+        Exponential,
+    };
+
+    // Probability for each operation to be delayed
+    double probability;
+    milliseconds delay;
+    Distribution distribution;
+
+    bool enabled() const {
+        return probability > 0 && delay.count() > 0;
+    }
+
+    static Distribution parseDistribution(const std::string& name);
+};
+
+struct FaultInjectionOptions {
+    LatencyFault writeFault;
+    LatencyFault syncFault;
+
+    // Periodically block all the writes and syncs, simulating a device stall
+    seconds stallInterval;
+    milliseconds stallDuration;
+
+    bool enabled() const {
+        return writeFault.enabled() || syncFault.enabled() || (stallInterval.count() > 0 && stallDuration.count() > 0);
+    }
+};
+
+/**
+ * RocksDB Env that injects latency into the writes and syncs of the files it creates, to reproduce the behavior of
+ * a slow or aging disk. Since the journal is the RocksDB WAL, this covers both the journal and the SST files.
+ */
+class FaultInjectionEnv: public rocksdb::EnvWrapper {
+public:
+    FaultInjectionEnv(rocksdb::Env* base, const FaultInjectionOptions& options, MetricsManager& metricsManager);
+
+    rocksdb::Status NewWritableFile(const std::string& fname, std::unique_ptr<rocksdb::WritableFile>* result,
+            const rocksdb::EnvOptions& options) override;
+
+    rocksdb::Status ReopenWritableFile(const std::string& fname, std::unique_ptr<rocksdb::WritableFile>* result,
+            const rocksdb::EnvOptions& options) override;
+
+    rocksdb::Status ReuseWritableFile(const std::string& fname, const std::string& oldFname,
+            std::unique_ptr<rocksdb::WritableFile>* result, const rocksdb::EnvOptions& options) override;
+
+    void beforeWrite();
+    void beforeSync();
+
+private:
+    void inject(const LatencyFault& fault, Metric* metric);
+    void waitForStall();
+
+    const FaultInjectionOptions options_;
+    const steady_clock::time_point startTime_;
+
+    MetricPtr injectedWriteDelay_;
+    MetricPtr injectedSyncDelay_;
+    MetricPtr injectedStall_;
+};
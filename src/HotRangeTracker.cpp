@@ -0,0 +1,136 @@
+/**
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "HotRangeTracker.h"
+
+#include "Logging.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+DECLARE_LOG_OBJECT();
+
+HotRangeTracker::HotRangeTracker(size_t maxRanges) :
+        maxRanges_(maxRanges) {
+    for (size_t i = 0; i < NumShards; i++) {
+        shards_.emplace_back(new Shard());
+    }
+}
+
+void HotRangeTracker::record(int64_t ledgerId, int64_t entryId) {
+    Shard& shard = *shards_[std::hash<int64_t>()(ledgerId) % NumShards];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.ranges.find(ledgerId);
+    if (it == shard.ranges.end()) {
+        if (shard.ranges.size() >= maxRanges_ / NumShards + 1) {
+            // Full until the next decay
+            return;
+        }
+        shard.ranges.emplace(ledgerId, Range { ledgerId, entryId, entryId, 1 });
+        return;
+    }
+
+    Range& range = it->second;
+    range.firstEntryId = std::min(range.firstEntryId, entryId);
+    range.lastEntryId = std::max(range.lastEntryId, entryId);
+    ++range.reads;
+}
+
+void HotRangeTracker::add(const Range& range) {
+    Shard& shard = *shards_[std::hash<int64_t>()(range.ledgerId) % NumShards];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto res = shard.ranges.emplace(range.ledgerId, range);
+    if (!res.second) {
+        Range& existing = res.first->second;
+        existing.firstEntryId = std::min(existing.firstEntryId, range.firstEntryId);
+        existing.lastEntryId = std::max(existing.lastEntryId, range.lastEntryId);
+        existing.reads += range.reads;
+    }
+}
+
+void HotRangeTracker::save(const std::string& path) {
+    std::vector<Range> ranges;
+    for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        for (auto it = shard->ranges.begin(); it != shard->ranges.end();) {
+            ranges.push_back(it->second);
+
+            // Halve the counts, so that the ledgers no longer read fade away
+            it->second.reads /= 2;
+            if (it->second.reads == 0) {
+                it = shard->ranges.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    std::sort(ranges.begin(), ranges.end(), [](const Range& a, const Range& b) {
+        return a.reads > b.reads;
+    });
+    if (ranges.size() > maxRanges_) {
+        ranges.resize(maxRanges_);
+    }
+
+    std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream file(tmpPath, std::ios::trunc);
+        for (const Range& range : ranges) {
+            file << range.ledgerId << ' ' << range.firstEntryId << ' ' << range.lastEntryId << ' ' << range.reads
+                    << '\n';
+        }
+
+        file.close();
+        if (!file) {
+            LOG_WARN("Failed to write hot ranges to " << tmpPath);
+            return;
+        }
+    }
+
+    if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        LOG_WARN("Failed to rename hot ranges file " << tmpPath);
+        return;
+    }
+
+    LOG_DEBUG("Saved " << ranges.size() << " hot ranges to " << path);
+}
+
+std::vector<HotRangeTracker::Range> HotRangeTracker::load(const std::string& path) {
+    std::vector<Range> ranges;
+    std::ifstream file(path);
+    if (!file) {
+        return ranges;
+    }
+
+    Range range;
+    while (file >> range.ledgerId >> range.firstEntryId >> range.lastEntryId >> range.reads) {
+        ranges.push_back(range);
+    }
+
+    if (!file.eof()) {
+        LOG_WARN("Ignoring invalid hot ranges file " << path);
+        ranges.clear();
+    }
+
+    return ranges;
+}
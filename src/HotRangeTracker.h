@@ -0,0 +1,73 @@
+/**
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Tracks the ranges of entries read from the database for each ledger, to warm up the block cache after a restart.
+ *
+ * The read counts decay each time the ranges are saved, so that the saved set follows the current working set.
+ */
+class HotRangeTracker {
+public:
+    struct Range {
+        int64_t ledgerId;
+        int64_t firstEntryId;
+        int64_t lastEntryId;
+        uint64_t reads;
+    };
+
+    explicit HotRangeTracker(size_t maxRanges);
+
+    void record(int64_t ledgerId, int64_t entryId);
+
+    /**
+     * Merge a range, eg: loaded from a previous run
+     */
+    void add(const Range& range);
+
+    /**
+     * Save the hottest ranges to a file, replacing it atomically, and decay the read counts
+     */
+    void save(const std::string& path);
+
+    /**
+     * @return the ranges saved in a file, hottest first. Empty if the file does not exist or is invalid.
+     */
+    static std::vector<Range> load(const std::string& path);
+
+private:
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<int64_t, Range> ranges;
+    };
+
+    static const size_t NumShards = 16;
+
+    const size_t maxRanges_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+};
@@ -0,0 +1,283 @@
+/**
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "LedgerMetadata.h"
+
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+#include <folly/Conv.h>
+#include <folly/Format.h>
+#include <folly/Optional.h>
+#include <folly/String.h>
+#include <openssl/sha.h>
+
+using namespace folly;
+
+static const std::string FormatVersionHeader = "BookieMetadataFormatVersion";
+
+/**
+ * Decode a quoted string of the protobuf text format
+ */
+static std::string unquote(StringPiece value) {
+    if (value.size() < 2 || value.front() != '"' || value.back() != '"') {
+        throw std::runtime_error(to<std::string>("Invalid string value: ", value));
+    }
+
+    value = value.subpiece(1, value.size() - 2);
+    std::string res;
+    res.reserve(value.size());
+
+    for (size_t i = 0; i < value.size(); i++) {
+        char c = value[i];
+        if (c != '\\' || i + 1 == value.size()) {
+            res.push_back(c);
+            continue;
+        }
+
+        c = value[++i];
+        switch (c) {
+        case 'n':
+            res.push_back('\n');
+            break;
+        case 'r':
+            res.push_back('\r');
+            break;
+        case 't':
+            res.push_back('\t');
+            break;
+        case 'x': {
+            int v = 0;
+            int digits = 0;
+            while (digits < 2 && i + 1 < value.size() && isxdigit(value[i + 1])) {
+                char d = value[++i];
+                v = v * 16 + (isdigit(d) ? d - '0' : tolower(d) - 'a' + 10);
+                ++digits;
+            }
+            res.push_back((char) v);
+            break;
+        }
+        default:
+            if (c >= '0' && c <= '7') {
+                // Octal escape, up to 3 digits
+                int v = c - '0';
+                for (int digits = 1; digits < 3 && i + 1 < value.size() && value[i + 1] >= '0' && value[i + 1] <= '7';
+                        digits++) {
+                    v = v * 8 + (value[++i] - '0');
+                }
+                res.push_back((char) v);
+            } else {
+                // \" \' \\ and unknown escapes
+                res.push_back(c);
+            }
+        }
+    }
+
+    return res;
+}
+
+static LedgerMetadata::State parseState(StringPiece value) {
+    if (value == "OPEN") {
+        return LedgerMetadata::State::Open;
+    } else if (value == "IN_RECOVERY") {
+        return LedgerMetadata::State::InRecovery;
+    } else if (value == "CLOSED") {
+        return LedgerMetadata::State::Closed;
+    } else {
+        throw std::runtime_error(to<std::string>("Invalid ledger state: ", value));
+    }
+}
+
+LedgerMetadata LedgerMetadata::parse(const std::string& data) {
+    std::vector<StringPiece> lines;
+    split('\n', data, lines);
+
+    if (lines.empty() || !StringPiece(lines[0]).startsWith(FormatVersionHeader)) {
+        throw std::runtime_error("Missing ledger metadata format version");
+    }
+
+    int version = to<int>(trimWhitespace(lines[0].subpiece(FormatVersionHeader.size())));
+    if (version != 2) {
+        throw std::runtime_error(to<std::string>("Unsupported ledger metadata format version: ", version));
+    }
+
+    LedgerMetadata metadata;
+    std::vector<std::string> blocks;
+    std::vector<std::string> segmentMembers;
+    int64_t segmentFirstEntry = 0;
+
+    for (size_t i = 1; i < lines.size(); i++) {
+        StringPiece line = trimWhitespace(lines[i]);
+        if (line.empty()) {
+            continue;
+        }
+
+        if (line.endsWith('{')) {
+            blocks.push_back(trimWhitespace(line.subpiece(0, line.size() - 1)).str());
+            segmentMembers.clear();
+            segmentFirstEntry = 0;
+            continue;
+        }
+
+        if (line == "}") {
+            if (blocks.empty()) {
+                throw std::runtime_error("Unbalanced braces in ledger metadata");
+            }
+            if (blocks.back() == "segment") {
+                metadata.ensembles[segmentFirstEntry] = std::move(segmentMembers);
+                segmentMembers.clear();
+            }
+            blocks.pop_back();
+            continue;
+        }
+
+        size_t separator = line.find(':');
+        if (separator == StringPiece::npos) {
+            throw std::runtime_error(to<std::string>("Invalid ledger metadata line: ", line));
+        }
+
+        StringPiece key = trimWhitespace(line.subpiece(0, separator));
+        StringPiece value = trimWhitespace(line.subpiece(separator + 1));
+
+        if (blocks.empty()) {
+            if (key == "quorumSize") {
+                metadata.writeQuorumSize = to<int32_t>(value);
+            } else if (key == "ensembleSize") {
+                metadata.ensembleSize = to<int32_t>(value);
+            } else if (key == "ackQuorumSize") {
+                metadata.ackQuorumSize = to<int32_t>(value);
+            } else if (key == "length") {
+                metadata.length = to<int64_t>(value);
+            } else if (key == "lastEntryId") {
+                metadata.lastEntryId = to<int64_t>(value);
+            } else if (key == "state") {
+                metadata.state = parseState(value);
+            } else if (key == "password") {
+                metadata.password = unquote(value);
+            }
+        } else if (blocks.size() == 1 && blocks.back() == "segment") {
+            if (key == "ensembleMember") {
+                segmentMembers.push_back(unquote(value));
+            } else if (key == "firstEntryId") {
+                segmentFirstEntry = to<int64_t>(value);
+            }
+        }
+    }
+
+    if (!blocks.empty()) {
+        throw std::runtime_error("Unbalanced braces in ledger metadata");
+    }
+
+    if (metadata.ackQuorumSize == 0) {
+        // Older clients don't set the ack quorum
+        metadata.ackQuorumSize = metadata.writeQuorumSize;
+    }
+
+    metadata.masterKey = masterKeyFromPassword(metadata.password);
+    return metadata;
+}
+
+std::string LedgerMetadata::replaceBookie(const std::string& data, int64_t firstEntryId, const std::string& oldBookie,
+        const std::string& newBookie) {
+    std::vector<StringPiece> lines;
+    split('\n', data, lines);
+
+    // The segment first entry id might come after its members, so the members lines are only rewritten at the end of
+    // the segment block
+    std::vector<std::string> output;
+    Optional<size_t> segmentStart;
+    int64_t segmentFirstEntry = 0;
+    bool replaced = false;
+
+    for (StringPiece line : lines) {
+        output.push_back(line.str());
+        StringPiece trimmed = trimWhitespace(line);
+
+        if (trimmed == "segment {") {
+            segmentStart = output.size();
+            segmentFirstEntry = 0;
+        } else if (segmentStart && trimmed.startsWith("firstEntryId:")) {
+            segmentFirstEntry = to<int64_t>(trimWhitespace(trimmed.subpiece(strlen("firstEntryId:"))));
+        } else if (segmentStart && trimmed == "}") {
+            for (size_t i = *segmentStart; !replaced && segmentFirstEntry == firstEntryId && i < output.size(); i++) {
+                StringPiece member = trimWhitespace(output[i]);
+                if (member.startsWith("ensembleMember:")
+                        && unquote(trimWhitespace(member.subpiece(strlen("ensembleMember:")))) == oldBookie) {
+                    size_t indent = output[i].find_first_not_of(" \t");
+                    output[i] = sformat("{}ensembleMember: \"{}\"", output[i].substr(0, indent),
+                            cEscape<std::string>(newBookie));
+                    replaced = true;
+                }
+            }
+            segmentStart.clear();
+        }
+    }
+
+    if (!replaced) {
+        throw std::runtime_error(sformat("Bookie {} not found in the ensemble at entry {}", oldBookie, firstEntryId));
+    }
+
+    return join('\n', output);
+}
+
+const std::vector<std::string>& LedgerMetadata::ensembleFor(int64_t entryId) const {
+    auto it = ensembles.upper_bound(entryId);
+    if (it == ensembles.begin()) {
+        throw std::out_of_range(to<std::string>("No ensemble for entry ", entryId));
+    }
+
+    return (--it)->second;
+}
+
+std::string LedgerMetadata::masterKeyFromPassword(const std::string& password) {
+    std::string data = "ledger" + password;
+
+    unsigned char digest[SHA_DIGEST_LENGTH];
+    SHA1((const unsigned char*) data.data(), data.size(), digest);
+    return std::string((const char*) digest, sizeof(digest));
+}
+
+std::string LedgerMetadata::getPath(const std::string& ledgersRootPath, int64_t ledgerId) {
+    if (ledgerId < std::numeric_limits<int32_t>::max()) {
+        // Hierarchical layout: 10 digits split as 2/4/L4
+        std::string id = sformat("{:010d}", ledgerId);
+        return sformat("{}/{}/{}/L{}", ledgersRootPath, id.substr(0, 2), id.substr(2, 4), id.substr(6, 4));
+    } else {
+        // Long hierarchical layout: 19 digits split as 3/4/4/4/L4
+        std::string id = sformat("{:019d}", ledgerId);
+        return sformat("{}/{}/{}/{}/{}/L{}", ledgersRootPath, id.substr(0, 3), id.substr(3, 4), id.substr(7, 4),
+                id.substr(11, 4), id.substr(15, 4));
+    }
+}
+
+std::ostream& operator<<(std::ostream& s, LedgerMetadata::State state) {
+    switch (state) {
+    case LedgerMetadata::State::Open:
+        return s << "Open";
+    case LedgerMetadata::State::InRecovery:
+        return s << "InRecovery";
+    case LedgerMetadata::State::Closed:
+        return s << "Closed";
+    default:
+        return s << "Unknown";
+    }
+}
@@ -0,0 +1,90 @@
+/**
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * Metadata of a ledger, as stored by the BookKeeper clients in ZooKeeper
+ */
+struct LedgerMetadata {
+    enum class State {
+        Open, InRecovery, Closed,
+    };
+
+    State state = State::Open;
+
+    int32_t ensembleSize = 0;
+    int32_t writeQuorumSize = 0;
+    int32_t ackQuorumSize = 0;
+
+    int64_t lastEntryId = -1;
+    int64_t length = 0;
+
+    // Ensembles of bookies ("host:port"), by first entry id
+    std::map<int64_t, std::vector<std::string>> ensembles;
+
+    std::string password;
+
+    // Digest of the password, sent by the clients as master key in the add requests
+    std::string masterKey;
+
+    /**
+     * @return the ensemble storing the given entry
+     */
+    const std::vector<std::string>& ensembleFor(int64_t entryId) const;
+
+    /**
+     * Parse the serialized metadata. Only the text format (version 2) is supported.
+     *
+     * @throws std::runtime_error if the metadata cannot be parsed
+     */
+    static LedgerMetadata parse(const std::string& data);
+
+    /**
+     * Replace a bookie in the ensemble starting at firstEntryId, directly in the serialized metadata, so that the
+     * fields not handled by the parser are preserved.
+     *
+     * @return the updated serialized metadata
+     * @throws std::runtime_error if the bookie is not part of that ensemble
+     */
+    static std::string replaceBookie(const std::string& data, int64_t firstEntryId, const std::string& oldBookie,
+            const std::string& newBookie);
+
+    /**
+     * @return the master key a client derives from the ledger password
+     */
+    static std::string masterKeyFromPassword(const std::string& password);
+
+    /**
+     * @return the z-node path of a ledger metadata, in the hierarchical layout. Eg: /ledgers/00/0000/L0001
+     */
+    static std::string getPath(const std::string& ledgersRootPath, int64_t ledgerId);
+};
+
+typedef std::shared_ptr<const LedgerMetadata> LedgerMetadataPtr;
+
+std::ostream& operator<<(std::ostream& s, LedgerMetadata::State state);
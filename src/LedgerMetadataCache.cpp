@@ -0,0 +1,127 @@
+/**
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "LedgerMetadataCache.h"
+
+#include "Logging.h"
+
+#include <algorithm>
+
+DECLARE_LOG_OBJECT();
+
+LedgerMetadataCache::LedgerMetadataCache(MetadataStore& metadataStore, MetricsManager& metricsManager,
+        size_t maxEntries, const std::string& ledgersRootPath) :
+        metadataStore_(metadataStore),
+        ledgersRootPath_(ledgersRootPath),
+        cacheHit_(metricsManager.createMetric("ledgerMetadataCacheHit")),
+        cacheMiss_(metricsManager.createMetric("ledgerMetadataCacheMiss")),
+        loadLatency_(metricsManager.createMetric("ledgerMetadataLoad")) {
+    size_t maxEntriesPerShard = std::max<size_t>(1, maxEntries / NumShards);
+    for (size_t i = 0; i < NumShards; i++) {
+        shards_.push_back(make_unique<Shard>(maxEntriesPerShard));
+    }
+}
+
+Future<CachedLedgerMetadataPtr> LedgerMetadataCache::get(int64_t ledgerId) {
+    Shard& shard = getShard(ledgerId);
+    std::shared_ptr<SharedPromise<CachedLedgerMetadataPtr>> promise;
+
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        auto it = shard.entries.find(ledgerId);
+        if (it != shard.entries.end()) {
+            cacheHit_->addValueSample(1);
+            return makeFuture(it->second);
+        }
+
+        cacheMiss_->addValueSample(1);
+        auto loadIt = shard.loading.find(ledgerId);
+        if (loadIt != shard.loading.end()) {
+            return loadIt->second->getFuture();
+        }
+
+        promise = std::make_shared<SharedPromise<CachedLedgerMetadataPtr>>();
+        shard.loading[ledgerId] = promise;
+    }
+
+    Future<CachedLedgerMetadataPtr> future = promise->getFuture();
+    load(ledgerId);
+    return future;
+}
+
+void LedgerMetadataCache::invalidate(int64_t ledgerId) {
+    Shard& shard = getShard(ledgerId);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.entries.erase(ledgerId);
+}
+
+void LedgerMetadataCache::load(int64_t ledgerId) {
+    std::string path = LedgerMetadata::getPath(ledgersRootPath_, ledgerId);
+    LOG_DEBUG("Loading metadata of ledger " << ledgerId << " from " << path);
+    Timer timer = loadLatency_->startTimer();
+    std::weak_ptr<LedgerMetadataCache> cache = shared_from_this();
+
+    // The watch is triggered after the load completes, so the entry is always inserted before being invalidated
+    metadataStore_.get(path, [cache, ledgerId](const WatchEvent& event) {
+        if (auto self = cache.lock()) {
+            LOG_DEBUG("Invalidating metadata of ledger " << ledgerId);
+            self->invalidate(ledgerId);
+        }
+    }).then([cache, ledgerId, timer](NodeData data) mutable {
+        timer.completed();
+        auto metadata = std::make_shared<const CachedLedgerMetadata>(
+                CachedLedgerMetadata { LedgerMetadata::parse(data.value), std::move(data) });
+        if (auto self = cache.lock()) {
+            self->loadCompleted(ledgerId, Try<CachedLedgerMetadataPtr>(std::move(metadata)));
+        }
+    }).onError([cache, ledgerId](exception_wrapper ew) {
+        LOG_DEBUG("Failed to load metadata of ledger " << ledgerId << ": " << ew.what());
+        if (auto self = cache.lock()) {
+            self->loadCompleted(ledgerId, Try<CachedLedgerMetadataPtr>(std::move(ew)));
+        }
+    });
+}
+
+void LedgerMetadataCache::loadCompleted(int64_t ledgerId, Try<CachedLedgerMetadataPtr>&& metadata) {
+    Shard& shard = getShard(ledgerId);
+    std::shared_ptr<SharedPromise<CachedLedgerMetadataPtr>> promise;
+
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.loading.find(ledgerId);
+        if (it == shard.loading.end()) {
+            return;
+        }
+
+        promise = std::move(it->second);
+        shard.loading.erase(it);
+
+        if (metadata.hasValue()) {
+            shard.entries.set(ledgerId, metadata.value());
+        }
+    }
+
+    promise->setTry(std::move(metadata));
+}
+
+LedgerMetadataCache::Shard& LedgerMetadataCache::getShard(int64_t ledgerId) {
+    return *shards_[std::hash<int64_t>()(ledgerId) % NumShards];
+}
@@ -0,0 +1,105 @@
+/**
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#pragma once
+
+#include "LedgerMetadata.h"
+#include "MetadataStore.h"
+#include "Metrics.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <folly/EvictingCacheMap.h>
+#include <folly/futures/Future.h>
+#include <folly/futures/SharedPromise.h>
+
+using namespace folly;
+
+/**
+ * Metadata of a ledger, with the z-node it was parsed from
+ */
+struct CachedLedgerMetadata {
+    LedgerMetadata metadata;
+
+    // Serialized metadata and z-node stat, for the conditional updates
+    NodeData node;
+};
+
+typedef std::shared_ptr<const CachedLedgerMetadata> CachedLedgerMetadataPtr;
+
+/**
+ * Concurrent LRU cache of ledger metadata.
+ *
+ * Entries are loaded asynchronously from the metadata store, with a watch on the metadata z-node: when the metadata
+ * changes, the ledger is deleted or the session expires, the entry is dropped and loaded again on the next access.
+ * The cache is split into shards, each with its own lock and LRU list, to reduce contention.
+ *
+ * Must be created with std::make_shared, and destroyed before the metadata store. The store callbacks only hold a weak
+ * reference to the cache, so the ones still pending when it is destroyed are ignored.
+ */
+class LedgerMetadataCache: public std::enable_shared_from_this<LedgerMetadataCache> {
+public:
+    LedgerMetadataCache(MetadataStore& metadataStore, MetricsManager& metricsManager, size_t maxEntries,
+            const std::string& ledgersRootPath = "/ledgers");
+
+    /**
+     * @return a future yielding the metadata of a ledger, or failed with a MetadataException (NoNode) if the ledger
+     *         does not exist
+     */
+    Future<CachedLedgerMetadataPtr> get(int64_t ledgerId);
+
+    void invalidate(int64_t ledgerId);
+
+private:
+    struct Shard {
+        explicit Shard(size_t maxEntries) :
+                entries(maxEntries) {
+        }
+
+        std::mutex mutex;
+        EvictingCacheMap<int64_t, CachedLedgerMetadataPtr> entries;
+
+        // Loads in progress, shared by the concurrent lookups of the same ledger
+        std::unordered_map<int64_t, std::shared_ptr<SharedPromise<CachedLedgerMetadataPtr>>> loading;
+    };
+
+    Shard& getShard(int64_t ledgerId);
+
+    /**
+     * Load the metadata of a ledger, whose promise was already registered in the shard
+     */
+    void load(int64_t ledgerId);
+
+    void loadCompleted(int64_t ledgerId, Try<CachedLedgerMetadataPtr>&& metadata);
+
+    static const size_t NumShards = 16;
+
+    MetadataStore& metadataStore_;
+    const std::string ledgersRootPath_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+
+    MetricPtr cacheHit_;
+    MetricPtr cacheMiss_;
+    MetricPtr loadLatency_;
+};
@@ -0,0 +1,146 @@
+/**
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <folly/Optional.h>
+#include <folly/SharedMutex.h>
+
+using namespace folly;
+
+/**
+ * In-memory table of a per-ledger state (fenced ledgers, master keys), mirroring the records of the metadata column
+ * family.
+ *
+ * The table is split into shards, each with its own reader-writer lock, so the lookups done on the add path don't
+ * contend with each other. Unlike folly::AtomicHashMap, it has no reserved keys and entries can be removed, so the
+ * table shrinks when the ledgers leave the bookie.
+ */
+template<typename T>
+class LedgerStateTable {
+public:
+    LedgerStateTable() :
+            size_(0) {
+        for (size_t i = 0; i < NumShards; i++) {
+            shards_.emplace_back(new Shard());
+        }
+    }
+
+    /**
+     * Lock-free when the table is empty
+     */
+    bool contains(int64_t ledgerId) const {
+        if (size_.load(std::memory_order_acquire) == 0) {
+            return false;
+        }
+
+        const Shard& shard = getShard(ledgerId);
+        SharedMutex::ReadHolder lock(shard.mutex);
+        return shard.values.find(ledgerId) != shard.values.end();
+    }
+
+    Optional<T> get(int64_t ledgerId) const {
+        if (size_.load(std::memory_order_acquire) == 0) {
+            return none;
+        }
+
+        const Shard& shard = getShard(ledgerId);
+        SharedMutex::ReadHolder lock(shard.mutex);
+        auto it = shard.values.find(ledgerId);
+        return it != shard.values.end() ? Optional<T>(it->second) : none;
+    }
+
+    /**
+     * Insert a value, unless the ledger already has one.
+     *
+     * @param onInsert invoked when the value is inserted, while still holding the shard lock: the concurrent lookups
+     *                 of the ledger only find the value once it has returned. If it throws, the value is removed.
+     * @return the value in the table, and whether it was inserted
+     */
+    template<typename OnInsert>
+    std::pair<T, bool> insert(int64_t ledgerId, const T& value, OnInsert&& onInsert) {
+        Shard& shard = getShard(ledgerId);
+        SharedMutex::WriteHolder lock(shard.mutex);
+
+        auto res = shard.values.emplace(ledgerId, value);
+        if (!res.second) {
+            return {res.first->second, false};
+        }
+
+        try {
+            onInsert();
+        } catch (...) {
+            shard.values.erase(res.first);
+            throw;
+        }
+
+        size_.fetch_add(1, std::memory_order_release);
+        return {value, true};
+    }
+
+    std::pair<T, bool> insert(int64_t ledgerId, const T& value) {
+        return insert(ledgerId, value, []() {});
+    }
+
+    /**
+     * @return true if the ledger was in the table
+     */
+    bool erase(int64_t ledgerId) {
+        Shard& shard = getShard(ledgerId);
+        SharedMutex::WriteHolder lock(shard.mutex);
+
+        if (shard.values.erase(ledgerId) == 0) {
+            return false;
+        }
+
+        size_.fetch_sub(1, std::memory_order_release);
+        return true;
+    }
+
+    size_t size() const {
+        return size_.load(std::memory_order_acquire);
+    }
+
+private:
+    struct Shard {
+        mutable SharedMutex mutex;
+        std::unordered_map<int64_t, T> values;
+    };
+
+    static const size_t NumShards = 16;
+
+    Shard& getShard(int64_t ledgerId) {
+        return *shards_[std::hash<int64_t>()(ledgerId) % NumShards];
+    }
+
+    const Shard& getShard(int64_t ledgerId) const {
+        return *shards_[std::hash<int64_t>()(ledgerId) % NumShards];
+    }
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::atomic<size_t> size_;
+};
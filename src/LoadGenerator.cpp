@@ -0,0 +1,215 @@
+/**
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "LoadGenerator.h"
+
+#include "BookieCodecV2.h"
+#include "Logging.h"
+#include "RateLimiter.h"
+
+#include <thread>
+#include <unordered_map>
+
+#include <wangle/channel/AsyncSocketHandler.h>
+#include <wangle/channel/OutputBufferingHandler.h>
+#include <wangle/codec/LengthFieldBasedFrameDecoder.h>
+
+DECLARE_LOG_OBJECT();
+
+class AddEntryTask: public HandlerAdapter<Response, Request> {
+public:
+    AddEntryTask(BookieClientPipeline::Ptr pipeline, double rate, int msgSize, MetricPtr addEntryMetric,
+            std::atomic<bool>& running, std::atomic<int64_t>& pendingRequestsCount) :
+            pipeline_(pipeline),
+            rateLimiter_(rate),
+            payload_(msgSize, 'X'),
+            addEntryMetric_(addEntryMetric),
+            running_(running),
+            pendingRequestsCount_(pendingRequestsCount),
+            thread_() {
+    }
+
+    ~AddEntryTask() {
+        join();
+    }
+
+    void start() {
+        LOG_INFO("Started add entry task " << bookieAddress_);
+        int64_t ledgerId = ledgerIdGenerator_++;
+        int64_t entryIdGenerator = 0;
+
+        auto pipeline = pipeline_.get();
+        EventBase* eventBase = pipeline_->getTransport()->getEventBase();
+
+        while (running_) {
+            rateLimiter_.aquire();
+
+            int64_t entryId = entryIdGenerator++;
+            ++pendingRequestsCount_;
+
+            eventBase->runInEventBaseThread([entryId, ledgerId, pipeline, this]() {
+                Request request {2, BookieOperation::AddEntry, ledgerId, entryId, 0, IOBuf::wrapBuffer(payload_.c_str(),
+                            payload_.length())};
+                LOG_DEBUG("Sending request " << request);
+                pipeline->write(std::move(request));
+
+                pendingRequests_.insert( {entryId, std::move(addEntryMetric_->startTimer())});
+            });
+        }
+    }
+
+    void join() {
+        if (thread_ && thread_->joinable()) {
+            thread_->join();
+        }
+    }
+
+    virtual void transportActive(Context* ctx) override {
+        ctx->fireTransportActive();
+        ctx->getTransport()->getPeerAddress(&bookieAddress_);
+        thread_ = std::make_unique<std::thread>(std::bind(&AddEntryTask::start, this));
+    }
+
+    virtual void read(Context* ctx, Response response) override {
+        LOG_DEBUG("Received response: " << response);
+        if (UNLIKELY(response.errorCode != BookieError::OK)) {
+            LOG_ERROR("Received error response: " << response.errorCode);
+            std::exit(-1);
+        }
+
+        auto it = pendingRequests_.find(response.entryId);
+        it->second.completed();
+        pendingRequests_.erase(it);
+        --pendingRequestsCount_;
+    }
+
+    virtual void readEOF(Context* ctx) override {
+        LOG_INFO("EOF received from " << bookieAddress_);
+        close(ctx);
+    }
+
+private:
+    BookieClientPipeline::Ptr pipeline_;
+    SocketAddress bookieAddress_;
+    RateLimiter rateLimiter_;
+    const std::string payload_;
+    MetricPtr addEntryMetric_;
+    std::atomic<bool>& running_;
+    std::atomic<int64_t>& pendingRequestsCount_;
+    std::unique_ptr<std::thread> thread_;
+
+    // Only accessed from the connection event base thread
+    std::unordered_map<int64_t, Timer> pendingRequests_;
+
+    static std::atomic<int64_t> ledgerIdGenerator_;
+};
+
+std::atomic<int64_t> AddEntryTask::ledgerIdGenerator_;
+
+class LoadGeneratorPipelineFactory: public PipelineFactory<BookieClientPipeline> {
+public:
+    LoadGeneratorPipelineFactory(LoadGenerator& generator) :
+            generator_(generator) {
+    }
+
+    BookieClientPipeline::Ptr newPipeline(std::shared_ptr<AsyncTransportWrapper> sock) override {
+        auto pipeline = BookieClientPipeline::create();
+        auto task = std::make_shared<AddEntryTask>(pipeline, generator_.perConnectionRate_, generator_.msgSize_,
+                generator_.addEntryMetric_, generator_.running_, generator_.pendingRequests_);
+
+        pipeline->addBack(AsyncSocketHandler(sock));
+        if (generator_.addBatching_.enabled()) {
+            pipeline->addBack(OutputBufferingHandler());
+        }
+        pipeline->addBack(LengthFieldBasedFrameDecoder(4, BookieConstant::MaxFrameSize));
+        pipeline->addBack(BookieClientCodecV2());
+        if (generator_.addBatching_.enabled()) {
+            pipeline->addBack(std::make_shared<AddBatchingHandler>(sock->getEventBase(), generator_.addBatching_));
+        }
+        pipeline->addBack(task);
+        pipeline->finalize();
+
+        generator_.addTask(task);
+        return pipeline;
+    }
+
+private:
+    LoadGenerator& generator_;
+};
+
+LoadGenerator::LoadGenerator(double rate, int msgSize, int numberOfConnections, MetricPtr addEntryMetric,
+        const AddBatchingConfig& addBatching) :
+        perConnectionRate_(rate / numberOfConnections),
+        msgSize_(msgSize),
+        numberOfConnections_(numberOfConnections),
+        addEntryMetric_(addEntryMetric),
+        addBatching_(addBatching),
+        running_(true),
+        pendingRequests_(0) {
+    client_.group(std::make_shared<wangle::IOThreadPoolExecutor>(std::thread::hardware_concurrency()));
+    client_.pipelineFactory(std::make_shared<LoadGeneratorPipelineFactory>(*this));
+}
+
+LoadGenerator::~LoadGenerator() {
+    running_ = false;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& task : tasks_) {
+        task->join();
+    }
+}
+
+void LoadGenerator::start(const SocketAddress& bookieAddress) {
+    LOG_INFO("Bookie address: " << bookieAddress);
+
+    std::vector<Future<BookieClientPipeline*>> connectFutures;
+    for (int i = 0; i < numberOfConnections_; i++) {
+        connectFutures.push_back(client_.connect(bookieAddress));
+    }
+
+    for (auto& future : connectFutures) {
+        future.get();
+    }
+}
+
+void LoadGenerator::stop(milliseconds drainTimeout) {
+    running_ = false;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& task : tasks_) {
+            task->join();
+        }
+    }
+
+    Clock::time_point deadline = Clock::now() + drainTimeout;
+    while (pendingRequests_ > 0 && Clock::now() < deadline) {
+        std::this_thread::sleep_for(milliseconds(10));
+    }
+
+    if (pendingRequests_ > 0) {
+        LOG_WARN("Stopped load generator with " << pendingRequests_ << " outstanding requests");
+    }
+}
+
+void LoadGenerator::addTask(std::shared_ptr<AddEntryTask> task) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.push_back(task);
+}
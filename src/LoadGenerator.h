@@ -0,0 +1,85 @@
+/**
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#pragma once
+
+#include "AddBatchingHandler.h"
+#include "BookieProtocol.h"
+#include "Metrics.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <folly/SocketAddress.h>
+#include <wangle/bootstrap/ClientBootstrap.h>
+
+using namespace wangle;
+using namespace folly;
+
+typedef Pipeline<IOBufQueue&, Request> BookieClientPipeline;
+
+class AddEntryTask;
+
+/**
+ * Generate add entry requests at a fixed rate, spread over multiple connections to a bookie.
+ *
+ * Shared by the perfClient tool and the in-process loopback benchmark.
+ */
+class LoadGenerator {
+public:
+    LoadGenerator(double rate, int msgSize, int numberOfConnections, MetricPtr addEntryMetric,
+            const AddBatchingConfig& addBatching = AddBatchingConfig());
+    ~LoadGenerator();
+
+    /**
+     * Open the connections to the bookie and start sending requests. Blocks until all the connections are established.
+     */
+    void start(const SocketAddress& bookieAddress);
+
+    /**
+     * Stop sending new requests and wait, up to the given timeout, for the outstanding ones to complete
+     */
+    void stop(milliseconds drainTimeout);
+
+    int64_t pendingRequests() const {
+        return pendingRequests_;
+    }
+
+private:
+    void addTask(std::shared_ptr<AddEntryTask> task);
+
+    const double perConnectionRate_;
+    const int msgSize_;
+    const int numberOfConnections_;
+    MetricPtr addEntryMetric_;
+    const AddBatchingConfig addBatching_;
+
+    std::atomic<bool> running_;
+    std::atomic<int64_t> pendingRequests_;
+
+    std::mutex mutex_;
+    std::vector<std::shared_ptr<AddEntryTask>> tasks_;
+
+    ClientBootstrap<BookieClientPipeline> client_;
+
+    friend class LoadGeneratorPipelineFactory;
+};
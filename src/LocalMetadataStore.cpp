@@ -0,0 +1,547 @@
+/**
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "LocalMetadataStore.h"
+
+#include "Logging.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <folly/Conv.h>
+#include <folly/FileUtil.h>
+#include <folly/Format.h>
+#include <folly/String.h>
+#include <folly/dynamic.h>
+#include <folly/json.h>
+
+DECLARE_LOG_OBJECT();
+
+// The local store has a single session, which never expires
+static const int64_t LocalSessionId = 1;
+
+static int64_t currentTimeMillis() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static MetadataException makeException(MetadataError error, const std::string& msg) {
+    return MetadataException(static_cast<int>(error), msg);
+}
+
+template<typename T>
+Future<T> LocalMetadataStore::onCallbackExecutor(Future<T> future) {
+    if (callbackExecutor_) {
+        return std::move(future).via(callbackExecutor_);
+    } else {
+        return future;
+    }
+}
+
+LocalMetadataStore::LocalMetadataStore(const std::string& persistencePath, Executor* callbackExecutor) :
+        persistencePath_(persistencePath),
+        callbackExecutor_(callbackExecutor),
+        zxid_(0),
+        sessionStarted_(false) {
+    nodes_["/"] = Node { "", NodeStat { } };
+
+    if (!persistencePath_.empty()) {
+        load();
+    }
+}
+
+Future<uint64_t> LocalMetadataStore::startSession() {
+    std::vector<SessionListener> toNotify;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!sessionStarted_) {
+            sessionStarted_ = true;
+            toNotify = sessionListeners_;
+        }
+    }
+
+    LOG_INFO("Started local metadata store session");
+    for (auto& listener : toNotify) {
+        listener();
+    }
+
+    return makeFuture<uint64_t>(LocalSessionId);
+}
+
+void LocalMetadataStore::registerSessionListener(SessionListener listener) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    sessionListeners_.push_back(listener);
+
+    if (sessionStarted_) {
+        lock.unlock();
+        listener();
+    }
+}
+
+int64_t LocalMetadataStore::sessionId() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return sessionStarted_ ? LocalSessionId : 0;
+}
+
+Future<std::string> LocalMetadataStore::create(const std::string& path, const std::string& value,
+        std::initializer_list<CreateFlag> createFlags) {
+    int flags = 0;
+    for (auto flag : createFlags) {
+        flags |= flag;
+    }
+
+    return write(MetadataOp::create(path, value, flags)).then([](MetadataOpResult result) {
+        return result.path;
+    });
+}
+
+Future<NodeStat> LocalMetadataStore::setData(const std::string& path, const std::string& value,
+        int32_t version) {
+    return write(MetadataOp::setData(path, value, version)).then([](MetadataOpResult result) {
+        return result.stat;
+    });
+}
+
+Future<Unit> LocalMetadataStore::remove(const std::string& path, int32_t version) {
+    return write(MetadataOp::remove(path, version)).then([](MetadataOpResult result) {
+    });
+}
+
+Future<MetadataOpResult> LocalMetadataStore::write(const MetadataOp& op) {
+    return commit({ op }, "Failed to update z-node at ").then([](std::vector<MetadataOpResult> results) {
+        return std::move(results[0]);
+    });
+}
+
+Future<std::vector<MetadataOpResult>> LocalMetadataStore::multi(std::vector<MetadataOp> ops) {
+    return commit(ops, "Failed to execute multi-op on ");
+}
+
+Future<std::vector<MetadataOpResult>> LocalMetadataStore::commit(const std::vector<MetadataOp>& ops,
+        const char* errorMsg) {
+    std::vector<MetadataOpResult> results;
+    TriggeredWatches watches;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        int64_t zxid = zxid_;
+        EventList events;
+        UndoLog undoLog;
+        bool durable = false;
+
+        for (const MetadataOp& op : ops) {
+            MetadataOpResult result { MetadataError::OK };
+            MetadataError error = apply(op, result, events, undoLog, durable);
+            if (error != MetadataError::OK) {
+                rollback(undoLog);
+                zxid_ = zxid;
+                return onCallbackExecutor(makeFuture<std::vector<MetadataOpResult>>(makeException(error, //
+                        to<std::string>(errorMsg, op.path))));
+            }
+            results.push_back(std::move(result));
+        }
+
+        // Ephemeral z-nodes are not saved: skip the rewrite when only they changed. The parent counters they bump are
+        // saved with the next persistent change, before a surviving z-node could depend on them.
+        if (durable && !persist()) {
+            rollback(undoLog);
+            zxid_ = zxid;
+            return onCallbackExecutor(makeFuture<std::vector<MetadataOpResult>>(
+                    makeException(MetadataError::SystemError,
+                            to<std::string>("Failed to save local metadata to ", persistencePath_))));
+        }
+
+        watches = collectWatches(events);
+    }
+
+    triggerWatches(std::move(watches));
+    return onCallbackExecutor(makeFuture(std::move(results)));
+}
+
+void LocalMetadataStore::rollback(const UndoLog& undoLog) {
+    for (auto it = undoLog.rbegin(); it != undoLog.rend(); ++it) {
+        if (it->second) {
+            nodes_[it->first] = *it->second;
+        } else {
+            nodes_.erase(it->first);
+        }
+    }
+}
+
+Future<NodeData> LocalMetadataStore::get(const std::string& path, Watcher watcher) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto it = nodes_.find(path);
+    if (it == nodes_.end()) {
+        return onCallbackExecutor(makeFuture<NodeData>(makeException(MetadataError::NoNode, //
+                to<std::string>("Failed to read z-node at ", path))));
+    }
+
+    if (watcher) {
+        dataWatches_.emplace(path, std::move(watcher));
+    }
+
+    return onCallbackExecutor(makeFuture(NodeData { it->second.value, it->second.stat }));
+}
+
+Future<Optional<NodeStat>> LocalMetadataStore::exists(const std::string& path, Watcher watcher) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (watcher) {
+        // Set the watch even if the z-node does not exist, to be notified when created
+        dataWatches_.emplace(path, std::move(watcher));
+    }
+
+    auto it = nodes_.find(path);
+    if (it == nodes_.end()) {
+        return onCallbackExecutor(makeFuture<Optional<NodeStat>>(none));
+    }
+
+    return onCallbackExecutor(makeFuture<Optional<NodeStat>>(it->second.stat));
+}
+
+Future<std::vector<std::string>> LocalMetadataStore::getChildren(const std::string& path, Watcher watcher) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (nodes_.find(path) == nodes_.end()) {
+        return onCallbackExecutor(makeFuture<std::vector<std::string>>(makeException(MetadataError::NoNode, //
+                to<std::string>("Failed to get children of z-node at ", path))));
+    }
+
+    if (watcher) {
+        childWatches_.emplace(path, std::move(watcher));
+    }
+
+    return onCallbackExecutor(makeFuture(childrenOf(nodes_, path)));
+}
+
+MetadataError LocalMetadataStore::apply(const MetadataOp& op, MetadataOpResult& result, EventList& events,
+        UndoLog& undoLog, bool& durable) {
+    if (op.path.empty() || op.path[0] != '/' || (op.path.size() > 1 && op.path.back() == '/')) {
+        return MetadataError::BadArguments;
+    }
+
+    if (op.path == "/" && (op.type == MetadataOp::Create || op.type == MetadataOp::Remove)) {
+        return MetadataError::BadArguments;
+    }
+
+    auto it = nodes_.find(op.path);
+
+    switch (op.type) {
+    case MetadataOp::Create: {
+        std::string path = op.path;
+
+        // Create the missing parents
+        std::string parent = parentOf(path);
+        if (nodes_.find(parent) == nodes_.end()) {
+            MetadataOpResult parentResult { MetadataError::OK };
+            MetadataError error = apply(MetadataOp::create(parent, ""), parentResult, events, undoLog, durable);
+            if (error != MetadataError::OK) {
+                return error;
+            }
+        }
+
+        Node& parentNode = nodes_[parent];
+        if (parentNode.stat.ephemeralOwner != 0) {
+            return MetadataError::NoChildrenForEphemerals;
+        }
+
+        if (op.flags & Sequence) {
+            path += format("{:010d}", parentNode.stat.cversion).str();
+        }
+
+        if (nodes_.find(path) != nodes_.end()) {
+            return MetadataError::NodeExists;
+        }
+
+        undoLog.emplace_back(parent, parentNode);
+        undoLog.emplace_back(path, none);
+        durable |= !(op.flags & Ephemeral);
+
+        ++zxid_;
+        int64_t now = currentTimeMillis();
+        Node node { op.value, NodeStat { } };
+        node.stat.czxid = node.stat.mzxid = node.stat.pzxid = zxid_;
+        node.stat.ctime = node.stat.mtime = now;
+        node.stat.dataLength = op.value.size();
+        node.stat.ephemeralOwner = (op.flags & Ephemeral) ? LocalSessionId : 0;
+        nodes_[path] = std::move(node);
+
+        ++parentNode.stat.cversion;
+        ++parentNode.stat.numChildren;
+        parentNode.stat.pzxid = zxid_;
+
+        result.path = path;
+        events.emplace_back(WatchEventType::NodeCreated, path);
+        events.emplace_back(WatchEventType::NodeChildrenChanged, parent);
+        return MetadataError::OK;
+    }
+
+    case MetadataOp::SetData: {
+        if (it == nodes_.end()) {
+            return MetadataError::NoNode;
+        }
+
+        NodeStat& stat = it->second.stat;
+        if (op.version != -1 && op.version != stat.version) {
+            return MetadataError::BadVersion;
+        }
+
+        undoLog.emplace_back(op.path, it->second);
+        durable |= stat.ephemeralOwner == 0;
+
+        it->second.value = op.value;
+        stat.mzxid = ++zxid_;
+        stat.mtime = currentTimeMillis();
+        stat.dataLength = op.value.size();
+        ++stat.version;
+
+        result.path = op.path;
+        result.stat = stat;
+        events.emplace_back(WatchEventType::NodeDataChanged, op.path);
+        return MetadataError::OK;
+    }
+
+    case MetadataOp::Remove: {
+        if (it == nodes_.end()) {
+            return MetadataError::NoNode;
+        }
+
+        if (op.version != -1 && op.version != it->second.stat.version) {
+            return MetadataError::BadVersion;
+        }
+
+        if (it->second.stat.numChildren > 0) {
+            return MetadataError::NotEmpty;
+        }
+
+        std::string parent = parentOf(op.path);
+        Node& parentNode = nodes_[parent];
+        undoLog.emplace_back(op.path, it->second);
+        undoLog.emplace_back(parent, parentNode);
+        durable |= it->second.stat.ephemeralOwner == 0;
+
+        nodes_.erase(it);
+
+        ++parentNode.stat.cversion;
+        --parentNode.stat.numChildren;
+        parentNode.stat.pzxid = ++zxid_;
+
+        result.path = op.path;
+        events.emplace_back(WatchEventType::NodeDeleted, op.path);
+        events.emplace_back(WatchEventType::NodeChildrenChanged, parent);
+        return MetadataError::OK;
+    }
+
+    case MetadataOp::Check:
+        if (it == nodes_.end()) {
+            return MetadataError::NoNode;
+        }
+
+        if (op.version != -1 && op.version != it->second.stat.version) {
+            return MetadataError::BadVersion;
+        }
+
+        result.path = op.path;
+        return MetadataError::OK;
+
+    default:
+        return MetadataError::Unimplemented;
+    }
+}
+
+LocalMetadataStore::TriggeredWatches LocalMetadataStore::collectWatches(const EventList& events) {
+    TriggeredWatches watches;
+
+    auto take = [&](std::multimap<std::string, Watcher>& map, WatchEventType type, const std::string& path) {
+        auto range = map.equal_range(path);
+        for (auto it = range.first; it != range.second; ++it) {
+            watches.emplace_back(std::move(it->second), WatchEvent { type, path });
+        }
+        map.erase(range.first, range.second);
+    };
+
+    for (auto& event : events) {
+        switch (event.first) {
+        case WatchEventType::NodeCreated:
+        case WatchEventType::NodeDataChanged:
+            take(dataWatches_, event.first, event.second);
+            break;
+        case WatchEventType::NodeDeleted:
+            take(dataWatches_, event.first, event.second);
+            take(childWatches_, event.first, event.second);
+            break;
+        case WatchEventType::NodeChildrenChanged:
+            take(childWatches_, event.first, event.second);
+            break;
+        default:
+            break;
+        }
+    }
+
+    return watches;
+}
+
+void LocalMetadataStore::triggerWatches(TriggeredWatches watches) {
+    for (auto& watch : watches) {
+        Watcher watcher = std::move(watch.first);
+        WatchEvent event = std::move(watch.second);
+
+        if (callbackExecutor_) {
+            callbackExecutor_->add([watcher, event]() {
+                watcher(event);
+            });
+        } else {
+            watcher(event);
+        }
+    }
+}
+
+std::vector<std::string> LocalMetadataStore::childrenOf(const NodeMap& nodes, const std::string& path) {
+    std::string prefix = path == "/" ? path : path + "/";
+    std::vector<std::string> children;
+
+    for (auto it = nodes.lower_bound(prefix); it != nodes.end() && StringPiece(it->first).startsWith(prefix); ++it) {
+        StringPiece name = StringPiece(it->first).subpiece(prefix.size());
+        if (!name.empty() && name.find('/') == StringPiece::npos) {
+            children.push_back(name.str());
+        }
+    }
+
+    return children;
+}
+
+std::string LocalMetadataStore::parentOf(const std::string& path) {
+    size_t idx = path.rfind('/');
+    return idx == 0 ? "/" : path.substr(0, idx);
+}
+
+void LocalMetadataStore::load() {
+    std::string data;
+    if (!readFile(persistencePath_.c_str(), data)) {
+        LOG_INFO("No local metadata at " << persistencePath_ << " -- Starting empty");
+        return;
+    }
+
+    dynamic json = parseJson(data);
+    zxid_ = json["zxid"].asInt();
+
+    for (auto& entry : json["nodes"].items()) {
+        const dynamic& n = entry.second;
+        Node node;
+        std::string value = n["value"].asString();
+        if (!unhexlify(value, node.value)) {
+            throw std::runtime_error(to<std::string>("Invalid local metadata file ", persistencePath_));
+        }
+        node.stat = NodeStat { };
+        node.stat.czxid = n["czxid"].asInt();
+        node.stat.mzxid = n["mzxid"].asInt();
+        node.stat.pzxid = n["pzxid"].asInt();
+        node.stat.ctime = n["ctime"].asInt();
+        node.stat.mtime = n["mtime"].asInt();
+        node.stat.version = n["version"].asInt();
+        node.stat.cversion = n["cversion"].asInt();
+        node.stat.dataLength = node.value.size();
+        std::string path = entry.first.asString();
+        nodes_[path] = std::move(node);
+    }
+
+    // Children counts are derived, since the ephemeral children were not saved
+    for (auto& node : nodes_) {
+        node.second.stat.numChildren = childrenOf(nodes_, node.first).size();
+    }
+
+    LOG_INFO("Loaded " << nodes_.size() << " z-nodes from " << persistencePath_);
+}
+
+bool LocalMetadataStore::persist() {
+    if (persistencePath_.empty()) {
+        return true;
+    }
+
+    dynamic nodes = dynamic::object;
+    for (auto& node : nodes_) {
+        const NodeStat& stat = node.second.stat;
+        if (stat.ephemeralOwner != 0) {
+            continue;
+        }
+
+        std::string value;
+        hexlify(node.second.value, value);
+
+        nodes[node.first] = dynamic::object //
+                ("value", value) //
+                ("czxid", stat.czxid) //
+                ("mzxid", stat.mzxid) //
+                ("pzxid", stat.pzxid) //
+                ("ctime", stat.ctime) //
+                ("mtime", stat.mtime) //
+                ("version", stat.version) //
+                ("cversion", stat.cversion);
+    }
+
+    dynamic json = dynamic::object("zxid", zxid_)("nodes", nodes);
+    std::string data = toJson(json);
+
+    // Write to a temporary file, sync it and rename it, so that a crash leaves either the old or the new content
+    std::string tmpPath = persistencePath_ + ".tmp";
+    int fd = openNoInt(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        LOG_ERROR("Failed to open " << tmpPath << ": " << strerror(errno));
+        return false;
+    }
+
+    bool written = writeFull(fd, data.data(), data.size()) == static_cast<ssize_t>(data.size()) && fsyncNoInt(fd) == 0;
+    int error = errno;
+    if (closeNoInt(fd) != 0 && written) {
+        written = false;
+        error = errno;
+    }
+    if (!written) {
+        LOG_ERROR("Failed to write " << tmpPath << ": " << strerror(error));
+        return false;
+    }
+
+    if (rename(tmpPath.c_str(), persistencePath_.c_str()) != 0) {
+        LOG_ERROR("Failed to rename " << tmpPath << " to " << persistencePath_ << ": " << strerror(errno));
+        return false;
+    }
+
+    // The rename is only durable once the directory is synced
+    size_t idx = persistencePath_.rfind('/');
+    std::string directory = idx == std::string::npos ? "." : idx == 0 ? "/" : persistencePath_.substr(0, idx);
+    int dirFd = openNoInt(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd < 0 || fsyncNoInt(dirFd) != 0) {
+        LOG_ERROR("Failed to sync directory " << directory << ": " << strerror(errno));
+        if (dirFd >= 0) {
+            closeNoInt(dirFd);
+        }
+        return false;
+    }
+
+    closeNoInt(dirFd);
+    return true;
+}
@@ -0,0 +1,129 @@
+/**
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#pragma once
+
+#include "MetadataStore.h"
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <folly/Executor.h>
+
+/**
+ * Metadata store kept in process memory, for single-node deployments, tests and benchmarks.
+ *
+ * It follows the ZooKeeper semantics, with a single session that never expires, except that the parent z-nodes are
+ * created as needed. When a persistence file is given, the persistent z-nodes are written and synced to it before a
+ * change is acknowledged, and loaded back at startup. Ephemeral z-nodes are never persisted.
+ */
+class LocalMetadataStore: public MetadataStore {
+public:
+    explicit LocalMetadataStore(const std::string& persistencePath = "", Executor* callbackExecutor = nullptr);
+
+    Future<uint64_t> startSession() override;
+
+    void registerSessionListener(SessionListener listener) override;
+
+    int64_t sessionId() override;
+
+    Future<std::string> create(const std::string& path, const std::string& value,
+            std::initializer_list<CreateFlag> createFlags) override;
+
+    Future<NodeData> get(const std::string& path, Watcher watcher = nullptr) override;
+
+    Future<Optional<NodeStat>> exists(const std::string& path, Watcher watcher = nullptr) override;
+
+    Future<std::vector<std::string>> getChildren(const std::string& path, Watcher watcher = nullptr) override;
+
+    Future<NodeStat> setData(const std::string& path, const std::string& value, int32_t version = -1) override;
+
+    Future<Unit> remove(const std::string& path, int32_t version = -1) override;
+
+    Future<std::vector<MetadataOpResult>> multi(std::vector<MetadataOp> ops) override;
+
+private:
+    struct Node {
+        std::string value;
+        NodeStat stat;
+    };
+
+    typedef std::map<std::string, Node> NodeMap;
+    typedef std::vector<std::pair<WatchEventType, std::string>> EventList;
+    typedef std::vector<std::pair<Watcher, WatchEvent>> TriggeredWatches;
+
+    // Previous state of the modified z-nodes, none for the created ones, in modification order
+    typedef std::vector<std::pair<std::string, Optional<Node>>> UndoLog;
+
+    /**
+     * Apply a write operation on the nodes, collecting the watch events it triggers and the previous state of the
+     * z-nodes it modifies. Sets durable if a persistent z-node was modified.
+     */
+    MetadataError apply(const MetadataOp& op, MetadataOpResult& result, EventList& events, UndoLog& undoLog,
+            bool& durable);
+
+    /**
+     * Atomically apply and persist write operations, and complete them: if one of them fails, none is applied.
+     * Must not be called with the lock held.
+     */
+    Future<std::vector<MetadataOpResult>> commit(const std::vector<MetadataOp>& ops, const char* errorMsg);
+
+    /**
+     * Apply a single write operation and complete it. Must not be called with the lock held.
+     */
+    Future<MetadataOpResult> write(const MetadataOp& op);
+
+    void rollback(const UndoLog& undoLog);
+
+    TriggeredWatches collectWatches(const EventList& events);
+    void triggerWatches(TriggeredWatches watches);
+
+    static std::vector<std::string> childrenOf(const NodeMap& nodes, const std::string& path);
+    static std::string parentOf(const std::string& path);
+
+    void load();
+
+    /**
+     * Write the persistent z-nodes to a temporary file, sync it and rename it over the persistence file
+     *
+     * @return false if the file could not be written. Once renamed, the new file may survive a crash even if the
+     *         directory sync failed.
+     */
+    bool persist();
+
+    template<typename T>
+    Future<T> onCallbackExecutor(Future<T> future);
+
+    const std::string persistencePath_;
+    Executor* const callbackExecutor_;
+
+    std::mutex mutex_;
+    NodeMap nodes_;
+    int64_t zxid_;
+
+    std::multimap<std::string, Watcher> dataWatches_;
+    std::multimap<std::string, Watcher> childWatches_;
+
+    bool sessionStarted_;
+    std::vector<SessionListener> sessionListeners_;
+};
@@ -0,0 +1,279 @@
+/**
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "LocalSegmentStore.h"
+
+#include "Logging.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+#include <folly/FileUtil.h>
+#include <folly/Format.h>
+
+namespace fs = boost::filesystem;
+
+DECLARE_LOG_OBJECT();
+
+static std::runtime_error ioError(const std::string& operation, const std::string& path) {
+    return std::runtime_error(folly::sformat("Failed to {} {}: {}", operation, path, strerror(errno)));
+}
+
+// Max number of segments kept mapped when no buffer references them
+static const size_t MaxMappedSegments = 1024;
+
+static const uint64_t PageSize = sysconf(_SC_PAGESIZE);
+
+struct LocalSegmentStore::MappedSegment {
+    void* data;
+    uint64_t size;
+
+    // Only kept open to drop the pages from the page cache
+    int fd;
+
+    MappedSegment(void* data, uint64_t size, int fd) :
+            data(data),
+            size(size),
+            fd(fd) {
+    }
+
+    ~MappedSegment() {
+        ::munmap(data, size);
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+};
+
+/**
+ * Range of a segment referenced by a buffer returned from a read
+ */
+struct LocalSegmentStore::MappedRange {
+    MappedSegmentPtr segment;
+    uint64_t offset;
+    uint64_t length;
+
+    ~MappedRange() {
+        if (segment->fd < 0) {
+            return;
+        }
+
+        // Mapped pages are not dropped by fadvise: unmap the pages of the range from the process first. The partial
+        // pages at the edges may belong to the neighbour blocks, which are then only faulted in again.
+        uint64_t start = offset & ~(PageSize - 1);
+        uint64_t end = std::min((offset + length + PageSize - 1) & ~(PageSize - 1), segment->size);
+        ::madvise((uint8_t*) segment->data + start, end - start, MADV_DONTNEED);
+        ::posix_fadvise(segment->fd, offset, length, POSIX_FADV_DONTNEED);
+    }
+};
+
+LocalSegmentStore::LocalSegmentStore(const std::string& directory, bool mmapReads, bool dropPageCache) :
+        directory_(directory),
+        mmapReads_(mmapReads),
+        dropPageCache_(dropPageCache),
+        mappings_(MaxMappedSegments) {
+    fs::create_directories(directory_);
+    LOG_INFO(
+            "Using local segment store at " << directory_ << (mmapReads_ ? " with mmap reads" : "")
+                    << (dropPageCache_ ? ", bypassing the page cache" : ""));
+}
+
+void LocalSegmentStore::write(const std::string& name, const IOBuf& data) {
+    std::string path = getPath(name);
+    std::string tmpPath = path + ".tmp";
+
+    int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw ioError("create", tmpPath);
+    }
+
+    for (const folly::ByteRange& range : data) {
+        if (folly::writeFull(fd, range.data(), range.size()) != (ssize_t) range.size()) {
+            ::close(fd);
+            throw ioError("write", tmpPath);
+        }
+    }
+
+    if (::fsync(fd) != 0) {
+        ::close(fd);
+        throw ioError("sync", tmpPath);
+    }
+
+    // Segments are cold data: once synced, don't let them take the place of the hot pages
+    if (dropPageCache_) {
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+    ::close(fd);
+
+    // The segment only becomes visible once complete
+    if (::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        throw ioError("rename", tmpPath);
+    }
+
+    // The rename itself is only durable once the directory is synced. The caller drops the local copy of the entries
+    // right after.
+    syncDirectory();
+
+    // A mapping of the replaced segment would keep serving the old content
+    unmap(name);
+}
+
+std::unique_ptr<IOBuf> LocalSegmentStore::read(const std::string& name, uint64_t offset, uint64_t length) {
+    if (mmapReads_) {
+        return readMapped(name, offset, length);
+    }
+
+    std::string path = getPath(name);
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw ioError("open", path);
+    }
+
+    std::unique_ptr<IOBuf> buffer = IOBuf::create(length);
+    ssize_t res = folly::preadFull(fd, buffer->writableData(), length, offset);
+    if (dropPageCache_ && res > 0) {
+        ::posix_fadvise(fd, offset, res, POSIX_FADV_DONTNEED);
+    }
+    ::close(fd);
+
+    if (res < 0) {
+        throw ioError("read", path);
+    } else if ((uint64_t) res != length) {
+        throw std::runtime_error(folly::sformat("Short read of {} at offset {}: {}/{} bytes", path, offset, res, length));
+    }
+
+    buffer->append(length);
+    return buffer;
+}
+
+std::unique_ptr<IOBuf> LocalSegmentStore::readMapped(const std::string& name, uint64_t offset, uint64_t length) {
+    MappedSegmentPtr mapping = getMapping(name);
+    if (offset + length > mapping->size) {
+        throw std::runtime_error(
+                folly::sformat("Short read of {} at offset {}: {}/{} bytes", getPath(name), offset,
+                        offset < mapping->size ? mapping->size - offset : 0, length));
+    }
+
+    uint8_t* data = (uint8_t*) mapping->data + offset;
+
+    // Blocks are mostly consumed in order by the catch-up reads: start paging in the following ones. Addresses
+    // passed to madvise must be page aligned.
+    uint64_t readAheadStart = (offset + length) & ~(PageSize - 1);
+    if (readAheadStart < mapping->size) {
+        uint64_t readAheadLength = std::min(4 * length + PageSize, mapping->size - readAheadStart);
+        ::madvise((uint8_t*) mapping->data + readAheadStart, readAheadLength, MADV_WILLNEED);
+    }
+
+    // The buffer keeps the mapping alive until it's released
+    return IOBuf::takeOwnership(data, length, [](void*, void* userData) {
+        delete static_cast<MappedRange*>(userData);
+    }, new MappedRange { std::move(mapping), offset, length });
+}
+
+LocalSegmentStore::MappedSegmentPtr LocalSegmentStore::getMapping(const std::string& name) {
+    {
+        std::lock_guard<std::mutex> lock(mappingsMutex_);
+        auto it = mappings_.find(name);
+        if (it != mappings_.end()) {
+            return it->second;
+        }
+    }
+
+    std::string path = getPath(name);
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw ioError("open", path);
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw ioError("stat", path);
+    }
+
+    if (st.st_size == 0) {
+        ::close(fd);
+        throw std::runtime_error("Empty segment " + path);
+    }
+
+    // Segments are immutable once renamed in place, so the mapping stays valid until it's released
+    void* data = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        ::close(fd);
+        throw ioError("mmap", path);
+    }
+
+    if (!dropPageCache_) {
+        ::close(fd);
+        fd = -1;
+    }
+
+    ::madvise(data, st.st_size, MADV_SEQUENTIAL);
+    MappedSegmentPtr mapping = std::make_shared<MappedSegment>(data, st.st_size, fd);
+
+    // Concurrent misses on the same segment may both map it, the last one wins
+    std::lock_guard<std::mutex> lock(mappingsMutex_);
+    mappings_.set(name, mapping);
+    return mapping;
+}
+
+void LocalSegmentStore::unmap(const std::string& name) {
+    if (!mmapReads_) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mappingsMutex_);
+    mappings_.erase(name);
+}
+
+void LocalSegmentStore::remove(const std::string& name) {
+    unmap(name);
+
+    std::string path = getPath(name);
+    if (::unlink(path.c_str()) != 0 && errno != ENOENT) {
+        throw ioError("delete", path);
+    }
+}
+
+void LocalSegmentStore::syncDirectory() {
+    int fd = ::open(directory_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        throw ioError("open", directory_);
+    }
+
+    if (::fsync(fd) != 0) {
+        ::close(fd);
+        throw ioError("sync", directory_);
+    }
+    ::close(fd);
+}
+
+std::string LocalSegmentStore::getPath(const std::string& name) const {
+    return directory_ + "/" + name;
+}
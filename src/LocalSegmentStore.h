@@ -0,0 +1,68 @@
+/**
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#pragma once
+
+#include "SegmentStore.h"
+
+#include <mutex>
+
+#include <folly/EvictingCacheMap.h>
+
+/**
+ * Segment store keeping each segment as a file in a local directory (eg: a mount of a cheaper, larger disk)
+ *
+ * With mmap reads, the segments are mapped read-only on first access and the returned buffers wrap the mapped region,
+ * so reading a block already in the page cache costs no syscall nor copy. Each buffer holds a reference on its
+ * mapping, which is unmapped when the last buffer is released and the segment is no longer among the recently used.
+ *
+ * Since the tiering service keeps its own cache of uncompressed blocks, the store can also drop the segments from the
+ * page cache once written and once each block has been consumed, so that the catch-up reads of offloaded ledgers
+ * don't evict the pages of the journal and the tailing reads.
+ */
+class LocalSegmentStore: public SegmentStore {
+public:
+    explicit LocalSegmentStore(const std::string& directory, bool mmapReads = false, bool dropPageCache = false);
+
+    void write(const std::string& name, const IOBuf& data) override;
+
+    std::unique_ptr<IOBuf> read(const std::string& name, uint64_t offset, uint64_t length) override;
+
+    void remove(const std::string& name) override;
+
+private:
+    struct MappedSegment;
+    typedef std::shared_ptr<MappedSegment> MappedSegmentPtr;
+    struct MappedRange;
+
+    std::string getPath(const std::string& name) const;
+    void syncDirectory();
+
+    std::unique_ptr<IOBuf> readMapped(const std::string& name, uint64_t offset, uint64_t length);
+    MappedSegmentPtr getMapping(const std::string& name);
+    void unmap(const std::string& name);
+
+    const std::string directory_;
+    const bool mmapReads_;
+    const bool dropPageCache_;
+
+    std::mutex mappingsMutex_;
+    folly::EvictingCacheMap<std::string, MappedSegmentPtr> mappings_;
+};
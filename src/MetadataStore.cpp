@@ -0,0 +1,100 @@
+/**
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "MetadataStore.h"
+
+#include <folly/Conv.h>
+
+MetadataException::MetadataException(int rc) :
+        error_(getError(rc)),
+        msg_(getErrorMsg(error_)) {
+}
+
+MetadataException::MetadataException(int rc, const std::string& msg) :
+        error_(getError(rc)),
+        msg_(to<std::string>(msg, " - ", getErrorMsg(error_))) {
+}
+
+const char* MetadataException::what() const noexcept {
+    return msg_.c_str();
+}
+
+MetadataError MetadataException::error() const {
+    return error_;
+}
+
+MetadataError MetadataException::getError(int rc) {
+    return static_cast<MetadataError>(rc);
+}
+
+std::string MetadataException::getErrorMsg(MetadataError error) {
+    switch (error) {
+    case MetadataError::OK:
+        return "OK";
+    case MetadataError::SystemError:
+        return "System Error";
+    case MetadataError::RuntimeInconsistency:
+        return "Runtime inconsistency";
+    case MetadataError::DataIinconsistency:
+        return "Data inconsistency";
+    case MetadataError::ConnectionLoss:
+        return "Connection loss";
+    case MetadataError::MarshallingError:
+        return "Marshalling error";
+    case MetadataError::Unimplemented:
+        return "Unimplemented";
+    case MetadataError::OperationTimeout:
+        return "Operation timeout";
+    case MetadataError::BadArguments:
+        return "Bad arguments";
+    case MetadataError::InvalidState:
+        return "Invalid state";
+    case MetadataError::ApiError:
+        return "API error";
+    case MetadataError::NoNode:
+        return "No node";
+    case MetadataError::NoAuth:
+        return "No Auth";
+    case MetadataError::BadVersion:
+        return "Bad Version";
+    case MetadataError::NoChildrenForEphemerals:
+        return "No children for ephemerals";
+    case MetadataError::NodeExists:
+        return "Node exists";
+    case MetadataError::NotEmpty:
+        return "Not empty";
+    case MetadataError::SessionExpired:
+        return "Session expired";
+    case MetadataError::InvalidCallback:
+        return "Invalid callback";
+    case MetadataError::InvalidACL:
+        return "Invalid ACL";
+    case MetadataError::AuthFailed:
+        return "Auth failed";
+    case MetadataError::Closing:
+        return "Closing";
+    case MetadataError::Nothing:
+        return "Nothing";
+    case MetadataError::SessionMoved:
+        return "Session moved";
+    default:
+        return to<std::string>("Unknown error (", error, ")");
+    }
+}
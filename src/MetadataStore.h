@@ -0,0 +1,253 @@
+/**
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <folly/Optional.h>
+#include <folly/futures/Future.h>
+
+using namespace folly;
+
+enum class MetadataError
+    : int {
+        OK = 0, /*!< Everything is OK */
+
+        /** System and server-side errors.
+         * This is never thrown by the server, it shouldn't be used other than
+         * to indicate a range. Specifically error codes greater than this
+         * value, but lesser than {@link #ZAPIERROR}, are system errors. */
+        SystemError = -1, //
+    RuntimeInconsistency = -2, /*!< A runtime inconsistency was found */
+    DataIinconsistency = -3, /*!< A data inconsistency was found */
+    ConnectionLoss = -4, /*!< Connection to the server has been lost */
+    MarshallingError = -5, /*!< Error while marshalling or unmarshalling data */
+    Unimplemented = -6, /*!< Operation is unimplemented */
+    OperationTimeout = -7, /*!< Operation timeout */
+    BadArguments = -8, /*!< Invalid arguments */
+    InvalidState = -9, /*!< Invliad zhandle state */
+
+    /** API errors.
+     * This is never thrown by the server, it shouldn't be used other than
+     * to indicate a range. Specifically error codes greater than this
+     * value are API errors (while values less than this indicate a
+     * {@link #ZSYSTEMERROR}).
+     */
+    ApiError = -100,
+    NoNode = -101, /*!< Node does not exist */
+    NoAuth = -102, /*!< Not authenticated */
+    BadVersion = -103, /*!< Version conflict */
+    NoChildrenForEphemerals = -108, /*!< Ephemeral nodes may not have children */
+    NodeExists = -110, /*!< The node already exists */
+    NotEmpty = -111, /*!< The node has children */
+    SessionExpired = -112, /*!< The session has been expired by the server */
+    InvalidCallback = -113, /*!< Invalid callback specified */
+    InvalidACL = -114, /*!< Invalid ACL specified */
+    AuthFailed = -115, /*!< Client authentication failed */
+    Closing = -116, /*!< ZooKeeper is closing */
+    Nothing = -117, /*!< (not error) no server responses to process */
+    SessionMoved = -118 /*!<session moved to another server, so operation is ignored */
+};
+
+class MetadataException: public std::exception {
+public:
+    explicit MetadataException(int rc);
+    MetadataException(int rc, const std::string& msg);
+    const char* what() const noexcept override;
+
+    MetadataError error() const;
+
+    static MetadataError getError(int rc);
+    static std::string getErrorMsg(MetadataError error);
+
+private:
+    MetadataError error_;
+    std::string msg_;
+};
+
+/**
+ * Metadata of a z-node
+ */
+struct NodeStat {
+    int64_t czxid;
+    int64_t mzxid;
+    int64_t ctime;
+    int64_t mtime;
+    int32_t version;
+    int32_t cversion;
+    int32_t aversion;
+    int64_t ephemeralOwner;
+    int32_t dataLength;
+    int32_t numChildren;
+    int64_t pzxid;
+};
+
+struct NodeData {
+    std::string value;
+    NodeStat stat;
+};
+
+enum class WatchEventType
+    : int {
+        Session = -1, /*!< The session state changed. Watches are lost when the session expires */
+    NotWatching = -2, //
+    NodeCreated = 1, //
+    NodeDeleted = 2, //
+    NodeDataChanged = 3, //
+    NodeChildrenChanged = 4,
+};
+
+struct WatchEvent {
+    WatchEventType type;
+    std::string path;
+};
+
+/**
+ * One-shot watch callback. It is invoked once, either when the watched z-node changes or when the session expires.
+ */
+typedef std::function<void(const WatchEvent&)> Watcher;
+
+/**
+ * Single operation of a multi-op transaction
+ */
+struct MetadataOp {
+    enum Type {
+        Create, Remove, SetData, Check,
+    };
+
+    Type type;
+    std::string path;
+    std::string value;
+    int32_t version;
+    int flags;
+
+    static MetadataOp create(const std::string& path, const std::string& value, int flags = 0) {
+        return {Create, path, value, -1, flags};
+    }
+
+    static MetadataOp remove(const std::string& path, int32_t version = -1) {
+        return {Remove, path, "", version, 0};
+    }
+
+    static MetadataOp setData(const std::string& path, const std::string& value, int32_t version = -1) {
+        return {SetData, path, value, version, 0};
+    }
+
+    static MetadataOp check(const std::string& path, int32_t version) {
+        return {Check, path, "", version, 0};
+    }
+};
+
+struct MetadataOpResult {
+    MetadataError error;
+
+    // Effective path of the created z-node, for create operations
+    std::string path;
+
+    // Updated z-node metadata, for set data operations
+    NodeStat stat;
+};
+
+/**
+ * Hierarchical metadata store with the ZooKeeper data model: z-nodes with versions, ephemeral and sequential nodes,
+ * one-shot watches and atomic multi-op transactions.
+ *
+ * Implemented by ZooKeeper, and by LocalMetadataStore for single-node deployments and benchmarks.
+ */
+class MetadataStore {
+public:
+    typedef std::function<void()> SessionListener;
+
+    enum CreateFlag {
+        Ephemeral = 0x01, //
+        Sequence = 0x02,
+    };
+
+    virtual ~MetadataStore() {
+    }
+
+    virtual Future<uint64_t> startSession() = 0;
+
+    /**
+     * Register a listener invoked each time a new session is established, and right away if there is a session
+     */
+    virtual void registerSessionListener(SessionListener listener) = 0;
+
+    /**
+     * @return the id of the current session, or 0 if there is no session
+     */
+    virtual int64_t sessionId() = 0;
+
+    /**
+     * Create a z-node
+     *
+     * @param path
+     * @param value
+     * @param createFlags
+     * @return a future yielding the effective path of the created z-node
+     */
+    virtual Future<std::string> create(const std::string& path, const std::string& value,
+            std::initializer_list<CreateFlag> createFlags) = 0;
+
+    /**
+     * Read the content of a z-node
+     *
+     * @param watcher if set, invoked when the z-node data changes or the z-node is deleted
+     */
+    virtual Future<NodeData> get(const std::string& path, Watcher watcher = nullptr) = 0;
+
+    /**
+     * @param watcher if set, invoked when the z-node is created, deleted or its data changes
+     * @return a future yielding the z-node metadata, or none if the z-node does not exist
+     */
+    virtual Future<Optional<NodeStat>> exists(const std::string& path, Watcher watcher = nullptr) = 0;
+
+    /**
+     * @param watcher if set, invoked when a child is added or removed, or the z-node is deleted
+     */
+    virtual Future<std::vector<std::string>> getChildren(const std::string& path, Watcher watcher = nullptr) = 0;
+
+    /**
+     * Update the content of a z-node
+     *
+     * @param version expected version of the z-node, or -1 to update unconditionally
+     */
+    virtual Future<NodeStat> setData(const std::string& path, const std::string& value,
+            int32_t version = -1) = 0;
+
+    /**
+     * Delete a z-node
+     *
+     * @param version expected version of the z-node, or -1 to delete unconditionally
+     */
+    virtual Future<Unit> remove(const std::string& path, int32_t version = -1) = 0;
+
+    /**
+     * Atomically execute a set of operations
+     *
+     * @return a future yielding the results of the operations, or failed if any of them failed
+     */
+    virtual Future<std::vector<MetadataOpResult>> multi(std::vector<MetadataOp> ops) = 0;
+};
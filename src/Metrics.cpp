@@ -76,12 +76,24 @@ void Metric::updateStats(seconds statsPeriod) {
     stats_["rate"] = rate;
 }
 
+double Metric::currentPercentile(double percentile) {
+    LatencyHistogram aggregated(BucketSize, MinValue, MaxValue);
+    for (LatencyHistogram& hist : histogram_.accessAllThreads()) {
+        aggregated.merge(hist);
+    }
+
+    return toMillis(aggregated.getPercentileEstimate(percentile));
+}
+
 MetricsManager::MetricsManager(seconds statsPeriod) :
         statsPeriod_(statsPeriod),
         eventBase_(),
         statsUpdateThread_([=] {
             setThreadName("bookie-stats-updater");
-            eventBase_.runAfterDelay(std::bind(&MetricsManager::updateStats, this), milliseconds(statsPeriod_).count());
+            if (statsPeriod_.count() > 0) {
+                eventBase_.runAfterDelay(std::bind(&MetricsManager::updateStats, this),
+                        milliseconds(statsPeriod_).count());
+            }
             eventBase_.loopForever();
         }) {
 }
@@ -128,6 +140,15 @@ std::string MetricsManager::getJsonStats(bool formatJson) {
     return getJsonStatsNoLock(formatJson);
 }
 
+std::string MetricsManager::collectJsonStats(seconds period, bool formatJson) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& metric : metrics_) {
+        metric.second->updateStats(period);
+    }
+
+    return getJsonStatsNoLock(formatJson);
+}
+
 std::string MetricsManager::getJsonStatsNoLock(bool formatJson) {
     dynamic stats = dynamic::object();
     for (auto& metric : metrics_) {
@@ -69,6 +69,12 @@ public:
 
     const std::string& name() const;
 
+    /**
+     * Estimate a percentile, in milliseconds, from the samples recorded since the last stats update. The samples are
+     * not reset.
+     */
+    double currentPercentile(double percentile);
+
 private:
     dynamic getStats();
 
@@ -90,6 +96,10 @@ typedef std::shared_ptr<Metric> MetricPtr;
 
 class MetricsManager {
 public:
+    /**
+     * @param statsPeriod interval at which the stats are aggregated and logged. When zero, the stats are only
+     *                    aggregated when explicitly calling collectJsonStats()
+     */
     MetricsManager(seconds statsPeriod);
     ~MetricsManager();
 
@@ -97,6 +107,11 @@ public:
 
     std::string getJsonStats(bool formatJson = true);
 
+    /**
+     * Aggregate all the samples recorded since the last update, over the given period, and return the stats
+     */
+    std::string collectJsonStats(seconds period, bool formatJson = true);
+
 private:
     void updateStats();
     std::string getJsonStatsNoLock(bool formatJson);
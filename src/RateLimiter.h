@@ -44,19 +44,20 @@ class RateLimiter {
     Clock::time_point nextFree_;
 };
 
-RateLimiter::RateLimiter(double rate)
-        : interval_(std::chrono::microseconds((long)(1e6 / rate))),
+inline RateLimiter::RateLimiter(double rate)
+        // In clock ticks: truncating to whole microseconds would make the high rates noticeably faster than asked
+        : interval_(std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / rate))),
           storedPermits_(0.0),
           maxPermits_(rate),
           nextFree_() {
     assert(rate < 1e6 && "Exceeded maximum rate");
 }
 
-void RateLimiter::aquire() {
+inline void RateLimiter::aquire() {
     aquire(1);
 }
 
-void RateLimiter::aquire(int permits) {
+inline void RateLimiter::aquire(int permits) {
     Clock::time_point now = Clock::now();
 
     if (now > nextFree_) {
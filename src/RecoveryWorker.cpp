@@ -0,0 +1,433 @@
+/**
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "RecoveryWorker.h"
+
+#include "BookieConfig.h"
+#include "LedgerMetadataCache.h"
+#include "Logging.h"
+#include "MetadataStore.h"
+#include "Storage.h"
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+
+#include <folly/Conv.h>
+#include <folly/Format.h>
+#include <folly/ThreadName.h>
+
+DECLARE_LOG_OBJECT();
+
+static const std::string LedgersRootPath = "/ledgers";
+static const std::string AvailablePath = "/ledgers/available";
+static const std::string ReadOnlyPath = "/ledgers/available/readonly";
+static const std::string UnderreplicatedPath = "/ledgers/underreplication/ledgers";
+static const std::string LocksPath = "/ledgers/underreplication/locks";
+
+static const std::string MarkerPrefix = "urL";
+
+// Interval to look again for under-replicated ledgers, when none was found
+static const milliseconds PollInterval = seconds(10);
+
+// Delay before retrying a ledger that could not be fully replicated (eg: still open)
+static const milliseconds DeferredLedgerRetryDelay = seconds(60);
+
+// Size of the batches bulk loaded into the storage, each one as an SST file
+static const size_t MaxBatchBytes = 64 * 1024 * 1024;
+
+static BookieClientConfig recoveryClientConfig() {
+    BookieClientConfig config;
+    config.numIoThreads = 2;
+
+    // Reads are throttled, so a late reply doesn't need to be raced against the other replicas
+    config.speculativeReads = false;
+    return config;
+}
+
+RecoveryWorker::RecoveryWorker(MetadataStore& metadataStore, LedgerMetadataCache& metadataCache, Storage& storage,
+        MetricsManager& metricsManager, const BookieConfig& conf) :
+        metadataStore_(metadataStore),
+        metadataCache_(metadataCache),
+        storage_(storage),
+        bookieAddress_(format("{}:{}", conf.bookieHost(), conf.bookiePort()).str()),
+        readWindow_(std::max(1, conf.recoveryReadWindow())),
+        client_(recoveryClientConfig()),
+        rateLimiter_(conf.recoveryRateLimitMb() * 1024),
+        running_(false),
+        replicatedLedgers_(metricsManager.createMetric("recoveryReplicatedLedgers")),
+        replicatedEntries_(metricsManager.createMetric("recoveryReplicatedEntries")),
+        replicationLatency_(metricsManager.createMetric("recoveryLedgerLatency")) {
+}
+
+RecoveryWorker::~RecoveryWorker() {
+    stop();
+}
+
+void RecoveryWorker::start() {
+    LOG_INFO("Starting auto-recovery worker for bookie " << bookieAddress_);
+    running_ = true;
+    thread_ = std::thread(std::bind(&RecoveryWorker::run, this));
+}
+
+void RecoveryWorker::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    stopCondition_.notify_all();
+
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void RecoveryWorker::run() {
+    setThreadName("bookie-recovery");
+
+    while (running_) {
+        Optional<ClaimedLedger> ledger;
+        try {
+            ledger = claimLedger();
+        } catch (const std::exception& e) {
+            LOG_WARN("Failed to look for under-replicated ledgers: " << e.what());
+        }
+
+        if (!ledger) {
+            waitFor(PollInterval);
+            continue;
+        }
+
+        int64_t ledgerId = ledger->ledgerId;
+        LOG_INFO("Replicating ledger " << ledgerId);
+
+        Timer timer = replicationLatency_->startTimer();
+        bool completed = false;
+        try {
+            completed = replicateLedger(ledgerId);
+        } catch (const std::exception& e) {
+            LOG_WARN("Failed to replicate ledger " << ledgerId << ": " << e.what());
+        }
+
+        try {
+            if (completed) {
+                // The version check keeps the marker if the ledger was marked again in the meantime
+                metadataStore_.remove(ledger->markerPath, ledger->markerVersion).get();
+                timer.completed();
+                replicatedLedgers_->addValueSample(1);
+                LOG_INFO("Ledger " << ledgerId << " is fully replicated");
+            } else {
+                deferredLedgers_[ledgerId] = steady_clock::now() + DeferredLedgerRetryDelay;
+            }
+        } catch (const std::exception& e) {
+            LOG_WARN("Failed to unmark ledger " << ledgerId << ": " << e.what());
+        }
+
+        try {
+            metadataStore_.remove(getLockPath(ledgerId)).get();
+        } catch (const std::exception& e) {
+            // The lock is ephemeral, it will go away with the session anyway
+            LOG_WARN("Failed to release the lock of ledger " << ledgerId << ": " << e.what());
+        }
+    }
+
+    LOG_INFO("Auto-recovery worker stopped");
+}
+
+Optional<RecoveryWorker::ClaimedLedger> RecoveryWorker::claimLedger() {
+    steady_clock::time_point now = steady_clock::now();
+    for (auto it = deferredLedgers_.begin(); it != deferredLedgers_.end();) {
+        if (it->second <= now) {
+            it = deferredLedgers_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    return claimLedger(UnderreplicatedPath);
+}
+
+Optional<RecoveryWorker::ClaimedLedger> RecoveryWorker::claimLedger(const std::string& path) {
+    std::vector<std::string> children;
+    try {
+        children = metadataStore_.getChildren(path).get();
+    } catch (const MetadataException& e) {
+        if (e.error() == MetadataError::NoNode) {
+            return none;
+        }
+        throw;
+    }
+
+    for (const std::string& child : children) {
+        if (!running_) {
+            break;
+        }
+
+        std::string childPath = path + "/" + child;
+        if (!StringPiece(child).startsWith(MarkerPrefix)) {
+            // Intermediate level of the hierarchy
+            Optional<ClaimedLedger> claimed = claimLedger(childPath);
+            if (claimed) {
+                return claimed;
+            }
+            continue;
+        }
+
+        int64_t ledgerId;
+        try {
+            ledgerId = to<int64_t>(StringPiece(child).subpiece(MarkerPrefix.size()));
+        } catch (const std::exception& e) {
+            LOG_WARN("Ignoring invalid under-replication marker " << childPath);
+            continue;
+        }
+
+        if (deferredLedgers_.count(ledgerId)) {
+            continue;
+        }
+
+        try {
+            NodeData marker = metadataStore_.get(childPath).get();
+            metadataStore_.create(getLockPath(ledgerId), "", { MetadataStore::CreateFlag::Ephemeral }).get();
+            return ClaimedLedger { ledgerId, childPath, marker.stat.version };
+        } catch (const MetadataException& e) {
+            // NoNode: the ledger was replicated in the meantime. NodeExists: claimed by another worker.
+            if (e.error() != MetadataError::NoNode && e.error() != MetadataError::NodeExists) {
+                throw;
+            }
+        }
+    }
+
+    return none;
+}
+
+bool RecoveryWorker::replicateLedger(int64_t ledgerId) {
+    std::string path = LedgerMetadata::getPath(LedgersRootPath, ledgerId);
+
+    CachedLedgerMetadataPtr cached;
+    try {
+        cached = metadataCache_.get(ledgerId).get();
+    } catch (const MetadataException& e) {
+        if (e.error() == MetadataError::NoNode) {
+            LOG_INFO("Ledger " << ledgerId << " was deleted");
+            return true;
+        }
+        throw;
+    }
+
+    if (storage_.isOffloaded(ledgerId)) {
+        // The bulk loaded entries would be shadowed by the offloaded ones. Leave the ledger to the other workers.
+        LOG_INFO("Ledger " << ledgerId << " is offloaded on this bookie, skipping it");
+        return false;
+    }
+
+    const LedgerMetadata& metadata = cached->metadata;
+    std::set<std::string> available = getAvailableBookies();
+
+    // Record the ledger master key, so that the writer can keep adding entries to this bookie after the ensemble change
+    MasterKey masterKey;
+    memcpy(masterKey.data(), metadata.masterKey.data(), masterKey.size());
+    if (!storage_.verifyMasterKey(ledgerId, masterKey)) {
+        throw std::runtime_error("This bookie already has a different master key for the ledger");
+    }
+
+    std::string updatedMetadata = cached->node.value;
+    bool changed = false;
+    bool completed = true;
+
+    for (auto it = metadata.ensembles.begin(); it != metadata.ensembles.end(); ++it) {
+        const std::vector<std::string>& ensemble = it->second;
+
+        std::vector<size_t> lostBookies;
+        for (size_t i = 0; i < ensemble.size(); i++) {
+            if (!available.count(ensemble[i])) {
+                lostBookies.push_back(i);
+            }
+        }
+
+        if (lostBookies.empty()) {
+            continue;
+        }
+
+        int64_t firstEntryId = it->first;
+        int64_t lastEntryId;
+        auto next = std::next(it);
+        if (next != metadata.ensembles.end()) {
+            lastEntryId = next->first - 1;
+        } else if (metadata.state == LedgerMetadata::State::Closed) {
+            lastEntryId = metadata.lastEntryId;
+        } else {
+            // The last ensemble of an open ledger is still being written, it can only be replicated once the ledger
+            // is recovered and closed
+            completed = false;
+            continue;
+        }
+
+        if (metadata.state == LedgerMetadata::State::Closed) {
+            lastEntryId = std::min(lastEntryId, metadata.lastEntryId);
+        }
+
+        if (std::find(ensemble.begin(), ensemble.end(), bookieAddress_) != ensemble.end()) {
+            // Another bookie has to take over
+            completed = false;
+            continue;
+        }
+
+        // A single bookie is replaced in each ensemble, the others are left to the other workers
+        size_t lostBookieIndex = lostBookies.front();
+        if (lostBookies.size() > 1) {
+            completed = false;
+        }
+
+        LOG_INFO("Replicating entries " << firstEntryId << "-" << lastEntryId << " of ledger " << ledgerId
+                << " from lost bookie " << ensemble[lostBookieIndex]);
+        replicateEntries(metadata, ledgerId, firstEntryId, lastEntryId, ensemble, lostBookieIndex, available);
+
+        updatedMetadata = LedgerMetadata::replaceBookie(updatedMetadata, firstEntryId, ensemble[lostBookieIndex],
+                bookieAddress_);
+        changed = true;
+    }
+
+    if (changed) {
+        // Fails with BadVersion if the writer changed the metadata in the meantime, or if the cached copy was not
+        // invalidated yet. The ledger is retried later, with the metadata reloaded.
+        try {
+            metadataStore_.setData(path, updatedMetadata, cached->node.stat.version).get();
+        } catch (const MetadataException&) {
+            metadataCache_.invalidate(ledgerId);
+            throw;
+        }
+    }
+
+    return completed;
+}
+
+void RecoveryWorker::replicateEntries(const LedgerMetadata& metadata, int64_t ledgerId, int64_t firstEntryId,
+        int64_t lastEntryId, const std::vector<std::string>& ensemble, size_t lostBookieIndex,
+        const std::set<std::string>& available) {
+    const size_t ensembleSize = ensemble.size();
+    const size_t writeQuorumSize = metadata.writeQuorumSize;
+
+    std::vector<Optional<SocketAddress>> addresses(ensembleSize);
+    for (size_t i = 0; i < ensembleSize; i++) {
+        if (available.count(ensemble[i])) {
+            addresses[i] = SocketAddress();
+            addresses[i]->setFromHostPort(ensemble[i]);
+        }
+    }
+
+    std::deque<std::pair<int64_t, Future<IOBufPtr>>> pendingReads;
+    Storage::EntryList batch;
+    size_t batchBytes = 0;
+
+    auto flushBatch = [&]() {
+        std::vector<Storage::LedgerEntries> ledgers;
+        ledgers.push_back({ ledgerId, std::move(batch) });
+        storage_.bulkLoad(std::move(ledgers)).get();
+        batch.clear();
+        batchBytes = 0;
+    };
+
+    auto completeRead = [&]() {
+        int64_t entryId = pendingReads.front().first;
+        IOBufPtr data = pendingReads.front().second.get();
+        pendingReads.pop_front();
+
+        size_t length = data->computeChainDataLength();
+        rateLimiter_.aquire(std::max<size_t>(1, length / 1024));
+        replicatedEntries_->addValueSample(1);
+
+        batch.emplace_back(entryId, std::move(data));
+        batchBytes += length;
+        if (batchBytes >= MaxBatchBytes) {
+            flushBatch();
+        }
+    };
+
+    for (int64_t entryId = firstEntryId; entryId <= lastEntryId && running_; entryId++) {
+        // Entries are striped: entry e is stored on the write quorum starting at index e % ensembleSize
+        size_t firstIndex = entryId % ensembleSize;
+        if ((lostBookieIndex + ensembleSize - firstIndex) % ensembleSize >= writeQuorumSize) {
+            continue;
+        }
+
+        std::vector<SocketAddress> replicas;
+        for (size_t i = 0; i < writeQuorumSize; i++) {
+            const Optional<SocketAddress>& address = addresses[(firstIndex + i) % ensembleSize];
+            if (address) {
+                replicas.push_back(*address);
+            }
+        }
+
+        if (replicas.empty()) {
+            throw std::runtime_error(sformat("No replica left for entry {}:{}", ledgerId, entryId));
+        }
+
+        if (pendingReads.size() >= readWindow_) {
+            completeRead();
+        }
+
+        pendingReads.emplace_back(entryId, client_.readEntry(replicas, ledgerId, entryId));
+    }
+
+    if (!running_) {
+        throw std::runtime_error("Auto-recovery worker is stopping");
+    }
+
+    while (!pendingReads.empty()) {
+        completeRead();
+    }
+
+    if (!batch.empty()) {
+        flushBatch();
+    }
+}
+
+std::set<std::string> RecoveryWorker::getAvailableBookies() {
+    std::set<std::string> available;
+    for (const std::string& bookie : metadataStore_.getChildren(AvailablePath).get()) {
+        if (bookie != "readonly") {
+            available.insert(bookie);
+        }
+    }
+
+    // Read-only bookies can still serve the entries
+    try {
+        for (const std::string& bookie : metadataStore_.getChildren(ReadOnlyPath).get()) {
+            available.insert(bookie);
+        }
+    } catch (const MetadataException& e) {
+        if (e.error() != MetadataError::NoNode) {
+            throw;
+        }
+    }
+
+    return available;
+}
+
+void RecoveryWorker::waitFor(milliseconds duration) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stopCondition_.wait_for(lock, duration, [this]() {
+        return !running_;
+    });
+}
+
+std::string RecoveryWorker::getLockPath(int64_t ledgerId) {
+    return sformat("{}/{}{:010d}", LocksPath, MarkerPrefix, ledgerId);
+}
@@ -0,0 +1,116 @@
+/**
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#pragma once
+
+#include "BookieClient.h"
+#include "LedgerMetadata.h"
+#include "Metrics.h"
+#include "RateLimiter.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+#include <folly/Optional.h>
+
+class BookieConfig;
+class LedgerMetadataCache;
+class MetadataStore;
+class Storage;
+
+using namespace folly;
+
+/**
+ * Auto-recovery worker: re-replicates into this bookie the ledgers that lost a copy when a bookie went away.
+ *
+ * Follows the BookKeeper auto-recovery layout in the metadata store: the auditor marks the ledgers under
+ * /ledgers/underreplication/ledgers and the workers claim them with an ephemeral lock under
+ * /ledgers/underreplication/locks. For each ensemble of a claimed ledger that contains a bookie no longer registered,
+ * the entries that were stored on that bookie are read from the surviving replicas, with a window of pipelined reads,
+ * and bulk loaded locally through Storage::bulkLoad, bypassing the write path. The ledger metadata is then updated to
+ * replace the lost bookie with this one, and the ledger is unmarked.
+ *
+ * The worker runs on its own thread, and the copy is throttled to a fixed rate, so the foreground traffic is not
+ * affected.
+ */
+class RecoveryWorker {
+public:
+    RecoveryWorker(MetadataStore& metadataStore, LedgerMetadataCache& metadataCache, Storage& storage,
+            MetricsManager& metricsManager, const BookieConfig& conf);
+    ~RecoveryWorker();
+
+    void start();
+
+    void stop();
+
+private:
+    struct ClaimedLedger {
+        int64_t ledgerId;
+        std::string markerPath;
+        int32_t markerVersion;
+    };
+
+    void run();
+
+    Optional<ClaimedLedger> claimLedger();
+    Optional<ClaimedLedger> claimLedger(const std::string& path);
+
+    /**
+     * @return true if the ledger was fully replicated and can be unmarked
+     */
+    bool replicateLedger(int64_t ledgerId);
+
+    void replicateEntries(const LedgerMetadata& metadata, int64_t ledgerId, int64_t firstEntryId, int64_t lastEntryId,
+            const std::vector<std::string>& ensemble, size_t lostBookieIndex, const std::set<std::string>& available);
+
+    std::set<std::string> getAvailableBookies();
+
+    void waitFor(milliseconds duration);
+
+    static std::string getLockPath(int64_t ledgerId);
+
+    MetadataStore& metadataStore_;
+    LedgerMetadataCache& metadataCache_;
+    Storage& storage_;
+    const std::string bookieAddress_;
+    const size_t readWindow_;
+
+    BookieClient client_;
+
+    // Permits are KB of replicated entries
+    RateLimiter rateLimiter_;
+
+    std::atomic<bool> running_;
+    std::mutex mutex_;
+    std::condition_variable stopCondition_;
+    std::thread thread_;
+
+    // Ledgers that could not be fully replicated, and when to retry them. Only accessed by the worker thread.
+    std::map<int64_t, steady_clock::time_point> deferredLedgers_;
+
+    MetricPtr replicatedLedgers_;
+    MetricPtr replicatedEntries_;
+    MetricPtr replicationLatency_;
+};
@@ -0,0 +1,57 @@
+/**
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <folly/io/IOBuf.h>
+
+using folly::IOBuf;
+
+/**
+ * Secondary storage for the segments of the ledgers offloaded by the tiering service.
+ *
+ * Segments are immutable blobs, written once and then read by ranges. The calls are blocking: they are only made from
+ * the tiering thread and from the tiered reads executor.
+ */
+class SegmentStore {
+public:
+    virtual ~SegmentStore() {
+    }
+
+    /**
+     * Durably store a segment, replacing any previous segment with the same name
+     *
+     * @throws std::runtime_error on failure
+     */
+    virtual void write(const std::string& name, const IOBuf& data) = 0;
+
+    /**
+     * Read a range of a segment
+     *
+     * @throws std::runtime_error on failure, or if the range is past the end of the segment
+     */
+    virtual std::unique_ptr<IOBuf> read(const std::string& name, uint64_t offset, uint64_t length) = 0;
+
+    virtual void remove(const std::string& name) = 0;
+};
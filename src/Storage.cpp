@@ -18,19 +18,35 @@
  * under the License.
  *
  */
+#include "AdmissionPersistentCache.h"
+#include "BookieProtocol.h"
 #include "Logging.h"
 #include "RateLimiter.h"
 #include "Storage.h"
+#include "FaultInjectionEnv.h"
 
 #include <chrono>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <tuple>
 #include <rocksdb/table.h>
 #include <rocksdb/filter_policy.h>
 #include <rocksdb/cache.h>
 #include <rocksdb/slice_transform.h>
+#include <rocksdb/sst_file_writer.h>
+#include <rocksdb/statistics.h>
+#include <rocksdb/version.h>
+#include <folly/Bits.h>
+#include <folly/Format.h>
+#include <folly/Optional.h>
 #include <folly/ThreadName.h>
 
+#include <boost/filesystem.hpp>
+
 using namespace rocksdb;
 using namespace std::chrono;
+namespace fs = boost::filesystem;
 
 DECLARE_LOG_OBJECT();
 
@@ -46,18 +62,99 @@ constexpr unsigned long long int operator ""_GB(unsigned long long int gigabytes
     return gigabytes * 1024 * 1024 * 1024;
 }
 
+/**
+ * Entries are stored with a 16 bytes key (ledgerId, entryId) in big-endian format, so that the entries of a ledger
+ * are sorted by entryId
+ */
+struct EntryKey {
+    int64_t ledgerId;
+    int64_t entryId;
+
+    EntryKey(int64_t ledgerId, int64_t entryId) :
+            ledgerId(Endian::big(ledgerId)),
+            entryId(Endian::big(entryId)) {
+    }
+
+    Slice slice() const {
+        return Slice((const char*) this, sizeof(EntryKey));
+    }
+};
+
+static_assert(sizeof(EntryKey) == 16, "Entry keys are expected to be 16 bytes");
+
+static const std::string MetadataColumnFamilyName = "metadata";
+
+/**
+ * Ledger state keys in the metadata column family: a one byte type followed by the ledgerId in big-endian format
+ */
+struct LedgerStateKey {
+    static const char Fenced = 'F';
+    static const char Key = 'K';
+    static const char Offloaded = 'T';
+
+    char type;
+    char ledgerId[sizeof(int64_t)];
+
+    LedgerStateKey(char type, int64_t ledgerId) :
+            type(type) {
+        int64_t value = Endian::big(ledgerId);
+        memcpy(this->ledgerId, &value, sizeof(value));
+    }
+
+    Slice slice() const {
+        return Slice((const char*) this, sizeof(LedgerStateKey));
+    }
+
+    static int64_t ledgerIdFrom(const Slice& key) {
+        int64_t value;
+        memcpy(&value, key.data() + 1, sizeof(value));
+        return Endian::big(value);
+    }
+};
+
+static_assert(sizeof(LedgerStateKey) == 9, "Ledger state keys are expected to be 9 bytes");
+
+// Max number of ledger ranges saved to warm up the block cache
+static const size_t MaxHotRanges = 10000;
+
+static bool constantTimeEquals(const MasterKey& a, const MasterKey& b) {
+    uint8_t diff = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        diff |= a[i] ^ b[i];
+    }
+    return diff == 0;
+}
+
 Storage::Storage(const BookieConfig& conf, MetricsManager& metricsManager) :
         db_(nullptr),
+        metadataColumnFamily_(nullptr),
         writeOptions_(),
         journalQueue_(10000),
+        readExecutor_(conf.numReadThreads()),
+        tailCache_(conf.tailCacheEntriesPerLedger(), conf.tailCacheMaxLedgers(), conf.tailCacheMaxSizeBytes()),
+        hotRanges_(MaxHotRanges),
+        hotRangesPath_(conf.dataDirectory() + "/hot-ranges"),
+        warmUpMaxBytes_(0),
+        warmUpStopped_(false),
+        bulkLoadExecutor_(1),
+        bulkLoadDirectory_(conf.dataDirectory() + "/bulk-load"),
+        bulkLoadFileId_(0),
         fsyncWal_(conf.fsyncWal()),
         journalThread_(std::bind(&Storage::runJournal, this)),
         rocksDbPutLatency_(metricsManager.createMetric("rocksDbPut")),
         addEntryEnqueueLatency_(metricsManager.createMetric("addEntryEnqueueLatency")),
         walSyncLatency_(metricsManager.createMetric("walSync")),
-        walQueueLatency_(metricsManager.createMetric("walQueueLatency")) {
+        walQueueLatency_(metricsManager.createMetric("walQueueLatency")),
+        rocksDbGetLatency_(metricsManager.createMetric("rocksDbGet")),
+        bulkLoadLatency_(metricsManager.createMetric("bulkLoad")),
+        bulkLoadEntries_(metricsManager.createMetric("bulkLoadEntries")),
+        tailCacheHit_(metricsManager.createMetric("tailCacheHit")),
+        tailCacheMiss_(metricsManager.createMetric("tailCacheMiss")),
+        warmUpChunks_(metricsManager.createMetric("blockCacheWarmUpChunks")),
+        statistics_(CreateDBStatistics()) {
     Options options;
     options.create_if_missing = true;
+    options.create_missing_column_families = true;
     options.write_buffer_size = 1_GB;
     options.max_write_buffer_number = 4;
     options.max_background_compactions = 16;
@@ -71,64 +168,182 @@ Storage::Storage(const BookieConfig& conf, MetricsManager& metricsManager) :
     options.compaction_readahead_size = 8_MB;
     options.allow_concurrent_memtable_write = true;
 
+    // Keeps the catch-up reads of old ledgers, and the freshly flushed or compacted files, out of the page cache
+    // the journal and the tailing readers depend on. The compaction reads rely on compaction_readahead_size.
+    options.use_direct_reads = conf.directIo();
+    options.use_direct_io_for_flush_and_compaction = conf.directIo();
+
     // Keys are always 16 bytes (ledgerId, entryId)
     options.prefix_extractor.reset(NewFixedPrefixTransform(8));
 
     options.log_file_time_to_roll = duration_cast<seconds>(hours(24)).count();
     options.keep_log_file_num = 30;
     options.stats_dump_period_sec = 60;
+    options.statistics = statistics_;
 
     options.wal_dir = conf.walDirectory();
 
+    FaultInjectionOptions faultInjectionOptions = conf.faultInjectionOptions();
+    if (faultInjectionOptions.enabled()) {
+        env_.reset(new FaultInjectionEnv(Env::Default(), faultInjectionOptions, metricsManager));
+        options.env = env_.get();
+    }
+
     BlockBasedTableOptions table_options;
     table_options.block_size = 256_KB;
     table_options.format_version = 2;
     table_options.checksum = kxxHash;
     table_options.block_cache = NewLRUCache(8_GB, 8);
+    warmUpMaxBytes_ = table_options.block_cache->GetCapacity();
     table_options.cache_index_and_filter_blocks = true;
-    table_options.filter_policy.reset(NewBloomFilterPolicy(10, false));
+    table_options.cache_index_and_filter_blocks_with_high_priority = true;
+    table_options.pin_l0_filter_and_index_blocks_in_cache = true;
+
+    // With 1GB files, the monolithic index and filter of a file take megabytes: a single cache miss would evict many
+    // data blocks. Partitions are loaded on demand, only the small top-level index stays pinned.
+    if (conf.partitionedIndexFilters()) {
+        table_options.index_type = BlockBasedTableOptions::kTwoLevelIndexSearch;
+        table_options.partition_filters = true;
+        table_options.metadata_block_size = 4_KB;
+        table_options.pin_top_level_index_and_filter = true;
+    }
+
+    if (conf.filterType() == "ribbon") {
+#if ROCKSDB_MAJOR > 6 || (ROCKSDB_MAJOR == 6 && ROCKSDB_MINOR >= 22)
+        // Same false positive rate as the 10 bits bloom filter, with ~30% less memory. Requires format version 5.
+        table_options.format_version = 5;
+        table_options.filter_policy.reset(NewRibbonFilterPolicy(10));
+#else
+        LOG_WARN("Ribbon filters are not supported by this RocksDB version -- Using bloom filters");
+        table_options.filter_policy.reset(NewBloomFilterPolicy(10, false));
+#endif
+    } else if (conf.filterType() == "bloom") {
+        table_options.filter_policy.reset(NewBloomFilterPolicy(10, false));
+    } else {
+        // Rejected by BookieConfig: the journal thread is already running, an exception would terminate the process
+        LOG_FATAL("Invalid filter type: " << conf.filterType());
+        std::exit(1);
+    }
+    if (!conf.persistentCacheDirectory().empty()) {
+        try {
+            table_options.persistent_cache = AdmissionPersistentCache::open(conf.persistentCacheDirectory(),
+                    conf.persistentCacheSizeBytes(), metricsManager);
+        } catch (const std::exception& e) {
+            LOG_FATAL(e.what());
+            std::exit(1);
+        }
+    }
     options.table_factory.reset(NewBlockBasedTableFactory(table_options));
 
     LOG_INFO("Opening database at " << conf.dataDirectory());
 
-    Status res = DB::Open(options, conf.dataDirectory(), &db_);
+    // The metadata column family only holds a few small records per ledger
+    std::vector<ColumnFamilyDescriptor> columnFamilies;
+    columnFamilies.emplace_back(kDefaultColumnFamilyName, ColumnFamilyOptions(options));
+    columnFamilies.emplace_back(MetadataColumnFamilyName, ColumnFamilyOptions());
+
+    std::vector<ColumnFamilyHandle*> handles;
+    Status res = DB::Open(DBOptions(options), conf.dataDirectory(), columnFamilies, &handles, &db_);
     if (!res.ok()) {
         LOG_FATAL("Failed to open database: " << res.code());
         std::exit(1);
     }
 
+    // The default column family handle is owned by the db
+    delete handles[0];
+    metadataColumnFamily_ = handles[1];
+
     LOG_INFO("Database opened successfully");
+
+    // Leftovers of bulk loads interrupted by a restart
+    boost::system::error_code ec;
+    fs::remove_all(bulkLoadDirectory_, ec);
+    if (!ec) {
+        fs::create_directories(bulkLoadDirectory_, ec);
+    }
+    if (ec) {
+        LOG_FATAL("Failed to prepare the bulk load directory " << bulkLoadDirectory_ << ": " << ec.message());
+        std::exit(1);
+    }
+
+    loadLedgerState();
+
+    if (conf.warmUpRateMb() > 0) {
+        warmUpThread_ = std::thread(std::bind(&Storage::warmUp, this, conf.warmUpRateMb()));
+    }
+}
+
+void Storage::loadLedgerState() {
+    std::vector<int64_t> fencedLedgers;
+    std::vector<std::pair<int64_t, MasterKey>> masterKeys;
+    std::vector<int64_t> offloadedLedgers;
+
+    std::unique_ptr<Iterator> it(db_->NewIterator(ReadOptions(), metadataColumnFamily_));
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+        Slice key = it->key();
+        if (key.size() != sizeof(LedgerStateKey)) {
+            LOG_WARN("Ignoring unknown ledger state record: " << key.ToString(true));
+            continue;
+        }
+
+        int64_t ledgerId = LedgerStateKey::ledgerIdFrom(key);
+        if (key[0] == LedgerStateKey::Fenced) {
+            fencedLedgers.push_back(ledgerId);
+        } else if (key[0] == LedgerStateKey::Key && it->value().size() == sizeof(MasterKey)) {
+            masterKeys.emplace_back(ledgerId, MasterKey());
+            memcpy(masterKeys.back().second.data(), it->value().data(), sizeof(MasterKey));
+        } else if (key[0] == LedgerStateKey::Offloaded) {
+            // The pointer is loaded by the tiering service
+            offloadedLedgers.push_back(ledgerId);
+        } else {
+            LOG_WARN("Ignoring unknown ledger state record: " << key.ToString(true));
+        }
+    }
+
+    if (!it->status().ok()) {
+        LOG_FATAL("Failed to load the ledger state: " << it->status().ToString());
+        std::exit(1);
+    }
+
+    for (int64_t ledgerId : fencedLedgers) {
+        fencedLedgers_.insert(ledgerId, true);
+    }
+
+    for (auto& masterKey : masterKeys) {
+        masterKeys_.insert(masterKey.first, masterKey.second);
+    }
+
+    for (int64_t ledgerId : offloadedLedgers) {
+        offloadedLedgers_.insert(ledgerId, true);
+    }
+
+    LOG_INFO("Loaded " << fencedLedgers.size() << " fenced ledgers and " << masterKeys.size() << " master keys");
 }
 
 Storage::~Storage() {
+    warmUpStopped_ = true;
+    if (warmUpThread_.joinable()) {
+        warmUpThread_.join();
+    }
+    saveHotRanges();
+
     // Write a null promise to make the journal thread to exit
-    JournalEntry entry { { }, { }, nullptr, walQueueLatency_->startTimer() };
+    JournalEntry entry { JournalEntryType::Entry, 0, 0, false, { }, nullptr, walQueueLatency_->startTimer() };
     journalQueue_.blockingWrite(std::move(entry));
     journalThread_.join();
+    readExecutor_.join();
+    bulkLoadExecutor_.join();
+    delete metadataColumnFamily_;
     delete db_;
 }
 
-Future<Unit> Storage::put(int64_t ledgerId, int64_t entryId, IOBufPtr data) {
+Future<Unit> Storage::put(int64_t ledgerId, int64_t entryId, IOBufPtr data, bool recovery) {
     PromisePtr promise = make_unique<Promise<Unit>>();
     Future<Unit> future = promise->getFuture();
 
-    union Key {
-        struct {
-            int64_t ledgerId;
-            int64_t entryId;
-        };
-        char data[0];
-    };
-
-    Key key;
-    key.ledgerId = Endian::big(ledgerId);
-    key.entryId = Endian::big(entryId);
-
-    JournalEntry entry { Slice(key.data, sizeof(key)), std::move(data), std::move(promise),
+    JournalEntry entry { JournalEntryType::Entry, ledgerId, entryId, recovery, std::move(data), std::move(promise),
             walQueueLatency_->startTimer() };
 
-    Slice valueSlice((const char*) data->data(), data->length());
-
     Timer addEntryEnqueueTimer = addEntryEnqueueLatency_->startTimer();
     journalQueue_.blockingWrite(std::move(entry));
     addEntryEnqueueTimer.completed();
@@ -136,10 +351,418 @@ Future<Unit> Storage::put(int64_t ledgerId, int64_t entryId, IOBufPtr data) {
     return future;
 }
 
+Future<Unit> Storage::fenceLedger(int64_t ledgerId) {
+    if (isOffloaded(ledgerId)) {
+        // Already immutable
+        return makeFuture();
+    }
+
+    if (fencedLedgers_.insert(ledgerId, true).second) {
+        LOG_INFO("Fenced ledger " << ledgerId);
+    }
+
+    // Write the record even if the ledger was already fenced: the previous record might still be in the journal
+    // queue, and the caller expects it to be persisted when the future completes
+    PromisePtr promise = make_unique<Promise<Unit>>();
+    Future<Unit> future = promise->getFuture();
+
+    JournalEntry entry { JournalEntryType::Fence, ledgerId, BookieConstant::InvalidEntryId, false, { },
+            std::move(promise), walQueueLatency_->startTimer() };
+    journalQueue_.blockingWrite(std::move(entry));
+    return future;
+}
+
+bool Storage::verifyMasterKey(int64_t ledgerId, const MasterKey& masterKey) {
+    if (isOffloaded(ledgerId)) {
+        // The adds are rejected anyway, don't record a key for an immutable ledger
+        return true;
+    }
+
+    folly::Optional<MasterKey> recorded = masterKeys_.get(ledgerId);
+    if (LIKELY(recorded.hasValue())) {
+        return constantTimeEquals(*recorded, masterKey);
+    }
+
+    // The record is enqueued while the key is only visible to this thread: the requests of other IO threads that find
+    // the key afterwards enqueue their entries behind the record, so no entry can be persisted without the key
+    auto res = masterKeys_.insert(ledgerId, masterKey, [&]() {
+        JournalEntry entry { JournalEntryType::MasterKey, ledgerId, BookieConstant::InvalidEntryId, false,
+                IOBuf::copyBuffer(masterKey.data(), masterKey.size()), make_unique<Promise<Unit>>(),
+                walQueueLatency_->startTimer() };
+        journalQueue_.blockingWrite(std::move(entry));
+    });
+
+    // Otherwise recorded concurrently by another request
+    return res.second || constantTimeEquals(res.first, masterKey);
+}
+
+Future<Unit> Storage::bulkLoad(std::vector<LedgerEntries> ledgers) {
+    auto ledgersPtr = std::make_shared<std::vector<LedgerEntries>>(std::move(ledgers));
+    return via(&bulkLoadExecutor_, [this, ledgersPtr]() {
+        ingestLedgers(*ledgersPtr);
+    });
+}
+
+void Storage::ingestLedgers(const std::vector<LedgerEntries>& ledgers) {
+    for (const LedgerEntries& ledger : ledgers) {
+        // The entries would be hidden by the offloaded ones, and dropped by the next offload
+        if (isOffloaded(ledger.ledgerId)) {
+            throw std::invalid_argument(
+                    sformat("Cannot bulk load entries into offloaded ledger {}", ledger.ledgerId));
+        }
+    }
+
+    Timer bulkLoadTimer = bulkLoadLatency_->startTimer();
+    std::string path = sformat("{}/{:08d}.sst", bulkLoadDirectory_, bulkLoadFileId_++);
+
+    SstFileWriter writer(EnvOptions(), db_->GetOptions());
+    Status status = writer.Open(path);
+    if (!status.ok()) {
+        throw std::runtime_error("Failed to create bulk load file: " + status.ToString());
+    }
+
+    int64_t entriesCount = 0;
+    folly::Optional<EntryKey> lastKey;
+    for (const LedgerEntries& ledger : ledgers) {
+        for (const auto& entry : ledger.entries) {
+            EntryKey key(ledger.ledgerId, entry.first);
+            if (lastKey && memcmp(&key, lastKey.get_pointer(), sizeof(EntryKey)) <= 0) {
+                fs::remove(path);
+                throw std::invalid_argument(
+                        sformat("Bulk load entries are not sorted at {}:{}", ledger.ledgerId, entry.first));
+            }
+            lastKey = key;
+
+            ByteRange value = entry.second->coalesce();
+            status = writer.Put(key.slice(), Slice((const char*) value.data(), value.size()));
+            if (!status.ok()) {
+                fs::remove(path);
+                throw std::runtime_error("Failed to write bulk load file: " + status.ToString());
+            }
+            ++entriesCount;
+        }
+    }
+
+    if (entriesCount == 0) {
+        fs::remove(path);
+        return;
+    }
+
+    status = writer.Finish();
+    if (status.ok()) {
+        IngestExternalFileOptions options;
+        // The file is renamed into the database directory instead of being copied
+        options.move_files = true;
+        status = db_->IngestExternalFile({ path }, options);
+    }
+
+    if (!status.ok()) {
+        fs::remove(path);
+        throw std::runtime_error("Failed to ingest bulk load file: " + status.ToString());
+    }
+
+    // The tail cache would hide the bulk loaded entries from the last entry reads
+    for (const LedgerEntries& ledger : ledgers) {
+        tailCache_.invalidate(ledger.ledgerId);
+    }
+
+    bulkLoadTimer.completed();
+    // The metrics are latency histograms: one sample per entry, as for the replicated entries
+    for (int64_t i = 0; i < entriesCount; i++) {
+        bulkLoadEntries_->addValueSample(1);
+    }
+    LOG_INFO("Bulk loaded " << entriesCount << " entries of " << ledgers.size() << " ledgers");
+}
+
+std::vector<int64_t> Storage::listLedgers() {
+    std::vector<int64_t> ledgers;
+
+    ReadOptions options;
+    options.fill_cache = false;
+    // Seeks jump from one ledger to the next, across the prefixes
+    options.total_order_seek = true;
+
+    std::unique_ptr<Iterator> it(db_->NewIterator(options));
+    for (it->SeekToFirst(); it->Valid();) {
+        if (it->key().size() != sizeof(EntryKey)) {
+            it->Next();
+            continue;
+        }
+
+        int64_t ledgerId = Endian::big(*(const int64_t*) it->key().data());
+        ledgers.push_back(ledgerId);
+
+        if (ledgerId == std::numeric_limits<int64_t>::max()) {
+            break;
+        }
+        it->Seek(EntryKey(ledgerId + 1, 0).slice());
+    }
+
+    if (!it->status().ok()) {
+        throw std::runtime_error(it->status().ToString());
+    }
+
+    return ledgers;
+}
+
+void Storage::scanLedger(int64_t ledgerId, const std::function<void(int64_t entryId, const Slice& data)>& callback) {
+    ReadOptions options;
+    options.fill_cache = false;
+
+    std::unique_ptr<Iterator> it(db_->NewIterator(options));
+    for (it->Seek(EntryKey(ledgerId, 0).slice()); it->Valid(); it->Next()) {
+        Slice key = it->key();
+        if (key.size() != sizeof(EntryKey) || Endian::big(*(const int64_t*) key.data()) != ledgerId) {
+            break;
+        }
+
+        callback(Endian::big(*(const int64_t*) (key.data() + sizeof(int64_t))), it->value());
+    }
+
+    if (!it->status().ok()) {
+        throw std::runtime_error(it->status().ToString());
+    }
+}
+
+void Storage::offloadLedger(int64_t ledgerId, const std::string& pointer) {
+    EntryKey begin(ledgerId, 0);
+    EntryKey end(ledgerId, std::numeric_limits<int64_t>::max());
+
+    WriteBatch writeBatch;
+    writeBatch.Put(metadataColumnFamily_, LedgerStateKey(LedgerStateKey::Offloaded, ledgerId).slice(), pointer);
+    writeBatch.DeleteRange(begin.slice(), end.slice());
+    // The range end is exclusive
+    writeBatch.Delete(end.slice());
+
+    // The offloaded ledger is immutable, its fence and master key records are not needed anymore
+    writeBatch.Delete(metadataColumnFamily_, LedgerStateKey(LedgerStateKey::Fenced, ledgerId).slice());
+    writeBatch.Delete(metadataColumnFamily_, LedgerStateKey(LedgerStateKey::Key, ledgerId).slice());
+
+    WriteOptions options;
+    options.sync = true;
+    Status status = db_->Write(options, &writeBatch);
+    if (!status.ok()) {
+        throw std::runtime_error(status.ToString());
+    }
+
+    offloadedLedgers_.insert(ledgerId, true);
+    fencedLedgers_.erase(ledgerId);
+    masterKeys_.erase(ledgerId);
+    tailCache_.invalidate(ledgerId);
+}
+
+std::vector<std::pair<int64_t, std::string>> Storage::offloadedLedgers() {
+    std::vector<std::pair<int64_t, std::string>> ledgers;
+
+    std::unique_ptr<Iterator> it(db_->NewIterator(ReadOptions(), metadataColumnFamily_));
+    const char prefix = LedgerStateKey::Offloaded;
+    for (it->Seek(Slice(&prefix, 1)); it->Valid(); it->Next()) {
+        Slice key = it->key();
+        if (key.size() != sizeof(LedgerStateKey) || key[0] != LedgerStateKey::Offloaded) {
+            break;
+        }
+
+        ledgers.emplace_back(LedgerStateKey::ledgerIdFrom(key), it->value().ToString());
+    }
+
+    if (!it->status().ok()) {
+        throw std::runtime_error(it->status().ToString());
+    }
+
+    return ledgers;
+}
+
+void Storage::logBlockCacheStats() {
+    static const std::vector<std::pair<Tickers, const char*>> tickers = { //
+            { BLOCK_CACHE_INDEX_HIT, "indexHit" }, //
+            { BLOCK_CACHE_INDEX_MISS, "indexMiss" }, //
+            { BLOCK_CACHE_FILTER_HIT, "filterHit" }, //
+            { BLOCK_CACHE_FILTER_MISS, "filterMiss" }, //
+            { BLOCK_CACHE_DATA_HIT, "dataHit" }, //
+            { BLOCK_CACHE_DATA_MISS, "dataMiss" }, //
+            { BLOOM_FILTER_USEFUL, "filterUseful" }, //
+            };
+
+    // The tickers are not reset, they are also part of the periodic RocksDB stats dump
+    std::lock_guard<std::mutex> lock(blockCacheStatsMutex_);
+    lastTickers_.resize(tickers.size());
+
+    std::ostringstream ss;
+    for (size_t i = 0; i < tickers.size(); i++) {
+        uint64_t count = statistics_->getTickerCount(tickers[i].first);
+        ss << tickers[i].second << ": " << count - lastTickers_[i] << " -- ";
+        lastTickers_[i] = count;
+    }
+
+    uint64_t pinnedUsage = 0;
+    db_->GetIntProperty("rocksdb.block-cache-pinned-usage", &pinnedUsage);
+    ss << "pinned: " << pinnedUsage / 1_MB << " MB";
+
+    LOG_INFO("Block cache -- " << ss.str());
+}
+
+void Storage::saveHotRanges() {
+    hotRanges_.save(hotRangesPath_);
+}
+
+void Storage::warmUp(double rateMb) {
+    setThreadName("bookie-warmup");
+
+    std::vector<HotRangeTracker::Range> ranges = HotRangeTracker::load(hotRangesPath_);
+    if (ranges.empty()) {
+        return;
+    }
+
+    LOG_INFO("Warming up the block cache with " << ranges.size() << " hot ranges");
+    steady_clock::time_point start = steady_clock::now();
+
+    // Permits are KB, acquired in chunks to keep the throttling cheap with small entries
+    RateLimiter rateLimiter(rateMb * 1024);
+    const uint64_t chunkSize = 64_KB;
+    uint64_t pendingBytes = 0;
+    uint64_t loadedBytes = 0;
+    size_t loadedRanges = 0;
+
+    ReadOptions options;
+    options.fill_cache = true;
+    options.readahead_size = 2_MB;
+    std::unique_ptr<Iterator> it(db_->NewIterator(options));
+
+    for (const HotRangeTracker::Range& range : ranges) {
+        if (warmUpStopped_ || loadedBytes >= warmUpMaxBytes_) {
+            break;
+        }
+
+        // Keep tracking the range, even if it's not read again before the next save
+        hotRanges_.add(range);
+
+        for (it->Seek(EntryKey(range.ledgerId, range.firstEntryId).slice()); it->Valid(); it->Next()) {
+            Slice key = it->key();
+            if (key.size() != sizeof(EntryKey) || Endian::big(*(const int64_t*) key.data()) != range.ledgerId
+                    || Endian::big(*(const int64_t*) (key.data() + sizeof(int64_t))) > range.lastEntryId) {
+                break;
+            }
+
+            pendingBytes += key.size() + it->value().size();
+            if (pendingBytes >= chunkSize) {
+                rateLimiter.aquire(pendingBytes / 1024);
+                // The metrics are latency histograms: count the chunks, the total size is logged at the end
+                warmUpChunks_->addValueSample(1);
+                loadedBytes += pendingBytes;
+                pendingBytes = 0;
+
+                if (warmUpStopped_ || loadedBytes >= warmUpMaxBytes_) {
+                    break;
+                }
+            }
+        }
+
+        if (!it->status().ok()) {
+            LOG_WARN("Failed to warm up the block cache: " << it->status().ToString());
+            return;
+        }
+        ++loadedRanges;
+    }
+
+    loadedBytes += pendingBytes;
+    LOG_INFO("Warmed up the block cache with " << loadedBytes << " bytes from " << loadedRanges << " ranges in "
+            << duration_cast<milliseconds>(steady_clock::now() - start).count() << " ms");
+}
+
+IOBufPtr Storage::getFromTailCache(int64_t ledgerId, int64_t entryId) {
+    if (!tailCache_.enabled()) {
+        return IOBufPtr();
+    }
+
+    IOBufPtr data = tailCache_.get(ledgerId, entryId);
+    if (data) {
+        tailCacheHit_->addValueSample(1);
+    } else {
+        tailCacheMiss_->addValueSample(1);
+    }
+    return data;
+}
+
+Future<IOBufPtr> Storage::get(int64_t ledgerId, int64_t entryId) {
+    return via(&readExecutor_, [this, ledgerId, entryId]() {
+        Timer getTimer = rocksDbGetLatency_->startTimer();
+        // When the entry is in a cached block, the slice pins the block instead of copying the value
+        std::unique_ptr<PinnableSlice> value = make_unique<PinnableSlice>();
+        Status status = db_->Get(ReadOptions(), db_->DefaultColumnFamily(), EntryKey(ledgerId, entryId).slice(),
+                value.get());
+        getTimer.completed();
+
+        if (status.IsNotFound()) {
+            return IOBufPtr();
+        } else if (!status.ok()) {
+            throw std::runtime_error(status.ToString());
+        }
+
+        hotRanges_.record(ledgerId, entryId);
+
+        // The response is written to the socket straight from the pinned block, which is released with the buffer
+        PinnableSlice* slice = value.release();
+        return IOBuf::takeOwnership((void*) slice->data(), slice->size(), [](void*, void* userData) {
+            delete static_cast<PinnableSlice*>(userData);
+        }, slice);
+    });
+}
+
+Future<IOBufPtr> Storage::getLastEntry(int64_t ledgerId) {
+    return via(&readExecutor_, [this, ledgerId]() {
+        std::unique_ptr<Iterator> it(db_->NewIterator(ReadOptions()));
+        it->SeekForPrev(EntryKey(ledgerId, std::numeric_limits<int64_t>::max()).slice());
+        if (!it->status().ok()) {
+            throw std::runtime_error(it->status().ToString());
+        }
+
+        if (!it->Valid() || it->key().size() != sizeof(EntryKey)
+                || Endian::big(*(const int64_t*) it->key().data()) != ledgerId) {
+            return IOBufPtr();
+        }
+
+        return IOBuf::copyBuffer(it->value().data(), it->value().size());
+    });
+}
+
+void Storage::revertLedgerState(const std::vector<int64_t>& fencedLedgers, const std::vector<int64_t>& keyLedgers) {
+    // The ledgers might have been fenced, or their key recorded, by an earlier batch: only the state not found in the
+    // database is dropped
+    std::string value;
+    for (int64_t ledgerId : fencedLedgers) {
+        Status status = db_->Get(ReadOptions(), metadataColumnFamily_,
+                LedgerStateKey(LedgerStateKey::Fenced, ledgerId).slice(), &value);
+        if (status.IsNotFound()) {
+            fencedLedgers_.erase(ledgerId);
+        } else if (!status.ok()) {
+            LOG_ERROR("Failed to read the fenced state of ledger " << ledgerId << ": " << status.ToString());
+        }
+    }
+
+    for (int64_t ledgerId : keyLedgers) {
+        Status status = db_->Get(ReadOptions(), metadataColumnFamily_,
+                LedgerStateKey(LedgerStateKey::Key, ledgerId).slice(), &value);
+        if (status.IsNotFound()) {
+            masterKeys_.erase(ledgerId);
+        } else if (!status.ok()) {
+            LOG_ERROR("Failed to read the master key of ledger " << ledgerId << ": " << status.ToString());
+        }
+    }
+}
+
 void Storage::runJournal() {
     setThreadName("bookie-journal");
 
     std::vector<PromisePtr> entriesToSync;
+
+    // Persisted entries to insert into the tail cache, once the batch is synced
+    std::vector<std::tuple<int64_t, int64_t, IOBufPtr>> entriesToCache;
+    const bool tailCacheEnabled = tailCache_.enabled();
+
+    // Ledgers whose fence or master key record is in the batch, to reconcile the in-memory state if the write fails
+    std::vector<int64_t> fencesToSync;
+    std::vector<int64_t> keysToSync;
+
     Unit unit;
     Metric* journalSyncLatency = walSyncLatency_.get();
     WriteOptions syncOptions;
@@ -176,8 +799,44 @@ void Storage::runJournal() {
             }
 
             entry.walTimeSpentInQueue.completed();
+
+            // The add might have passed the fenced check before the ledger was fenced. Checking again here, in the
+            // journal order, guarantees that no entry is persisted after the fence record.
+            if (entry.type == JournalEntryType::Entry
+                    && ((!entry.recovery && isFenced(entry.ledgerId)) || isOffloaded(entry.ledgerId))) {
+                entry.promise->setException(LedgerFencedException(entry.ledgerId));
+                continue;
+            }
+
             entriesToSync.emplace_back(std::move(entry.promise));
-            writeBatch.Put(entry.key, Slice((const char*) entry.data->data(), entry.data->length()));
+
+            switch (entry.type) {
+            case JournalEntryType::Entry: {
+                // The entry payload might be chained when it spans multiple network buffers
+                ByteRange value = entry.data->coalesce();
+                writeBatch.Put(EntryKey(entry.ledgerId, entry.entryId).slice(),
+                        Slice((const char*) value.data(), value.size()));
+
+                // The write batch has its own copy, the buffer is handed over to the cache
+                if (tailCacheEnabled) {
+                    entriesToCache.emplace_back(entry.ledgerId, entry.entryId, std::move(entry.data));
+                }
+                break;
+            }
+
+            case JournalEntryType::Fence:
+                writeBatch.Put(metadataColumnFamily_, LedgerStateKey(LedgerStateKey::Fenced, entry.ledgerId).slice(),
+                        Slice());
+                fencesToSync.push_back(entry.ledgerId);
+                break;
+
+            case JournalEntryType::MasterKey:
+                writeBatch.Put(metadataColumnFamily_,
+                        LedgerStateKey(LedgerStateKey::Key, entry.ledgerId).slice(),
+                        Slice((const char*) entry.data->data(), entry.data->length()));
+                keysToSync.push_back(entry.ledgerId);
+                break;
+            }
 
             if (toSyncCount++ == 1000) {
                 break;
@@ -189,13 +848,36 @@ void Storage::runJournal() {
         }
 
         Timer syncLatencyTimer = journalSyncLatency->startTimer();
-        db_->Write(syncOptions, &writeBatch);
+        Status status = db_->Write(syncOptions, &writeBatch);
         syncLatencyTimer.completed();
 
-        for (auto& pr : entriesToSync) {
-            pr->setValue(unit);
+        if (LIKELY(status.ok())) {
+            // A fence record persisted after a failed one, for the same ledger, fences it again
+            for (int64_t ledgerId : fencesToSync) {
+                fencedLedgers_.insert(ledgerId, true);
+            }
+
+            // Cache the entries before acknowledging them, so that the readers notified of the new entries find them
+            for (auto& cached : entriesToCache) {
+                tailCache_.put(std::get<0>(cached), std::get<1>(cached), *std::get<2>(cached));
+            }
+
+            for (auto& pr : entriesToSync) {
+                pr->setValue(unit);
+            }
+        } else {
+            LOG_ERROR("Failed to write to the journal: " << status.ToString());
+            revertLedgerState(fencesToSync, keysToSync);
+
+            std::runtime_error error("Failed to write to the journal: " + status.ToString());
+            for (auto& pr : entriesToSync) {
+                pr->setException(error);
+            }
         }
 
+        entriesToCache.clear();
+        fencesToSync.clear();
+        keysToSync.clear();
         entriesToSync.clear();
         writeBatch.Clear();
     }
@@ -21,37 +21,204 @@
 #pragma once
 
 #include <rocksdb/db.h>
+#include <rocksdb/statistics.h>
 #include <folly/futures/Future.h>
 #include <folly/io/IOBuf.h>
 #include <folly/MPMCQueue.h>
+#include <wangle/concurrent/CPUThreadPoolExecutor.h>
 
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include <stdexcept>
+#include <string>
 #include <memory>
 #include <thread>
+#include <utility>
+#include <vector>
 
 #include "BookieConfig.h"
+#include "BookieProtocol.h"
+#include "HotRangeTracker.h"
+#include "LedgerStateTable.h"
 #include "Metrics.h"
+#include "TailCache.h"
 
 using namespace folly;
 using rocksdb::Slice;
 typedef std::unique_ptr<IOBuf> IOBufPtr;
 
+/**
+ * Add rejected because the ledger was fenced while the entry was waiting for the journal, or because the ledger was
+ * offloaded (closed and immutable)
+ */
+class LedgerFencedException: public std::runtime_error {
+public:
+    explicit LedgerFencedException(int64_t ledgerId) :
+            std::runtime_error("Ledger " + std::to_string(ledgerId) + " is fenced") {
+    }
+};
+
 class Storage {
 public:
     Storage(const BookieConfig& conf, MetricsManager& metricsManager);
     ~Storage();
 
-    Future<Unit> put(int64_t ledgerId, int64_t entryId, IOBufPtr data);
+    /**
+     * Add an entry through the journal. Unless it's a recovery add, the entry is rejected if the ledger is fenced by
+     * the time the journal processes it, so that no add can be persisted after the fence record.
+     *
+     * @return a future completing when the entry is persisted, or failed with a LedgerFencedException
+     */
+    Future<Unit> put(int64_t ledgerId, int64_t entryId, IOBufPtr data, bool recovery = false);
+
+    // Entries of a ledger, by entryId
+    typedef std::vector<std::pair<int64_t, IOBufPtr>> EntryList;
+
+    struct LedgerEntries {
+        int64_t ledgerId;
+        EntryList entries;
+    };
+
+    /**
+     * Bulk load entries, bypassing the journal, the WAL and the memtable (eg: re-replication, imports).
+     *
+     * The entries are written into an SST file on a background thread, and the file is then ingested into the
+     * database. When the key range is not already in the database, as for a ledger copied from another bookie, the
+     * file lands directly in the bottom level and is never rewritten by the compactions.
+     *
+     * @param ledgers sorted by ledgerId, each with its entries sorted by entryId
+     * @return a future completing when the entries are persisted, or failed with a std::runtime_error
+     */
+    Future<Unit> bulkLoad(std::vector<LedgerEntries> ledgers);
+
+    /**
+     * @return the ids of the ledgers with entries in the database. Scans the whole key space, only meant for
+     *         background tasks.
+     */
+    std::vector<int64_t> listLedgers();
+
+    /**
+     * Iterate over the entries of a ledger, in entryId order, without filling the block cache
+     */
+    void scanLedger(int64_t ledgerId, const std::function<void(int64_t entryId, const Slice& data)>& callback);
+
+    /**
+     * Drop the entries of a ledger moved to the secondary storage, and persist the pointer to their new location, in
+     * a single atomic write.
+     */
+    void offloadLedger(int64_t ledgerId, const std::string& pointer);
+
+    /**
+     * @return the pointers of the ledgers moved to the secondary storage
+     */
+    std::vector<std::pair<int64_t, std::string>> offloadedLedgers();
+
+    /**
+     * Offloaded ledgers are immutable: their adds and bulk loads are rejected, since their reads are served from the
+     * secondary storage only
+     */
+    bool isOffloaded(int64_t ledgerId) const {
+        return offloadedLedgers_.contains(ledgerId);
+    }
+
+    /**
+     * Read an entry. The lookup is done on the storage read threads.
+     *
+     * @return a future yielding the entry data, or a null buffer if the entry does not exist
+     */
+    Future<IOBufPtr> get(int64_t ledgerId, int64_t entryId);
+
+    /**
+     * Lookup a recently persisted entry, on the caller thread. Use BookieConstant::LastAddConfirmed as entryId to read
+     * the last entry of the ledger.
+     *
+     * @return the entry data, or a null buffer if the entry is not in the tail cache
+     */
+    IOBufPtr getFromTailCache(int64_t ledgerId, int64_t entryId);
+
+    /**
+     * Save the ranges of entries recently read from the database, to warm up the block cache on the next start. Called
+     * periodically and on shutdown.
+     */
+    void saveHotRanges();
+
+    /**
+     * Log the block cache hits and misses of the index, filter and data blocks since the last call
+     */
+    void logBlockCacheStats();
+
+    /**
+     * Read the entry with the highest entryId stored for the ledger
+     *
+     * @return a future yielding the entry data, or a null buffer if there are no entries for the ledger
+     */
+    Future<IOBufPtr> getLastEntry(int64_t ledgerId);
+
+    /**
+     * Mark a ledger as fenced. New adds are rejected from the moment the call returns, including the ones already
+     * waiting for the journal, and the fence record is written through the journal.
+     *
+     * @return a future completing when the fence record is persisted. If the journal write fails, the future fails and
+     *         the ledger is not fenced anymore, unless an earlier record was persisted.
+     */
+    Future<Unit> fenceLedger(int64_t ledgerId);
+
+    /**
+     * Lock-free when no ledger is fenced, otherwise a shared lock on a shard of the table. Safe to call on the add
+     * entry path.
+     */
+    bool isFenced(int64_t ledgerId) const {
+        return fencedLedgers_.contains(ledgerId);
+    }
+
+    /**
+     * Check the master key of a ledger, with a shared lock lookup and a constant-time comparison. The first key seen
+     * for a ledger is recorded, and it is persisted through the journal ahead of any entry of the ledger.
+     *
+     * @return false if a different key was already recorded for the ledger
+     */
+    bool verifyMasterKey(int64_t ledgerId, const MasterKey& masterKey);
+
+    /**
+     * @return the number of entries waiting to be written to the journal
+     */
+    int64_t journalQueueSize() const {
+        return std::max<int64_t>(0, journalQueue_.size());
+    }
 
 private:
     void runJournal();
 
+    /**
+     * Drop the in-memory fenced state and master keys of the ledgers whose records failed to be written
+     */
+    void revertLedgerState(const std::vector<int64_t>& fencedLedgers, const std::vector<int64_t>& keyLedgers);
+    void loadLedgerState();
+    void ingestLedgers(const std::vector<LedgerEntries>& ledgers);
+    void warmUp(double rateMb);
+
+    // Wraps the default env when disk fault injection is enabled. Must outlive the db.
+    std::unique_ptr<rocksdb::Env> env_;
+
     rocksdb::DB* db_;
+
+    // Ledger state (fenced ledgers and master keys), kept apart from the entries
+    rocksdb::ColumnFamilyHandle* metadataColumnFamily_;
     const rocksdb::WriteOptions writeOptions_;
 
     typedef std::unique_ptr<Promise<Unit>> PromisePtr;
 
+    enum class JournalEntryType {
+        Entry, Fence, MasterKey,
+    };
+
     struct JournalEntry {
-        Slice key;
+        JournalEntryType type;
+        int64_t ledgerId;
+        int64_t entryId;
+        bool recovery;
         IOBufPtr data;
         PromisePtr promise;
         Timer walTimeSpentInQueue;
@@ -59,6 +226,30 @@ private:
 
     MPMCQueue<JournalEntry> journalQueue_;
 
+    wangle::CPUThreadPoolExecutor readExecutor_;
+
+    // Filled by the journal thread, after each sync
+    TailCache tailCache_;
+
+    HotRangeTracker hotRanges_;
+    const std::string hotRangesPath_;
+
+    // Loads the hot ranges of the previous run into the block cache, in background after the start
+    uint64_t warmUpMaxBytes_;
+    std::atomic<bool> warmUpStopped_;
+    std::thread warmUpThread_;
+
+    // Builds and ingests the bulk load files, one at a time
+    wangle::CPUThreadPoolExecutor bulkLoadExecutor_;
+    const std::string bulkLoadDirectory_;
+    std::atomic<int64_t> bulkLoadFileId_;
+
+    // In-memory mirrors of the fence and master key records. Ledgers are never unfenced, the entries are only removed
+    // with the ledger records.
+    LedgerStateTable<bool> fencedLedgers_;
+    LedgerStateTable<MasterKey> masterKeys_;
+    LedgerStateTable<bool> offloadedLedgers_;
+
     const bool fsyncWal_;
     std::thread journalThread_;
 
@@ -66,5 +257,15 @@ private:
     MetricPtr addEntryEnqueueLatency_;
     MetricPtr walSyncLatency_;
     MetricPtr walQueueLatency_;
+    MetricPtr rocksDbGetLatency_;
+    MetricPtr bulkLoadLatency_;
+    MetricPtr bulkLoadEntries_;
+    MetricPtr tailCacheHit_;
+    MetricPtr tailCacheMiss_;
+    MetricPtr warmUpChunks_;
+
+    std::shared_ptr<rocksdb::Statistics> statistics_;
+    std::mutex blockCacheStatsMutex_;
+    std::vector<uint64_t> lastTickers_;
 };
 
@@ -0,0 +1,153 @@
+/**
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "TailCache.h"
+
+#include "BookieProtocol.h"
+
+#include <algorithm>
+#include <cstring>
+
+TailCache::Ring::Ring(size_t capacity) :
+        entryIds(capacity, BookieConstant::InvalidEntryId),
+        entries(capacity),
+        lastEntryId(BookieConstant::InvalidEntryId),
+        bytes(0) {
+}
+
+TailCache::Shard::Shard(size_t maxLedgers) :
+        ledgers(maxLedgers),
+        bytes(0) {
+    // Called on the rings evicted by set() and prune(), but not by erase()
+    ledgers.setPruneHook([this](int64_t ledgerId, std::shared_ptr<Ring>&& ring) {
+        bytes -= ring->bytes;
+    });
+}
+
+TailCache::TailCache(size_t entriesPerLedger, size_t maxLedgers, size_t maxBytes) :
+        entriesPerLedger_(entriesPerLedger),
+        maxBytesPerShard_(std::max<size_t>(1, maxBytes / NumShards)) {
+    size_t maxLedgersPerShard = std::max<size_t>(1, maxLedgers / NumShards);
+    for (size_t i = 0; i < NumShards; i++) {
+        shards_.push_back(make_unique<Shard>(maxLedgersPerShard));
+    }
+}
+
+TailCache::Shard& TailCache::getShard(int64_t ledgerId) {
+    return *shards_[std::hash<int64_t>()(ledgerId) % NumShards];
+}
+
+void TailCache::put(int64_t ledgerId, int64_t entryId, const IOBuf& data) {
+    if (!enabled() || entryId < 0) {
+        return;
+    }
+
+    IOBufPtr entry = makeEntry(data);
+    size_t entryBytes = entry->capacity();
+
+    Shard& shard = getShard(ledgerId);
+    SharedMutex::WriteHolder lock(shard.mutex);
+
+    std::shared_ptr<Ring> ring;
+    auto it = shard.ledgers.find(ledgerId);
+    if (it != shard.ledgers.end()) {
+        ring = it->second;
+    } else {
+        ring = std::make_shared<Ring>(entriesPerLedger_);
+        shard.ledgers.set(ledgerId, ring);
+    }
+
+    size_t slot = entryId % entriesPerLedger_;
+    if (ring->entries[slot]) {
+        size_t replacedBytes = ring->entries[slot]->capacity();
+        ring->bytes -= replacedBytes;
+        shard.bytes -= replacedBytes;
+    }
+
+    ring->entryIds[slot] = entryId;
+    ring->entries[slot] = std::move(entry);
+    ring->lastEntryId = std::max(ring->lastEntryId, entryId);
+    ring->bytes += entryBytes;
+    shard.bytes += entryBytes;
+
+    // The ledger just written is the most recent one, it is never pruned
+    while (shard.bytes > maxBytesPerShard_ && shard.ledgers.size() > 1) {
+        shard.ledgers.prune(1);
+    }
+}
+
+IOBufPtr TailCache::makeEntry(const IOBuf& data) {
+    size_t length = data.computeChainDataLength();
+    if (!data.isChained() && data.capacity() <= 2 * length + MaxSlackBytes) {
+        return data.clone();
+    }
+
+    IOBufPtr entry = IOBuf::create(length);
+    for (ByteRange range : data) {
+        memcpy(entry->writableTail(), range.data(), range.size());
+        entry->append(range.size());
+    }
+    return entry;
+}
+
+IOBufPtr TailCache::get(int64_t ledgerId, int64_t entryId) {
+    if (!enabled()) {
+        return IOBufPtr();
+    }
+
+    Shard& shard = getShard(ledgerId);
+    SharedMutex::ReadHolder lock(shard.mutex);
+
+    // Lookups don't promote the ledger, so that they can run concurrently. Ledgers are kept by write recency.
+    auto it = shard.ledgers.findWithoutPromotion(ledgerId);
+    if (it == shard.ledgers.end()) {
+        return IOBufPtr();
+    }
+
+    const Ring& ring = *it->second;
+    if (entryId == BookieConstant::LastAddConfirmed) {
+        entryId = ring.lastEntryId;
+    }
+
+    if (entryId < 0) {
+        return IOBufPtr();
+    }
+
+    size_t slot = entryId % entriesPerLedger_;
+    if (ring.entryIds[slot] != entryId) {
+        return IOBufPtr();
+    }
+
+    return ring.entries[slot]->clone();
+}
+
+void TailCache::invalidate(int64_t ledgerId) {
+    if (!enabled()) {
+        return;
+    }
+
+    Shard& shard = getShard(ledgerId);
+    SharedMutex::WriteHolder lock(shard.mutex);
+    auto it = shard.ledgers.findWithoutPromotion(ledgerId);
+    if (it != shard.ledgers.end()) {
+        shard.bytes -= it->second->bytes;
+        shard.ledgers.erase(ledgerId);
+    }
+}
@@ -0,0 +1,106 @@
+/**
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <folly/EvictingCacheMap.h>
+#include <folly/SharedMutex.h>
+#include <folly/io/IOBuf.h>
+
+using namespace folly;
+
+typedef std::unique_ptr<IOBuf> IOBufPtr;
+
+/**
+ * Cache of the most recently persisted entries of each ledger, for the tailing readers.
+ *
+ * Each ledger has a ring of the last entries, indexed by entryId, and the least recently written ledgers are evicted
+ * when there are too many of them, or when their entries hold too much memory. The cached entries share the buffers of
+ * the add requests, and the reads return clones of them. An entry is only copied when its buffer is much larger than
+ * the entry, like a socket read buffer holding many requests, since it would pin the whole buffer.
+ *
+ * The cache is split into shards, each with its own lock. Reads only take the shard lock in shared mode.
+ */
+class TailCache {
+public:
+    /**
+     * @param entriesPerLedger number of entries kept for each ledger. The cache is disabled when 0.
+     * @param maxLedgers max number of ledgers in the cache
+     * @param maxBytes max memory held by the cached entries. The most recently written ledger is always kept.
+     */
+    TailCache(size_t entriesPerLedger, size_t maxLedgers, size_t maxBytes);
+
+    bool enabled() const {
+        return entriesPerLedger_ > 0;
+    }
+
+    void put(int64_t ledgerId, int64_t entryId, const IOBuf& data);
+
+    /**
+     * @param entryId the entry to read, or BookieConstant::LastAddConfirmed for the last entry of the ledger
+     * @return the entry data, or a null buffer if not in the cache
+     */
+    IOBufPtr get(int64_t ledgerId, int64_t entryId);
+
+    /**
+     * Drop the entries of a ledger, when they are modified outside of the journal
+     */
+    void invalidate(int64_t ledgerId);
+
+private:
+    struct Ring {
+        explicit Ring(size_t capacity);
+
+        std::vector<int64_t> entryIds;
+        std::vector<IOBufPtr> entries;
+        int64_t lastEntryId;
+        size_t bytes;
+    };
+
+    struct Shard {
+        explicit Shard(size_t maxLedgers);
+
+        SharedMutex mutex;
+        EvictingCacheMap<int64_t, std::shared_ptr<Ring>> ledgers;
+
+        // Memory held by the entries of the ledgers in the shard
+        size_t bytes;
+    };
+
+    Shard& getShard(int64_t ledgerId);
+
+    /**
+     * @return a clone of the data, or a copy if the clone would pin a buffer much larger than the data
+     */
+    static IOBufPtr makeEntry(const IOBuf& data);
+
+    static const size_t NumShards = 16;
+
+    // Unused capacity tolerated in a cloned buffer, beyond the size of the entry
+    static const size_t MaxSlackBytes = 4096;
+
+    const size_t entriesPerLedger_;
+    const size_t maxBytesPerShard_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+};
@@ -0,0 +1,419 @@
+/**
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "TieringService.h"
+
+#include "BookieConfig.h"
+#include "BookieProtocol.h"
+#include "LedgerMetadataCache.h"
+#include "Logging.h"
+#include "MetadataStore.h"
+#include "Storage.h"
+
+#include <algorithm>
+#include <limits>
+
+#include <folly/Bits.h>
+#include <folly/Format.h>
+#include <folly/ThreadName.h>
+#include <folly/io/Compression.h>
+#include <folly/io/Cursor.h>
+#include <folly/io/IOBufQueue.h>
+
+DECLARE_LOG_OBJECT();
+
+// Uncompressed size of the segment blocks, the unit of the reads from the segment store
+static const size_t BlockSize = 256 * 1024;
+
+// Ledgers larger than this are split into multiple segments, to bound the memory used while offloading
+static const size_t MaxSegmentSize = 128 * 1024 * 1024;
+
+static const uint8_t PointerFormatVersion = 1;
+
+// Index slot for each entry id, from 0 to lastEntryId: block (4) | offset of the entry record in the block (4). The
+// entries not stored on this bookie (striped ensembles) have no block.
+static const size_t IndexSlotSize = 8;
+static const uint32_t NoBlock = std::numeric_limits<uint32_t>::max();
+
+// Max number of ledger indexes kept loaded
+static const size_t MaxCachedIndexes = 1024;
+
+static const int NumReadThreads = 4;
+
+static int64_t currentTimeMillis() {
+    return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+}
+
+std::string TieringService::OffloadedLedger::serialize() const {
+    IOBufQueue queue;
+    io::Appender appender(&queue, 1024);
+    appender.write<uint8_t>(PointerFormatVersion);
+    appender.writeBE<int64_t>(lastEntryId);
+    appender.writeBE<uint32_t>(blocks.size());
+    for (const Block& block : blocks) {
+        appender.writeBE<int64_t>(block.firstEntryId);
+        appender.writeBE<uint32_t>(block.segment);
+        appender.writeBE<uint64_t>(block.offset);
+        appender.writeBE<uint32_t>(block.compressedLength);
+        appender.writeBE<uint32_t>(block.uncompressedLength);
+    }
+
+    std::string res;
+    queue.appendToString(res);
+    return res;
+}
+
+TieringService::OffloadedLedger TieringService::OffloadedLedger::parse(const std::string& data) {
+    IOBufPtr buf = IOBuf::wrapBuffer(data.data(), data.size());
+    io::Cursor cursor(buf.get());
+
+    uint8_t version = cursor.read<uint8_t>();
+    if (version != PointerFormatVersion) {
+        throw std::runtime_error("Unsupported offloaded ledger pointer version");
+    }
+
+    OffloadedLedger ledger;
+    ledger.lastEntryId = cursor.readBE<int64_t>();
+    uint32_t blocksCount = cursor.readBE<uint32_t>();
+    ledger.blocks.reserve(blocksCount);
+    for (uint32_t i = 0; i < blocksCount; i++) {
+        Block block;
+        block.firstEntryId = cursor.readBE<int64_t>();
+        block.segment = cursor.readBE<uint32_t>();
+        block.offset = cursor.readBE<uint64_t>();
+        block.compressedLength = cursor.readBE<uint32_t>();
+        block.uncompressedLength = cursor.readBE<uint32_t>();
+        ledger.blocks.push_back(block);
+    }
+
+    return ledger;
+}
+
+TieringService::TieringService(std::unique_ptr<SegmentStore> segmentStore, Storage& storage,
+        LedgerMetadataCache& metadataCache, MetricsManager& metricsManager, const BookieConfig& conf) :
+        segmentStore_(std::move(segmentStore)),
+        storage_(storage),
+        metadataCache_(metadataCache),
+        minLedgerAge_(conf.tieringLedgerAge()),
+        scanInterval_(conf.tieringScanInterval()),
+        offloadedCount_(0),
+        blockCache_(std::max<size_t>(1, conf.tieringCacheSizeBytes() / BlockSize)),
+        indexCache_(MaxCachedIndexes),
+        readExecutor_(NumReadThreads),
+        running_(false),
+        offloadedLedgersMetric_(metricsManager.createMetric("tieringOffloadedLedgers")),
+        offloadLatency_(metricsManager.createMetric("tieringOffload")),
+        cacheHit_(metricsManager.createMetric("tieringCacheHit")),
+        cacheMiss_(metricsManager.createMetric("tieringCacheMiss")),
+        segmentReadLatency_(metricsManager.createMetric("tieringSegmentRead")) {
+    for (auto& pointer : storage_.offloadedLedgers()) {
+        offloadedLedgers_[pointer.first] = std::make_shared<OffloadedLedger>(OffloadedLedger::parse(pointer.second));
+    }
+    offloadedCount_ = offloadedLedgers_.size();
+
+    LOG_INFO("Loaded " << offloadedLedgers_.size() << " offloaded ledgers");
+}
+
+TieringService::~TieringService() {
+    stop();
+    readExecutor_.join();
+}
+
+void TieringService::start() {
+    running_ = true;
+    thread_ = std::thread(std::bind(&TieringService::run, this));
+}
+
+void TieringService::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    stopCondition_.notify_all();
+
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void TieringService::run() {
+    setThreadName("bookie-tiering");
+
+    while (running_) {
+        try {
+            scan();
+        } catch (const std::exception& e) {
+            LOG_WARN("Failed to scan the ledgers to offload: " << e.what());
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        stopCondition_.wait_for(lock, scanInterval_, [this]() {
+            return !running_;
+        });
+    }
+}
+
+void TieringService::scan() {
+    int offloaded = 0;
+    for (int64_t ledgerId : storage_.listLedgers()) {
+        if (!running_) {
+            break;
+        }
+
+        if (isOffloaded(ledgerId)) {
+            // The local writes into offloaded ledgers are rejected. Offloading the ledger again would replace its
+            // segments with whatever is left locally.
+            LOG_WARN("Ignoring local entries of offloaded ledger " << ledgerId);
+            continue;
+        }
+
+        try {
+            if (isCold(ledgerId)) {
+                offload(ledgerId);
+                ++offloaded;
+            }
+        } catch (const std::exception& e) {
+            LOG_WARN("Failed to offload ledger " << ledgerId << ": " << e.what());
+        }
+    }
+
+    if (offloaded > 0) {
+        LOG_INFO("Offloaded " << offloaded << " ledgers");
+    }
+}
+
+bool TieringService::isCold(int64_t ledgerId) {
+    CachedLedgerMetadataPtr cached;
+    try {
+        cached = metadataCache_.get(ledgerId).get();
+    } catch (const MetadataException& e) {
+        if (e.error() == MetadataError::NoNode) {
+            // Deleted ledger, waiting to be garbage collected
+            return false;
+        }
+        throw;
+    }
+
+    // A closed ledger metadata is not modified anymore, except by the recovery
+    return cached->metadata.state == LedgerMetadata::State::Closed
+            && milliseconds(currentTimeMillis() - cached->node.stat.mtime) >= minLedgerAge_;
+}
+
+void TieringService::offload(int64_t ledgerId) {
+    Timer offloadTimer = offloadLatency_->startTimer();
+    std::unique_ptr<io::Codec> codec = io::getCodec(io::CodecType::LZ4);
+
+    OffloadedLedger ledger;
+    ledger.lastEntryId = BookieConstant::InvalidEntryId;
+
+    IOBufQueue index(IOBufQueue::cacheChainLength());
+    io::Appender indexAppender(&index, 64 * 1024);
+
+    IOBufQueue segment(IOBufQueue::cacheChainLength());
+    uint32_t segmentIndex = 0;
+
+    IOBufQueue block(IOBufQueue::cacheChainLength());
+    int64_t blockFirstEntryId = BookieConstant::InvalidEntryId;
+
+    auto finishBlock = [&]() {
+        if (block.empty()) {
+            return;
+        }
+
+        IOBufPtr uncompressed = block.move();
+        IOBufPtr compressed = codec->compress(uncompressed.get());
+
+        Block info;
+        info.firstEntryId = blockFirstEntryId;
+        info.segment = segmentIndex;
+        info.offset = segment.chainLength();
+        info.compressedLength = compressed->computeChainDataLength();
+        info.uncompressedLength = uncompressed->computeChainDataLength();
+        ledger.blocks.push_back(info);
+
+        segment.append(std::move(compressed));
+    };
+
+    auto finishSegment = [&]() {
+        if (segment.empty()) {
+            return;
+        }
+
+        IOBufPtr data = segment.move();
+        segmentStore_->write(getSegmentName(ledgerId, segmentIndex), *data);
+        ++segmentIndex;
+    };
+
+    storage_.scanLedger(ledgerId, [&](int64_t entryId, const Slice& data) {
+        if (block.empty()) {
+            blockFirstEntryId = entryId;
+        }
+
+        for (int64_t id = ledger.lastEntryId + 1; id < entryId; id++) {
+            indexAppender.writeBE<uint32_t>(NoBlock);
+            indexAppender.writeBE<uint32_t>(0);
+        }
+        indexAppender.writeBE<uint32_t>(ledger.blocks.size());
+        indexAppender.writeBE<uint32_t>(block.chainLength());
+
+        // Entry record: entryId (8) | length (4) | data
+        struct {
+            int64_t entryId;
+            uint32_t length;
+        } __attribute__((packed)) header { Endian::big(entryId), Endian::big((uint32_t) data.size()) };
+        block.append(&header, sizeof(header));
+        block.append(data.data(), data.size());
+        ledger.lastEntryId = entryId;
+
+        if (block.chainLength() >= BlockSize) {
+            finishBlock();
+            if (segment.chainLength() >= MaxSegmentSize) {
+                finishSegment();
+            }
+        }
+    });
+
+    finishBlock();
+    finishSegment();
+
+    if (ledger.blocks.empty()) {
+        return;
+    }
+
+    segmentStore_->write(getIndexName(ledgerId), *index.move());
+
+    auto pointer = std::make_shared<OffloadedLedger>(std::move(ledger));
+
+    // From now on, the reads are served from the segment store
+    {
+        std::lock_guard<SharedMutex> lock(ledgersMutex_);
+        offloadedLedgers_[ledgerId] = pointer;
+        offloadedCount_ = offloadedLedgers_.size();
+    }
+
+    storage_.offloadLedger(ledgerId, pointer->serialize());
+
+    offloadTimer.completed();
+    offloadedLedgersMetric_->addValueSample(1);
+    LOG_INFO("Offloaded ledger " << ledgerId << " -- Entries up to: " << pointer->lastEntryId << " -- Segments: "
+            << segmentIndex);
+}
+
+TieringService::OffloadedLedgerPtr TieringService::getLedger(int64_t ledgerId) const {
+    SharedMutex::ReadHolder lock(ledgersMutex_);
+    auto it = offloadedLedgers_.find(ledgerId);
+    return it != offloadedLedgers_.end() ? it->second : nullptr;
+}
+
+Future<IOBufPtr> TieringService::readEntry(int64_t ledgerId, int64_t entryId) {
+    return via(&readExecutor_, [this, ledgerId, entryId]() {
+        return read(ledgerId, entryId);
+    });
+}
+
+IOBufPtr TieringService::read(int64_t ledgerId, int64_t entryId) {
+    OffloadedLedgerPtr ledger = getLedger(ledgerId);
+    if (!ledger) {
+        return IOBufPtr();
+    }
+
+    if (entryId == BookieConstant::LastAddConfirmed) {
+        entryId = ledger->lastEntryId;
+    }
+
+    if (entryId < 0 || entryId > ledger->lastEntryId) {
+        return IOBufPtr();
+    }
+
+    IndexPtr index = getIndex(ledgerId, *ledger);
+    io::Cursor slot(index.get());
+    slot.skip(entryId * IndexSlotSize);
+    uint32_t blockIndex = slot.readBE<uint32_t>();
+    uint32_t offset = slot.readBE<uint32_t>();
+    if (blockIndex == NoBlock) {
+        return IOBufPtr();
+    } else if (blockIndex >= ledger->blocks.size()) {
+        throw std::runtime_error(sformat("Invalid index of offloaded ledger {}", ledgerId));
+    }
+
+    BlockPtr block = getBlock(ledgerId, *ledger, blockIndex);
+    io::Cursor cursor(block.get());
+    cursor.skip(offset);
+    if (cursor.readBE<int64_t>() != entryId) {
+        throw std::runtime_error(sformat("Invalid index of offloaded ledger {}", ledgerId));
+    }
+
+    // Shares the cached block buffer
+    IOBufPtr data;
+    cursor.clone(data, cursor.readBE<uint32_t>());
+    return data;
+}
+
+TieringService::BlockPtr TieringService::getBlock(int64_t ledgerId, const OffloadedLedger& ledger, size_t blockIndex) {
+    BlockKey key { ledgerId, blockIndex };
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex_);
+        auto it = blockCache_.find(key);
+        if (it != blockCache_.end()) {
+            cacheHit_->addValueSample(1);
+            return it->second;
+        }
+    }
+
+    cacheMiss_->addValueSample(1);
+
+    const Block& info = ledger.blocks[blockIndex];
+    Timer readTimer = segmentReadLatency_->startTimer();
+    IOBufPtr compressed = segmentStore_->read(getSegmentName(ledgerId, info.segment), info.offset,
+            info.compressedLength);
+    readTimer.completed();
+
+    BlockPtr block = io::getCodec(io::CodecType::LZ4)->uncompress(compressed.get(), info.uncompressedLength);
+
+    // Concurrent misses on the same block may both read it, the last one wins
+    std::lock_guard<std::mutex> lock(cacheMutex_);
+    blockCache_.set(key, block);
+    return block;
+}
+
+TieringService::IndexPtr TieringService::getIndex(int64_t ledgerId, const OffloadedLedger& ledger) {
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex_);
+        auto it = indexCache_.find(ledgerId);
+        if (it != indexCache_.end()) {
+            return it->second;
+        }
+    }
+
+    // With the local segment store, the buffer wraps the memory mapped index
+    IndexPtr index = segmentStore_->read(getIndexName(ledgerId), 0, (ledger.lastEntryId + 1) * IndexSlotSize);
+
+    std::lock_guard<std::mutex> lock(cacheMutex_);
+    indexCache_.set(ledgerId, index);
+    return index;
+}
+
+std::string TieringService::getSegmentName(int64_t ledgerId, uint32_t segment) {
+    return sformat("{:019d}-{:04d}.seg", ledgerId, segment);
+}
+
+std::string TieringService::getIndexName(int64_t ledgerId) {
+    return sformat("{:019d}.idx", ledgerId);
+}
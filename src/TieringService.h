@@ -0,0 +1,164 @@
+/**
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#pragma once
+
+#include "Metrics.h"
+#include "SegmentStore.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <folly/EvictingCacheMap.h>
+#include <folly/SharedMutex.h>
+#include <folly/futures/Future.h>
+#include <wangle/concurrent/CPUThreadPoolExecutor.h>
+
+class BookieConfig;
+class LedgerMetadataCache;
+class Storage;
+
+using namespace folly;
+
+typedef std::unique_ptr<IOBuf> IOBufPtr;
+
+/**
+ * Moves the cold ledgers to a secondary storage.
+ *
+ * A background scan looks for the closed ledgers whose metadata has not changed for longer than the configured age,
+ * and rewrites their entries into LZ4 compressed segments on the segment store. The local entries are then replaced
+ * by a pointer record holding the segments block index, so the hot tier only has to hold the active ledgers.
+ *
+ * Reads of the offloaded ledgers fetch the block containing the entry from the segment store, through an LRU cache of
+ * uncompressed blocks. Each offloaded ledger also gets a dense index object, with the block and offset of every entry
+ * id, so that locating an entry is a lookup in the (memory mapped) index instead of a scan of the block.
+ */
+class TieringService {
+public:
+    TieringService(std::unique_ptr<SegmentStore> segmentStore, Storage& storage, LedgerMetadataCache& metadataCache,
+            MetricsManager& metricsManager, const BookieConfig& conf);
+    ~TieringService();
+
+    void start();
+
+    void stop();
+
+    /**
+     * Lock-free when no ledger is offloaded
+     */
+    bool isOffloaded(int64_t ledgerId) const {
+        return offloadedCount_.load(std::memory_order_acquire) > 0 && getLedger(ledgerId) != nullptr;
+    }
+
+    /**
+     * Read an entry of an offloaded ledger. BookieConstant::LastAddConfirmed reads the last entry.
+     *
+     * @return a future yielding the entry data, or a null buffer if the entry does not exist
+     */
+    Future<IOBufPtr> readEntry(int64_t ledgerId, int64_t entryId);
+
+private:
+    struct Block {
+        int64_t firstEntryId;
+        uint32_t segment;
+        uint64_t offset;
+        uint32_t compressedLength;
+        uint32_t uncompressedLength;
+    };
+
+    /**
+     * Location of the entries of an offloaded ledger, persisted as pointer record in the storage
+     */
+    struct OffloadedLedger {
+        int64_t lastEntryId;
+        std::vector<Block> blocks;
+
+        std::string serialize() const;
+        static OffloadedLedger parse(const std::string& data);
+    };
+
+    typedef std::shared_ptr<const OffloadedLedger> OffloadedLedgerPtr;
+
+    struct BlockKey {
+        int64_t ledgerId;
+        size_t block;
+
+        bool operator==(const BlockKey& other) const {
+            return ledgerId == other.ledgerId && block == other.block;
+        }
+    };
+
+    struct BlockKeyHash {
+        size_t operator()(const BlockKey& key) const {
+            return std::hash<int64_t>()(key.ledgerId) * 31 + key.block;
+        }
+    };
+
+    typedef std::shared_ptr<const IOBuf> BlockPtr;
+    typedef std::shared_ptr<const IOBuf> IndexPtr;
+
+    void run();
+    void scan();
+    bool isCold(int64_t ledgerId);
+    void offload(int64_t ledgerId);
+
+    OffloadedLedgerPtr getLedger(int64_t ledgerId) const;
+    IOBufPtr read(int64_t ledgerId, int64_t entryId);
+    BlockPtr getBlock(int64_t ledgerId, const OffloadedLedger& ledger, size_t blockIndex);
+    IndexPtr getIndex(int64_t ledgerId, const OffloadedLedger& ledger);
+
+    static std::string getSegmentName(int64_t ledgerId, uint32_t segment);
+    static std::string getIndexName(int64_t ledgerId);
+
+    std::unique_ptr<SegmentStore> segmentStore_;
+    Storage& storage_;
+    LedgerMetadataCache& metadataCache_;
+
+    const milliseconds minLedgerAge_;
+    const seconds scanInterval_;
+
+    mutable SharedMutex ledgersMutex_;
+    std::unordered_map<int64_t, OffloadedLedgerPtr> offloadedLedgers_;
+    std::atomic<int64_t> offloadedCount_;
+
+    std::mutex cacheMutex_;
+    EvictingCacheMap<BlockKey, BlockPtr, BlockKeyHash> blockCache_;
+    EvictingCacheMap<int64_t, IndexPtr> indexCache_;
+
+    // Runs the blocking segment store reads
+    wangle::CPUThreadPoolExecutor readExecutor_;
+
+    std::atomic<bool> running_;
+    std::mutex mutex_;
+    std::condition_variable stopCondition_;
+    std::thread thread_;
+
+    MetricPtr offloadedLedgersMetric_;
+    MetricPtr offloadLatency_;
+    MetricPtr cacheHit_;
+    MetricPtr cacheMiss_;
+    MetricPtr segmentReadLatency_;
+};
@@ -0,0 +1,164 @@
+/**
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "TrafficCapture.h"
+#include "Logging.h"
+
+#include <folly/Bits.h>
+#include <folly/Format.h>
+#include <folly/ThreadName.h>
+#include <folly/io/Cursor.h>
+
+DECLARE_LOG_OBJECT();
+
+static const char CaptureMagic[] = "BKCAP01\n";
+static constexpr size_t CaptureMagicLength = sizeof(CaptureMagic) - 1;
+
+TrafficCapture::TrafficCapture(const std::string& path, bool capturePayloads) :
+        file_(path, std::ios::binary | std::ios::trunc),
+        capturePayloads_(capturePayloads),
+        startTime_(steady_clock::now()),
+        queue_(100000),
+        droppedRecords_(0),
+        writerThread_(std::bind(&TrafficCapture::runWriter, this)) {
+    if (!file_) {
+        throw std::runtime_error("Failed to open capture file " + path);
+    }
+
+    file_.write(CaptureMagic, CaptureMagicLength);
+    LOG_INFO("Capturing bookie traffic to " << path << " -- payloads: " << (capturePayloads ? "included" : "elided"));
+}
+
+TrafficCapture::~TrafficCapture() {
+    // A record with a negative timestamp makes the writer thread to exit
+    CaptureRecord record { };
+    record.timestampMicros = -1;
+    queue_.blockingWrite(std::move(record));
+    writerThread_.join();
+
+    LOG_INFO("Closed capture file -- dropped records: " << droppedRecords_);
+}
+
+void TrafficCapture::record(uint32_t connectionId, const Request& request) {
+    CaptureRecord record;
+    record.timestampMicros = duration_cast<microseconds>(steady_clock::now() - startTime_).count();
+    record.connectionId = connectionId;
+    record.protocolVersion = request.protocolVersion;
+    record.opCode = request.opCode;
+    record.flags = request.flags;
+    record.ledgerId = request.ledgerId;
+    record.entryId = request.entryId;
+    record.payloadLength = request.data ? request.data->computeChainDataLength() : 0;
+
+    if (capturePayloads_ && request.data) {
+        // Shares the request buffer, no copy is done on the IO thread
+        record.payload = request.data->clone();
+    }
+
+    if (!queue_.write(std::move(record))) {
+        ++droppedRecords_;
+    }
+}
+
+void TrafficCapture::runWriter() {
+    setThreadName("bookie-capture");
+
+    char header[CaptureRecord::HeaderSize];
+    CaptureRecord record;
+
+    while (true) {
+        queue_.blockingRead(record);
+        if (record.timestampMicros < 0) {
+            file_.flush();
+            return;
+        }
+
+        IOBuf headerBuf(IOBuf::WRAP_BUFFER, header, sizeof(header));
+        io::RWPrivateCursor writer(&headerBuf);
+        writer.writeBE<int64_t>(record.timestampMicros);
+        writer.writeBE<uint32_t>(record.connectionId);
+        writer.writeBE<int8_t>(record.protocolVersion);
+        writer.writeBE<int8_t>((int8_t) record.opCode);
+        writer.writeBE<int16_t>(record.flags);
+        writer.writeBE<int64_t>(record.ledgerId);
+        writer.writeBE<int64_t>(record.entryId);
+        writer.writeBE<uint32_t>(record.payloadLength);
+        writer.writeBE<uint8_t>(record.payload ? 1 : 0);
+
+        file_.write(header, sizeof(header));
+
+        if (record.payload) {
+            for (ByteRange range : *record.payload) {
+                file_.write((const char*) range.data(), range.size());
+            }
+        }
+
+        if (queue_.isEmpty()) {
+            file_.flush();
+        }
+    }
+}
+
+TrafficCaptureReader::TrafficCaptureReader(const std::string& path) :
+        file_(path, std::ios::binary) {
+    char magic[CaptureMagicLength];
+    if (!file_.read(magic, sizeof(magic)) || std::string(magic, sizeof(magic)) != CaptureMagic) {
+        throw std::runtime_error("Invalid capture file " + path);
+    }
+}
+
+bool TrafficCaptureReader::next(CaptureRecord& record) {
+    char header[CaptureRecord::HeaderSize];
+    if (!file_.read(header, sizeof(header))) {
+        if (file_.gcount() == 0) {
+            return false;
+        }
+        throw std::runtime_error("Truncated capture record header");
+    }
+
+    IOBuf headerBuf(IOBuf::WRAP_BUFFER, header, sizeof(header));
+    io::Cursor reader(&headerBuf);
+    record.timestampMicros = reader.readBE<int64_t>();
+    record.connectionId = reader.readBE<uint32_t>();
+    record.protocolVersion = reader.readBE<int8_t>();
+    record.opCode = (BookieOperation) reader.readBE<int8_t>();
+    record.flags = reader.readBE<int16_t>();
+    record.ledgerId = reader.readBE<int64_t>();
+    record.entryId = reader.readBE<int64_t>();
+    record.payloadLength = reader.readBE<uint32_t>();
+    bool payloadIncluded = reader.readBE<uint8_t>() != 0;
+
+    // Requests are bounded by the frame size, anything larger is a corrupted record
+    if (record.payloadLength > BookieConstant::MaxFrameSize) {
+        throw std::runtime_error(sformat("Invalid capture record payload length: {}", record.payloadLength));
+    }
+
+    record.payload.reset();
+    if (payloadIncluded) {
+        record.payload = IOBuf::create(record.payloadLength);
+        if (!file_.read((char*) record.payload->writableData(), record.payloadLength)) {
+            throw std::runtime_error(
+                    sformat("Truncated capture record payload: {}/{} bytes", file_.gcount(), record.payloadLength));
+        }
+        record.payload->append(record.payloadLength);
+    }
+
+    return true;
+}
@@ -0,0 +1,103 @@
+/**
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#pragma once
+
+#include "BookieProtocol.h"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <thread>
+
+#include <folly/MPMCQueue.h>
+
+using namespace folly;
+using namespace std::chrono;
+
+/**
+ * Single request recorded in a capture file.
+ *
+ * File layout: the 8 bytes magic "BKCAP01\n", followed by the records. Each record has a fixed size header, with
+ * all the integers in big-endian format:
+ *
+ *   timestampMicros (8) | connectionId (4) | protocolVersion (1) | opCode (1) | flags (2) |
+ *   ledgerId (8) | entryId (8) | payloadLength (4) | payloadIncluded (1)
+ *
+ * followed by payloadLength bytes of payload, when payloadIncluded is set.
+ */
+struct CaptureRecord {
+    int64_t timestampMicros;
+    uint32_t connectionId;
+    int8_t protocolVersion;
+    BookieOperation opCode;
+    int16_t flags;
+    int64_t ledgerId;
+    int64_t entryId;
+    uint32_t payloadLength;
+
+    // Null when the payload was elided
+    IOBufPtr payload;
+
+    static constexpr size_t HeaderSize = 8 + 4 + 1 + 1 + 2 + 8 + 8 + 4 + 1;
+};
+
+/**
+ * Record the requests received by the bookie into a capture file.
+ *
+ * Requests are handed to a background writer thread, so the IO threads never block on the file. When the writer
+ * falls behind, requests are dropped from the capture rather than slowing down the bookie.
+ */
+class TrafficCapture {
+public:
+    TrafficCapture(const std::string& path, bool capturePayloads);
+    ~TrafficCapture();
+
+    void record(uint32_t connectionId, const Request& request);
+
+private:
+    void runWriter();
+
+    std::ofstream file_;
+    const bool capturePayloads_;
+    const steady_clock::time_point startTime_;
+
+    MPMCQueue<CaptureRecord> queue_;
+    std::atomic<uint64_t> droppedRecords_;
+    std::thread writerThread_;
+};
+
+/**
+ * Sequentially read the records of a capture file
+ */
+class TrafficCaptureReader {
+public:
+    explicit TrafficCaptureReader(const std::string& path);
+
+    /**
+     * @return false when the end of the file is reached
+     * @throws std::runtime_error if the file is truncated in the middle of a record, or corrupted
+     */
+    bool next(CaptureRecord& record);
+
+private:
+    std::ifstream file_;
+};
@@ -23,6 +23,7 @@
 #include "Logging.h"
 #include <zookeeper/zookeeper.h>
 #include <functional>
+#include <iterator>
 #include <memory>
 #include <cassert>
 
@@ -32,17 +33,69 @@
 
 DECLARE_LOG_OBJECT();
 
+// Maximum number of writes sent in a single multi-op request
+static const size_t MaxWriteBatchSize = 128;
+
+struct WatchContext {
+    ZooKeeper* client;
+    Watcher watcher;
+};
+
 template<typename T>
 struct Context {
     ZooKeeper* client;
     std::string path;
     Promise<T> promise;
+
+    // Set when the operation installs a watch
+    WatchContext* watch;
+};
+
+struct ZooKeeper::PendingWrite {
+    MetadataOp op;
+    Promise<MetadataOpResult> promise;
 };
 
-ZooKeeper::ZooKeeper(const std::string& zkServers, std::chrono::milliseconds sessionTimeout) :
+struct ZooKeeper::MultiContext {
+    ZooKeeper* client;
+    std::vector<MetadataOp> ops;
+
+    // Invoked with the multi-op return code. The results are only meaningful when the multi-op succeeded.
+    std::function<void(int rc, std::vector<MetadataOpResult> results)> callback;
+
+    std::vector<zoo_op_t> zkOps;
+    std::vector<zoo_op_result_t> zkResults;
+    std::vector<std::vector<char>> pathBuffers;
+    std::vector<struct Stat> stats;
+};
+
+static NodeStat toStat(const struct Stat* stat) {
+    return {stat->czxid, stat->mzxid, stat->ctime, stat->mtime, stat->version, stat->cversion, stat->aversion,
+        stat->ephemeralOwner, stat->dataLength, stat->numChildren, stat->pzxid};
+}
+
+static const char* getOpName(MetadataOp::Type type) {
+    switch (type) {
+    case MetadataOp::Create:
+        return "create";
+    case MetadataOp::Remove:
+        return "delete";
+    case MetadataOp::SetData:
+        return "set data on";
+    case MetadataOp::Check:
+        return "check";
+    default:
+        return "unknown operation on";
+    }
+}
+
+ZooKeeper::ZooKeeper(const std::string& zkServers, std::chrono::milliseconds sessionTimeout,
+        Executor* callbackExecutor) :
         zkServers_(zkServers),
         sessionTimeout_(sessionTimeout),
-        zk_(nullptr) {
+        zk_(nullptr),
+        callbackExecutor_(callbackExecutor),
+        writeInFlight_(false) {
 }
 
 ZooKeeper::~ZooKeeper() {
@@ -50,8 +103,8 @@ ZooKeeper::~ZooKeeper() {
         LOG_INFO("Closing zk session " << format("0x{0:x}", zoo_client_id(zk_)->client_id));
         int rc = zookeeper_close(zk_);
         if (rc != ZOK) {
-            ZooKeeperError err = ZooKeeperException::getError(rc);
-            LOG_WARN("Failed to close zk session: " << ZooKeeperException::getErrorMsg(err));
+            MetadataError err = MetadataException::getError(rc);
+            LOG_WARN("Failed to close zk session: " << MetadataException::getErrorMsg(err));
         }
     }
 }
@@ -108,37 +161,415 @@ void ZooKeeper::registerSessionListener(SessionListener listener) {
     }
 }
 
-Future<std::string> ZooKeeper::create(const std::string& path, const std::string& value,
-        std::initializer_list<CreateFlag> createFlags) {
+int64_t ZooKeeper::sessionId() {
     std::lock_guard<std::mutex> lock { mutex_ };
+    return zk_ ? zoo_client_id(zk_)->client_id : 0;
+}
 
-    Context<std::string>* ctx = new Context<std::string> { this, path };
+template<typename T>
+Future<T> ZooKeeper::onCallbackExecutor(Future<T> future) {
+    if (callbackExecutor_) {
+        return std::move(future).via(callbackExecutor_);
+    } else {
+        return future;
+    }
+}
+
+Future<std::string> ZooKeeper::create(const std::string& path, const std::string& value,
+        std::initializer_list<CreateFlag> createFlags) {
     int flags = 0;
     for (auto flag : createFlags) {
         flags |= flag;
     }
 
-    int rc = zoo_acreate(zk_, path.c_str(), value.c_str(), value.length(), &ZOO_OPEN_ACL_UNSAFE, flags,
-            [](int rc, const char* path, const void* zkCtx) {
-                Context<std::string>* ctx = (Context<std::string>*)zkCtx;
+    return onCallbackExecutor(submitWrite(MetadataOp::create(path, value, flags)).then([](MetadataOpResult result) {
+        LOG_DEBUG("Successfully created z-node at " << result.path);
+        return result.path;
+    }));
+}
+
+Future<NodeStat> ZooKeeper::setData(const std::string& path, const std::string& value, int32_t version) {
+    return onCallbackExecutor(submitWrite(MetadataOp::setData(path, value, version)).then([](MetadataOpResult result) {
+        return result.stat;
+    }));
+}
+
+Future<Unit> ZooKeeper::remove(const std::string& path, int32_t version) {
+    return onCallbackExecutor(submitWrite(MetadataOp::remove(path, version)).then([](MetadataOpResult result) {
+    }));
+}
+
+Future<NodeData> ZooKeeper::get(const std::string& path, Watcher watcher) {
+    Context<NodeData>* ctx = new Context<NodeData> { this, path };
+    if (watcher) {
+        ctx->watch = new WatchContext { this, std::move(watcher) };
+    }
+    Future<NodeData> future = ctx->promise.getFuture();
+
+    int rc;
+    {
+        std::lock_guard<std::mutex> lock { mutex_ };
+        rc = zoo_awget(zk_, path.c_str(), ctx->watch ? &ZooKeeper::handleWatchEvent : nullptr, ctx->watch,
+                [](int rc, const char* value, int valueLen, const struct Stat* stat, const void* zkCtx) {
+                    Context<NodeData>* ctx = (Context<NodeData>*)zkCtx;
+
+                    if (rc == ZOK) {
+                        ctx->promise.setValue(NodeData {
+                                    value && valueLen > 0 ? std::string(value, valueLen) : std::string(),
+                                    toStat(stat)});
+                    } else {
+                        delete ctx->watch;
+                        ctx->promise.setException(make_exception_wrapper<MetadataException>(rc, //
+                                        to<std::string>("Failed to read z-node at ", ctx->path)));
+                    }
+
+                    delete ctx;
+                }, ctx);
+    }
+
+    if (rc != ZOK) {
+        delete ctx->watch;
+        delete ctx;
+        return makeFuture<NodeData>(
+                make_exception_wrapper<MetadataException>(rc, to<std::string>("Failed to read z-node at ", path)));
+    }
+
+    return onCallbackExecutor(std::move(future));
+}
+
+Future<Optional<NodeStat>> ZooKeeper::exists(const std::string& path, Watcher watcher) {
+    Context<Optional<NodeStat>>* ctx = new Context<Optional<NodeStat>> { this, path };
+    if (watcher) {
+        ctx->watch = new WatchContext { this, std::move(watcher) };
+    }
+    Future<Optional<NodeStat>> future = ctx->promise.getFuture();
+
+    int rc;
+    {
+        std::lock_guard<std::mutex> lock { mutex_ };
+        rc = zoo_awexists(zk_, path.c_str(), ctx->watch ? &ZooKeeper::handleWatchEvent : nullptr, ctx->watch,
+                [](int rc, const struct Stat* stat, const void* zkCtx) {
+                    Context<Optional<NodeStat>>* ctx = (Context<Optional<NodeStat>>*)zkCtx;
+
+                    if (rc == ZOK) {
+                        ctx->promise.setValue(toStat(stat));
+                    } else if (rc == ZNONODE) {
+                        // The watch is set on the missing z-node, to be notified when created
+                        ctx->promise.setValue(none);
+                    } else {
+                        delete ctx->watch;
+                        ctx->promise.setException(make_exception_wrapper<MetadataException>(rc, //
+                                        to<std::string>("Failed to check z-node at ", ctx->path)));
+                    }
+
+                    delete ctx;
+                }, ctx);
+    }
+
+    if (rc != ZOK) {
+        delete ctx->watch;
+        delete ctx;
+        return makeFuture<Optional<NodeStat>>(
+                make_exception_wrapper<MetadataException>(rc, to<std::string>("Failed to check z-node at ", path)));
+    }
+
+    return onCallbackExecutor(std::move(future));
+}
+
+Future<std::vector<std::string>> ZooKeeper::getChildren(const std::string& path, Watcher watcher) {
+    Context<std::vector<std::string>>* ctx = new Context<std::vector<std::string>> { this, path };
+    if (watcher) {
+        ctx->watch = new WatchContext { this, std::move(watcher) };
+    }
+    Future<std::vector<std::string>> future = ctx->promise.getFuture();
+
+    int rc;
+    {
+        std::lock_guard<std::mutex> lock { mutex_ };
+        rc = zoo_awget_children(zk_, path.c_str(), ctx->watch ? &ZooKeeper::handleWatchEvent : nullptr, ctx->watch,
+                [](int rc, const struct String_vector* strings, const void* zkCtx) {
+                    Context<std::vector<std::string>>* ctx = (Context<std::vector<std::string>>*)zkCtx;
+
+                    if (rc == ZOK) {
+                        std::vector<std::string> children;
+                        children.reserve(strings->count);
+                        for (int i = 0; i < strings->count; i++) {
+                            children.emplace_back(strings->data[i]);
+                        }
+                        ctx->promise.setValue(std::move(children));
+                    } else {
+                        delete ctx->watch;
+                        ctx->promise.setException(make_exception_wrapper<MetadataException>(rc, //
+                                        to<std::string>("Failed to get children of z-node at ", ctx->path)));
+                    }
+
+                    delete ctx;
+                }, ctx);
+    }
+
+    if (rc != ZOK) {
+        delete ctx->watch;
+        delete ctx;
+        return makeFuture<std::vector<std::string>>(make_exception_wrapper<MetadataException>(rc,
+                to<std::string>("Failed to get children of z-node at ", path)));
+    }
+
+    return onCallbackExecutor(std::move(future));
+}
+
+Future<std::vector<MetadataOpResult>> ZooKeeper::multi(std::vector<MetadataOp> ops) {
+    auto promise = std::make_shared<Promise<std::vector<MetadataOpResult>>>();
+    Future<std::vector<MetadataOpResult>> future = promise->getFuture();
+
+    std::unique_ptr<MultiContext> ctx(new MultiContext { this, std::move(ops) });
+    ctx->callback = [promise](int rc, std::vector<MetadataOpResult> results) {
+        if (rc == ZOK) {
+            promise->setValue(std::move(results));
+        } else {
+            promise->setException(make_exception_wrapper<MetadataException>(rc, "Failed to execute multi-op"));
+        }
+    };
 
-                if (rc == ZOK) {
-                    LOG_DEBUG("Successfully created z-node at " << path);
-                    ctx->promise.setValue(path);
-                } else {
-                    ctx->promise.setException(make_exception_wrapper<ZooKeeperException>(rc, //
-                                    to<std::string>("Failed to create z-node at ", ctx->path) ));
+    sendMulti(std::move(ctx));
+    return onCallbackExecutor(std::move(future));
+}
+
+void ZooKeeper::sendMulti(std::unique_ptr<MultiContext> ctx) {
+    size_t count = ctx->ops.size();
+    ctx->zkOps.resize(count);
+    ctx->zkResults.resize(count);
+    ctx->pathBuffers.resize(count);
+    ctx->stats.resize(count);
+
+    for (size_t i = 0; i < count; i++) {
+        const MetadataOp& op = ctx->ops[i];
+        zoo_op_t* zkOp = &ctx->zkOps[i];
+
+        switch (op.type) {
+        case MetadataOp::Create:
+            // Leave room for the sequence suffix
+            ctx->pathBuffers[i].resize(op.path.size() + 16);
+            zoo_create_op_init(zkOp, op.path.c_str(), op.value.c_str(), op.value.length(), &ZOO_OPEN_ACL_UNSAFE,
+                    op.flags, ctx->pathBuffers[i].data(), ctx->pathBuffers[i].size());
+            break;
+        case MetadataOp::Remove:
+            zoo_delete_op_init(zkOp, op.path.c_str(), op.version);
+            break;
+        case MetadataOp::SetData:
+            zoo_set_op_init(zkOp, op.path.c_str(), op.value.c_str(), op.value.length(), op.version, &ctx->stats[i]);
+            break;
+        case MetadataOp::Check:
+            zoo_check_op_init(zkOp, op.path.c_str(), op.version);
+            break;
+        }
+    }
+
+    MultiContext* rawCtx = ctx.release();
+    int rc;
+    {
+        std::lock_guard<std::mutex> lock { mutex_ };
+        rc = zoo_amulti(zk_, count, rawCtx->zkOps.data(), rawCtx->zkResults.data(), [](int rc, const void* zkCtx) {
+            std::unique_ptr<MultiContext> ctx((MultiContext*) zkCtx);
+
+            std::vector<MetadataOpResult> results;
+            if (rc == ZOK) {
+                results.reserve(ctx->ops.size());
+                for (size_t i = 0; i < ctx->ops.size(); i++) {
+                    MetadataOpResult result {MetadataException::getError(ctx->zkResults[i].err)};
+                    if (ctx->ops[i].type == MetadataOp::Create) {
+                        result.path = ctx->pathBuffers[i].data();
+                    } else {
+                        result.path = ctx->ops[i].path;
+                    }
+
+                    if (ctx->ops[i].type == MetadataOp::SetData) {
+                        result.stat = toStat(&ctx->stats[i]);
+                    }
+                    results.push_back(std::move(result));
                 }
+            }
+
+            ctx->callback(rc, std::move(results));
+        }, rawCtx);
+    }
+
+    if (rc != ZOK) {
+        std::unique_ptr<MultiContext> ctx(rawCtx);
+        ctx->callback(rc, {});
+    }
+}
+
+Future<MetadataOpResult> ZooKeeper::submitWrite(MetadataOp op) {
+    std::unique_ptr<PendingWrite> write(new PendingWrite { std::move(op) });
+    Future<MetadataOpResult> future = write->promise.getFuture();
+
+    std::unique_lock<std::mutex> lock { writeMutex_ };
+    if (writeInFlight_) {
+        queuedWrites_.push_back(std::move(write));
+        return future;
+    }
 
-                delete ctx;
+    writeInFlight_ = true;
+    lock.unlock();
+
+    sendWrite(std::move(write), true);
+    return future;
+}
+
+void ZooKeeper::sendWrites(std::vector<std::unique_ptr<PendingWrite>> writes) {
+    if (writes.size() == 1) {
+        sendWrite(std::move(writes.front()), true);
+        return;
+    }
+
+    LOG_DEBUG("Sending batch of " << writes.size() << " writes");
+    auto batch = std::make_shared<std::vector<std::unique_ptr<PendingWrite>>>(std::move(writes));
+
+    std::unique_ptr<MultiContext> ctx(new MultiContext { this });
+    for (auto& write : *batch) {
+        ctx->ops.push_back(write->op);
+    }
+
+    ctx->callback = [this, batch](int rc, std::vector<MetadataOpResult> results) {
+        if (rc == ZOK) {
+            for (size_t i = 0; i < batch->size(); i++) {
+                (*batch)[i]->promise.setValue(std::move(results[i]));
+            }
+        } else if (rc <= ZAPIERROR) {
+            // One of the writes failed, and the whole batch was rejected. Retry each write on its own to find out.
+            LOG_DEBUG("Batch of " << batch->size() << " writes failed: " << MetadataException(rc).what()
+                    << " -- Retrying them individually");
+            for (auto& write : *batch) {
+                sendWrite(std::move(write), false);
+            }
+        } else {
+            // The batch may have been applied before the connection was lost: resending its writes could create
+            // duplicate sequential z-nodes, or fail the writes that succeeded. They fail, as they would on their own.
+            for (auto& write : *batch) {
+                write->promise.setException(make_exception_wrapper<MetadataException>(rc, //
+                        to<std::string>("Failed to ", getOpName(write->op.type), " z-node at ", write->op.path)));
+            }
+        }
+
+        writeCompleted();
+    };
+
+    sendMulti(std::move(ctx));
+}
+
+void ZooKeeper::sendWrite(std::unique_ptr<PendingWrite> write, bool inFlight) {
+    struct WriteContext {
+        ZooKeeper* client;
+        std::unique_ptr<PendingWrite> write;
+        bool inFlight;
+
+        void complete(int rc, MetadataOpResult result) {
+            if (rc == ZOK) {
+                write->promise.setValue(std::move(result));
+            } else {
+                write->promise.setException(make_exception_wrapper<MetadataException>(rc, //
+                                to<std::string>("Failed to ", getOpName(write->op.type), " z-node at ", write->op.path)));
+            }
+
+            if (inFlight) {
+                client->writeCompleted();
+            }
+        }
+    };
+
+    WriteContext* ctx = new WriteContext { this, std::move(write), inFlight };
+    const MetadataOp& op = ctx->write->op;
+
+    int rc;
+    {
+        std::lock_guard<std::mutex> lock { mutex_ };
+
+        switch (op.type) {
+        case MetadataOp::Create:
+            rc = zoo_acreate(zk_, op.path.c_str(), op.value.c_str(), op.value.length(), &ZOO_OPEN_ACL_UNSAFE, op.flags,
+                    [](int rc, const char* path, const void* zkCtx) {
+                        std::unique_ptr<WriteContext> ctx((WriteContext*) zkCtx);
+                        ctx->complete(rc, {MetadataError::OK, rc == ZOK ? path : ""});
+                    }, ctx);
+            break;
+
+        case MetadataOp::SetData:
+            rc = zoo_aset(zk_, op.path.c_str(), op.value.c_str(), op.value.length(), op.version,
+                    [](int rc, const struct Stat* stat, const void* zkCtx) {
+                        std::unique_ptr<WriteContext> ctx((WriteContext*) zkCtx);
+                        MetadataOpResult result {MetadataError::OK, ctx->write->op.path};
+                        if (rc == ZOK) {
+                            result.stat = toStat(stat);
+                        }
+                        ctx->complete(rc, std::move(result));
+                    }, ctx);
+            break;
+
+        case MetadataOp::Remove:
+            rc = zoo_adelete(zk_, op.path.c_str(), op.version, [](int rc, const void* zkCtx) {
+                std::unique_ptr<WriteContext> ctx((WriteContext*) zkCtx);
+                ctx->complete(rc, {MetadataError::OK, ctx->write->op.path});
             }, ctx);
+            break;
+
+        default:
+            rc = ZBADARGUMENTS;
+            break;
+        }
+    }
 
     if (rc != ZOK) {
-        return makeFuture<std::string>(
-                make_exception_wrapper<ZooKeeperException>(rc, to<std::string>("Failed to create z-node at ", path)));
+        std::unique_ptr<WriteContext>(ctx)->complete(rc, {});
+    }
+}
+
+void ZooKeeper::writeCompleted() {
+    std::vector<std::unique_ptr<PendingWrite>> batch;
+
+    {
+        std::lock_guard<std::mutex> lock { writeMutex_ };
+        if (queuedWrites_.empty()) {
+            writeInFlight_ = false;
+            return;
+        }
+
+        if (queuedWrites_.size() <= MaxWriteBatchSize) {
+            batch.swap(queuedWrites_);
+        } else {
+            auto end = queuedWrites_.begin() + MaxWriteBatchSize;
+            std::move(queuedWrites_.begin(), end, std::back_inserter(batch));
+            queuedWrites_.erase(queuedWrites_.begin(), end);
+        }
     }
 
-    return ctx->promise.getFuture();
+    sendWrites(std::move(batch));
+}
+
+void ZooKeeper::handleWatchEvent(zhandle_t* zh, int type, int state, const char* path, void* watcherCtx) {
+    WatchContext* ctx = reinterpret_cast<WatchContext*>(watcherCtx);
+
+    if (type == ZOO_SESSION_EVENT && state != ZOO_EXPIRED_SESSION_STATE) {
+        // Watches survive disconnections, keep waiting for the z-node event
+        return;
+    }
+
+    WatchEvent event { static_cast<WatchEventType>(type), path ? path : "" };
+    LOG_DEBUG("Triggered watch on '" << event.path << "' -- Type: " << getEventTypeStr(type));
+
+    Watcher watcher = std::move(ctx->watcher);
+    ctx->client->dispatch([watcher, event]() {
+        watcher(event);
+    });
+
+    delete ctx;
+}
+
+void ZooKeeper::dispatch(std::function<void()> callback) {
+    if (callbackExecutor_) {
+        callbackExecutor_->add(std::move(callback));
+    } else {
+        callback();
+    }
 }
 
 std::string ZooKeeper::getEventTypeStr(int type) {
@@ -176,80 +607,3 @@ std::string ZooKeeper::getSessionStateStr(int state) {
         return to<std::string>(state);
     }
 }
-
-ZooKeeperException::ZooKeeperException(int rc) :
-        zkError_(getError(rc)),
-        msg_(getErrorMsg(zkError_)) {
-}
-
-ZooKeeperException::ZooKeeperException(int rc, const std::string& msg) :
-        zkError_(getError(rc)),
-        msg_(to<std::string>(msg, " - ", getErrorMsg(zkError_))) {
-}
-
-const char* ZooKeeperException::what() const noexcept {
-    return msg_.c_str();
-}
-
-ZooKeeperError ZooKeeperException::error() const {
-    return zkError_;
-}
-
-ZooKeeperError ZooKeeperException::getError(int rc) {
-    return static_cast<ZooKeeperError>(rc);
-}
-
-std::string ZooKeeperException::getErrorMsg(ZooKeeperError zkError) {
-    switch (zkError) {
-    case ZooKeeperError::OK:
-        return "OK";
-    case ZooKeeperError::SystemError:
-        return "System Error";
-    case ZooKeeperError::RuntimeInconsistency:
-        return "Runtime inconsistency";
-    case ZooKeeperError::DataIinconsistency:
-        return "Data inconsistency";
-    case ZooKeeperError::ConnectionLoss:
-        return "Connection loss";
-    case ZooKeeperError::MarshallingError:
-        return "Marshalling error";
-    case ZooKeeperError::Unimplemented:
-        return "Unimplemented";
-    case ZooKeeperError::OperationTimeout:
-        return "Operation timeout";
-    case ZooKeeperError::BadArguments:
-        return "Bad arguments";
-    case ZooKeeperError::InvalidState:
-        return "Invalid state";
-    case ZooKeeperError::ApiError:
-        return "API error";
-    case ZooKeeperError::NoNode:
-        return "No node";
-    case ZooKeeperError::NoAuth:
-        return "No Auth";
-    case ZooKeeperError::BadVersion:
-        return "Bad Version";
-    case ZooKeeperError::NoChildrenForEphemerals:
-        return "No children for ephemerals";
-    case ZooKeeperError::NodeExists:
-        return "Node exists";
-    case ZooKeeperError::NotEmpty:
-        return "Not empty";
-    case ZooKeeperError::SessionExpired:
-        return "Session expired";
-    case ZooKeeperError::InvalidCallback:
-        return "Invalid callback";
-    case ZooKeeperError::InvalidACL:
-        return "Invalid ACL";
-    case ZooKeeperError::AuthFailed:
-        return "Auth failed";
-    case ZooKeeperError::Closing:
-        return "Closing";
-    case ZooKeeperError::Nothing:
-        return "Nothing";
-    case ZooKeeperError::SessionMoved:
-        return "Session moved";
-    default:
-        return to<std::string>("Unknown error (", zkError, ")");
-    }
-}
@@ -20,102 +20,79 @@
  */
 #pragma once
 
+#include "MetadataStore.h"
+
 #include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
+#include <folly/Executor.h>
 #include <folly/futures/Future.h>
 
 struct _zhandle;
 
 using namespace folly;
 
-enum class ZooKeeperError
-    : int {
-        OK = 0, /*!< Everything is OK */
-
-        /** System and server-side errors.
-         * This is never thrown by the server, it shouldn't be used other than
-         * to indicate a range. Specifically error codes greater than this
-         * value, but lesser than {@link #ZAPIERROR}, are system errors. */
-        SystemError = -1, //
-    RuntimeInconsistency = -2, /*!< A runtime inconsistency was found */
-    DataIinconsistency = -3, /*!< A data inconsistency was found */
-    ConnectionLoss = -4, /*!< Connection to the server has been lost */
-    MarshallingError = -5, /*!< Error while marshalling or unmarshalling data */
-    Unimplemented = -6, /*!< Operation is unimplemented */
-    OperationTimeout = -7, /*!< Operation timeout */
-    BadArguments = -8, /*!< Invalid arguments */
-    InvalidState = -9, /*!< Invliad zhandle state */
-
-    /** API errors.
-     * This is never thrown by the server, it shouldn't be used other than
-     * to indicate a range. Specifically error codes greater than this
-     * value are API errors (while values less than this indicate a
-     * {@link #ZSYSTEMERROR}).
-     */
-    ApiError = -100,
-    NoNode = -101, /*!< Node does not exist */
-    NoAuth = -102, /*!< Not authenticated */
-    BadVersion = -103, /*!< Version conflict */
-    NoChildrenForEphemerals = -108, /*!< Ephemeral nodes may not have children */
-    NodeExists = -110, /*!< The node already exists */
-    NotEmpty = -111, /*!< The node has children */
-    SessionExpired = -112, /*!< The session has been expired by the server */
-    InvalidCallback = -113, /*!< Invalid callback specified */
-    InvalidACL = -114, /*!< Invalid ACL specified */
-    AuthFailed = -115, /*!< Client authentication failed */
-    Closing = -116, /*!< ZooKeeper is closing */
-    Nothing = -117, /*!< (not error) no server responses to process */
-    SessionMoved = -118 /*!<session moved to another server, so operation is ignored */
-};
-
-class ZooKeeperException: public std::exception {
+/**
+ * Asynchronous ZooKeeper client.
+ *
+ * The futures returned by the client, and the watches, are completed on the callback executor when one is provided.
+ * Otherwise they run on the ZooKeeper client completion thread, and they should not block.
+ *
+ * Concurrent write operations (create, setData, remove) are batched: while a write is in flight, new writes are
+ * queued and then sent together in a single multi-op request. If the server rejects the multi-op, its operations are
+ * retried individually, so that each one gets its own result. If the connection fails, they all fail with its error.
+ */
+class ZooKeeper: public MetadataStore {
 public:
-    explicit ZooKeeperException(int rc);
-    ZooKeeperException(int rc, const std::string& msg);
-    const char* what() const noexcept override;
+    ZooKeeper(const std::string& zkServers, std::chrono::milliseconds sessionTimeout,
+            Executor* callbackExecutor = nullptr);
+    ZooKeeper(const ZooKeeper& x) = delete;
+    ZooKeeper& operator =(const ZooKeeper& x) = delete;
+    ~ZooKeeper();
 
-    ZooKeeperError error() const;
+    Future<uint64_t> startSession() override;
 
-    static ZooKeeperError getError(int rc);
-    static std::string getErrorMsg(ZooKeeperError zkError);
+    void registerSessionListener(SessionListener listener) override;
 
-private:
-    ZooKeeperError zkError_;
-    std::string msg_;
-};
+    int64_t sessionId() override;
 
-class ZooKeeper {
-public:
-    typedef std::function<void()> SessionListener;
+    Future<std::string> create(const std::string& path, const std::string& value,
+            std::initializer_list<CreateFlag> createFlags) override;
 
-    enum CreateFlag {
-        Ephemeral = 0x01, //
-        Sequence = 0x02,
-    };
+    Future<NodeData> get(const std::string& path, Watcher watcher = nullptr) override;
 
-    ZooKeeper(const std::string& zkServers, std::chrono::milliseconds sessionTimeout);
-    ZooKeeper(const ZooKeeper& x) = delete;
-    ZooKeeper& operator =(const ZooKeeper& x) = delete;
-    ~ZooKeeper();
+    Future<Optional<NodeStat>> exists(const std::string& path, Watcher watcher = nullptr) override;
 
-    Future<uint64_t> startSession();
+    Future<std::vector<std::string>> getChildren(const std::string& path, Watcher watcher = nullptr) override;
 
-    void registerSessionListener(SessionListener listener);
+    Future<NodeStat> setData(const std::string& path, const std::string& value, int32_t version = -1) override;
 
-    /**
-     * Create a z-node
-     *
-     * @param path
-     * @param value
-     * @param createFlags
-     * @return a future yielding the effective path of the created z-node
-     */
-    Future<std::string> create(const std::string& path, const std::string& value,
-            std::initializer_list<CreateFlag> createFlags);
+    Future<Unit> remove(const std::string& path, int32_t version = -1) override;
+
+    Future<std::vector<MetadataOpResult>> multi(std::vector<MetadataOp> ops) override;
 
 private:
+    struct PendingWrite;
+    struct MultiContext;
+
+    Future<MetadataOpResult> submitWrite(MetadataOp op);
+    void sendWrites(std::vector<std::unique_ptr<PendingWrite>> writes);
+    void sendWrite(std::unique_ptr<PendingWrite> write, bool inFlight);
+    void writeCompleted();
+
+    void sendMulti(std::unique_ptr<MultiContext> ctx);
+
+    template<typename T>
+    Future<T> onCallbackExecutor(Future<T> future);
+
+    void dispatch(std::function<void()> callback);
+
     static void handleSessionEvent(_zhandle* zh, int type, int state, const char* path, void* watcherCtx);
+    static void handleWatchEvent(_zhandle* zh, int type, int state, const char* path, void* watcherCtx);
 
     static std::string getEventTypeStr(int type);
     static std::string getSessionStateStr(int state);
@@ -128,4 +105,11 @@ private:
 
     Promise<uint64_t> sessionPromise_;
     std::vector<SessionListener> sessionListeners_;
+
+    Executor* const callbackExecutor_;
+
+    // Writes queued while another write is in flight, to be sent in the next batch
+    std::mutex writeMutex_;
+    std::vector<std::unique_ptr<PendingWrite>> queuedWrites_;
+    bool writeInFlight_;
 };
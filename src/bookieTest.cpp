@@ -0,0 +1,490 @@
+/**
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "Bookie.h"
+#include "BookieClient.h"
+#include "BookieConfig.h"
+#include "LedgerMetadata.h"
+#include "LocalMetadataStore.h"
+#include "Logging.h"
+#include "TailCache.h"
+#include "ZooKeeper.h"
+
+#include <glog/logging.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <folly/Format.h>
+
+namespace fs = boost::filesystem;
+
+DECLARE_LOG_OBJECT();
+
+static const int64_t OffloadedLedgerId = 3;
+static const int64_t OffloadedLastEntryId = 299;
+
+/**
+ * Bookie configuration for a test, with all the data in a temporary directory
+ */
+class TestConfig {
+public:
+    explicit TestConfig(const std::vector<std::string>& extraArgs = { }) :
+            directory_(fs::temp_directory_path() / fs::unique_path("bookieTest-%%%%-%%%%-%%%%")) {
+        fs::create_directories(directory_);
+
+        std::vector<std::string> args = { "bookieTest", //
+                "--dataDir", path("data"), //
+                "--walDir", path("wal"), //
+                "--metadataStore", "local", //
+                "--metadataStoreFile", metadataStoreFile(), //
+                "--tieringDirectory", path("tiered"), //
+                "--warmUpRateMb", "0", //
+                "--statsReportingIntervalSeconds", "0" };
+        args.insert(args.end(), extraArgs.begin(), extraArgs.end());
+
+        std::vector<char*> argv;
+        for (auto& arg : args) {
+            argv.push_back(&arg[0]);
+        }
+        CHECK(config_.parse(argv.size(), argv.data()));
+        config_.setBookiePort(0);
+        config_.setBookieBindAddress("127.0.0.1");
+    }
+
+    ~TestConfig() {
+        fs::remove_all(directory_);
+    }
+
+    std::string path(const std::string& name) const {
+        return (directory_ / name).string();
+    }
+
+    std::string metadataStoreFile() const {
+        return path("metadata.json");
+    }
+
+    const BookieConfig& get() const {
+        return config_;
+    }
+
+private:
+    const fs::path directory_;
+    BookieConfig config_;
+};
+
+static SocketAddress loopbackAddress(const Bookie& bookie) {
+    return SocketAddress("127.0.0.1", bookie.getAddress().getPort());
+}
+
+static MasterKey makeMasterKey(uint8_t seed) {
+    MasterKey masterKey;
+    masterKey.fill(seed);
+    return masterKey;
+}
+
+static std::string makeEntry(int64_t ledgerId, int64_t entryId, size_t size) {
+    std::string data = sformat("entry-{}-{}-", ledgerId, entryId);
+    data.resize(size, static_cast<char>('a' + entryId % 26));
+    return data;
+}
+
+/**
+ * @return the error of the add entry request, BookieError::OK if it succeeded
+ */
+static BookieError addEntry(BookieClient& client, const SocketAddress& bookie, int64_t ledgerId, int64_t entryId,
+        const MasterKey& masterKey, const std::string& data) {
+    try {
+        client.addEntry(bookie, ledgerId, entryId, IOBuf::copyBuffer(data), masterKey).get();
+        return BookieError::OK;
+    } catch (const BookieException& e) {
+        return e.error();
+    }
+}
+
+/**
+ * @return the entry data, or empty if the bookie replied with BookieError::NoEntry
+ */
+static std::string readEntry(BookieClient& client, const SocketAddress& bookie, int64_t ledgerId, int64_t entryId) {
+    try {
+        IOBufPtr data = client.readEntry(bookie, ledgerId, entryId).get();
+        return data->moveToFbString().toStdString();
+    } catch (const BookieException& e) {
+        CHECK(e.error() == BookieError::NoEntry) << "Failed to read " << ledgerId << ":" << entryId << ": " << e.what();
+        return "";
+    }
+}
+
+/**
+ * @return the error of the metadata operation, MetadataError::OK if it succeeded
+ */
+template<typename T>
+static MetadataError metadataError(Future<T> future) {
+    try {
+        future.get();
+        return MetadataError::OK;
+    } catch (const MetadataException& e) {
+        return e.error();
+    }
+}
+
+/**
+ * The adds into a fenced ledger are rejected, both by the handler and by the journal, except the recovery adds
+ */
+static void testFencedAdd() {
+    TestConfig config({ "--zkRegistration", "false" });
+    Bookie bookie(config.get());
+    bookie.start();
+
+    BookieClient client;
+    SocketAddress address = loopbackAddress(bookie);
+    const int64_t ledgerId = 1;
+    const MasterKey masterKey = makeMasterKey(1);
+
+    CHECK(addEntry(client, address, ledgerId, 0, masterKey, makeEntry(ledgerId, 0, 100)) == BookieError::OK);
+
+    bookie.fenceLedger(ledgerId).get();
+    CHECK(bookie.isFenced(ledgerId));
+
+    CHECK(addEntry(client, address, ledgerId, 1, masterKey, makeEntry(ledgerId, 1, 100)) == BookieError::Fenced);
+
+    // Adds that passed the handler check before the ledger was fenced are rejected by the journal
+    bool rejected = false;
+    try {
+        bookie.addEntry(ledgerId, 1, IOBuf::copyBuffer(makeEntry(ledgerId, 1, 100))).get();
+    } catch (const LedgerFencedException& e) {
+        rejected = true;
+    }
+    CHECK(rejected) << "Add into fenced ledger accepted by the journal";
+
+    bookie.addEntry(ledgerId, 1, IOBuf::copyBuffer(makeEntry(ledgerId, 1, 100)), true).get();
+    CHECK_EQ(readEntry(client, address, ledgerId, 1), makeEntry(ledgerId, 1, 100));
+
+    bookie.stop();
+}
+
+/**
+ * The adds with a master key other than the one of the first entry of the ledger are rejected
+ */
+static void testWrongMasterKey() {
+    TestConfig config({ "--zkRegistration", "false" });
+    Bookie bookie(config.get());
+    bookie.start();
+
+    BookieClient client;
+    SocketAddress address = loopbackAddress(bookie);
+    const int64_t ledgerId = 2;
+
+    CHECK(addEntry(client, address, ledgerId, 0, makeMasterKey(1), makeEntry(ledgerId, 0, 100)) == BookieError::OK);
+    CHECK(addEntry(client, address, ledgerId, 1, makeMasterKey(2), makeEntry(ledgerId, 1, 100))
+            == BookieError::UnauthorizedAccesss);
+    CHECK(addEntry(client, address, ledgerId, 1, makeMasterKey(1), makeEntry(ledgerId, 1, 100)) == BookieError::OK);
+
+    CHECK_EQ(readEntry(client, address, ledgerId, 0), makeEntry(ledgerId, 0, 100));
+    CHECK_EQ(readEntry(client, address, ledgerId, 1), makeEntry(ledgerId, 1, 100));
+
+    bookie.stop();
+}
+
+/**
+ * Only the entries not multiple of 7 are stored, as with a striped ensemble
+ */
+static bool isStored(int64_t entryId) {
+    return entryId % 7 != 0;
+}
+
+static void checkOffloadedEntries(const Bookie& bookie) {
+    BookieClient client;
+    SocketAddress address = loopbackAddress(bookie);
+
+    for (int64_t entryId = 0; entryId <= OffloadedLastEntryId; entryId++) {
+        std::string expected = isStored(entryId) ? makeEntry(OffloadedLedgerId, entryId, 4096) : "";
+        CHECK_EQ(readEntry(client, address, OffloadedLedgerId, entryId), expected) << "Entry " << entryId;
+    }
+
+    CHECK_EQ(readEntry(client, address, OffloadedLedgerId, BookieConstant::LastAddConfirmed),
+            makeEntry(OffloadedLedgerId, OffloadedLastEntryId, 4096));
+    CHECK_EQ(readEntry(client, address, OffloadedLedgerId, OffloadedLastEntryId + 1), "");
+
+    // Offloaded ledgers are immutable
+    CHECK(addEntry(client, address, OffloadedLedgerId, OffloadedLastEntryId + 1, MasterKey(), "data")
+            == BookieError::Fenced);
+}
+
+/**
+ * A closed ledger is moved to the tiering store and read back from there, before and after a restart
+ */
+static void testTieringRoundTrip() {
+    TestConfig config({ "--tieringStore", "local", //
+            "--tieringLedgerAgeHours", "0", //
+            "--tieringScanIntervalSeconds", "1" });
+
+    {
+        LocalMetadataStore metadataStore(config.metadataStoreFile());
+        std::string metadata = sformat("BookieMetadataFormatVersion\t2\n"
+                "quorumSize: 1\n"
+                "ensembleSize: 1\n"
+                "length: 0\n"
+                "lastEntryId: {}\n"
+                "state: CLOSED\n"
+                "segment {{\n"
+                "  ensembleMember: \"127.0.0.1:3181\"\n"
+                "  firstEntryId: 0\n"
+                "}}\n", OffloadedLastEntryId);
+        metadataStore.create(LedgerMetadata::getPath("/ledgers", OffloadedLedgerId), metadata, { }).get();
+    }
+
+    {
+        Bookie bookie(config.get());
+
+        // Written before the tiering service starts, so that it never sees a partial ledger
+        for (int64_t entryId = 0; entryId <= OffloadedLastEntryId; entryId++) {
+            if (isStored(entryId)) {
+                bookie.addEntry(OffloadedLedgerId, entryId,
+                        IOBuf::copyBuffer(makeEntry(OffloadedLedgerId, entryId, 4096))).get();
+            }
+        }
+
+        bookie.start();
+        for (int i = 0; i < 600 && !bookie.isOffloaded(OffloadedLedgerId); i++) {
+            std::this_thread::sleep_for(milliseconds(100));
+        }
+        CHECK(bookie.isOffloaded(OffloadedLedgerId)) << "Ledger not offloaded";
+
+        checkOffloadedEntries(bookie);
+        bookie.stop();
+    }
+
+    {
+        Bookie bookie(config.get());
+        bookie.start();
+        CHECK(bookie.isOffloaded(OffloadedLedgerId));
+
+        checkOffloadedEntries(bookie);
+        bookie.stop();
+    }
+}
+
+/**
+ * Concurrent writes are sent in batches. When the server rejects a batch, because one of its writes fails, the other
+ * writes still succeed and each one gets its own result.
+ *
+ * Needs a ZooKeeper server, set with the BOOKIE_TEST_ZK_SERVERS environment variable. Skipped otherwise.
+ */
+static void testZooKeeperWriteBatching() {
+    const char* zkServers = std::getenv("BOOKIE_TEST_ZK_SERVERS");
+    if (!zkServers) {
+        LOG_INFO("Skipping the ZooKeeper write batching test -- BOOKIE_TEST_ZK_SERVERS is not set");
+        return;
+    }
+
+    ZooKeeper zk(zkServers, seconds(30));
+    zk.startSession().get();
+    std::string root = zk.create("/bookieTest-", "", { MetadataStore::Sequence }).get();
+
+    // Submitted while the previous writes are in flight, so most of them are batched together
+    const int numCreates = 100;
+    std::vector<Future<std::string>> creates;
+    std::vector<Future<std::string>> conflictingCreates;
+    for (int i = 0; i < numCreates; i++) {
+        creates.push_back(zk.create(root + "/seq-", "", { MetadataStore::Sequence }));
+        if (i % 10 == 0) {
+            conflictingCreates.push_back(zk.create(root + "/node", "", { }));
+        }
+    }
+
+    std::set<std::string> paths;
+    for (auto& create : creates) {
+        paths.insert(create.get());
+    }
+    CHECK_EQ(paths.size(), static_cast<size_t>(numCreates)) << "Duplicate sequential z-nodes";
+
+    int created = 0;
+    for (auto& create : conflictingCreates) {
+        try {
+            create.get();
+            ++created;
+        } catch (const MetadataException& e) {
+            CHECK(e.error() == MetadataError::NodeExists) << e.what();
+        }
+    }
+    CHECK_EQ(created, 1);
+
+    std::vector<std::string> children = zk.getChildren(root).get();
+    CHECK_EQ(children.size(), static_cast<size_t>(numCreates + 1));
+
+    for (auto& child : children) {
+        zk.remove(root + "/" + child).get();
+    }
+    zk.remove(root).get();
+}
+
+/**
+ * A multi with a failing operation leaves the z-nodes unchanged, including the ones modified by the operations before it
+ */
+static void testLocalMetadataStoreMultiRollback() {
+    LocalMetadataStore store;
+    store.startSession().get();
+    store.create("/ledgers/L1", "v0", { }).get();
+
+    std::vector<MetadataOp> ops = { MetadataOp::setData("/ledgers/L1", "v1"), //
+            MetadataOp::create("/ledgers/L2", "v0"), //
+            MetadataOp::check("/ledgers/L1", 5) };
+    CHECK(metadataError(store.multi(ops)) == MetadataError::BadVersion);
+
+    NodeData data = store.get("/ledgers/L1").get();
+    CHECK_EQ(data.value, "v0");
+    CHECK_EQ(data.stat.version, 0);
+    CHECK(!store.exists("/ledgers/L2").get().hasValue());
+    CHECK_EQ(store.getChildren("/ledgers").get().size(), 1u);
+}
+
+/**
+ * A change that cannot be saved to the persistence file fails with SystemError and is not applied
+ */
+static void testLocalMetadataStorePersistFailure() {
+    TestConfig config;
+    std::string directory = config.path("metadata");
+    fs::create_directories(directory);
+
+    LocalMetadataStore store(directory + "/metadata.json");
+    store.startSession().get();
+    store.create("/ledgers/L1", "v0", { }).get();
+
+    // The temporary file cannot be created anymore
+    fs::remove_all(directory);
+
+    CHECK(metadataError(store.create("/ledgers/L2", "v0", { })) == MetadataError::SystemError);
+    CHECK(metadataError(store.setData("/ledgers/L1", "v1")) == MetadataError::SystemError);
+
+    CHECK(!store.exists("/ledgers/L2").get().hasValue());
+    NodeData data = store.get("/ledgers/L1").get();
+    CHECK_EQ(data.value, "v0");
+    CHECK_EQ(data.stat.version, 0);
+}
+
+static void putTailCache(TailCache& cache, int64_t ledgerId, int64_t firstEntryId, int64_t lastEntryId, size_t size) {
+    for (int64_t entryId = firstEntryId; entryId <= lastEntryId; entryId++) {
+        cache.put(ledgerId, entryId, *IOBuf::copyBuffer(makeEntry(ledgerId, entryId, size)));
+    }
+}
+
+static bool inTailCache(TailCache& cache, int64_t ledgerId, int64_t entryId) {
+    IOBufPtr data = cache.get(ledgerId, entryId);
+    if (!data) {
+        return false;
+    }
+    CHECK_EQ(data->moveToFbString().toStdString(), makeEntry(ledgerId, entryId, data->computeChainDataLength()));
+    return true;
+}
+
+/**
+ * The tail cache evicts the least recently written ledgers beyond its memory budget, but always keeps the last written
+ * one, and the replaced or evicted entries are no longer accounted for
+ */
+static void testTailCacheEviction() {
+    // 16 KB per shard. Ledgers ids multiple of 16 all land in the same shard.
+    const size_t entrySize = 2000;
+    TailCache cache(4, 1000, 16 * 16 * 1024);
+
+    // Replacing the entries of the ring does not grow the accounted memory
+    putTailCache(cache, 0, 0, 99, entrySize);
+    putTailCache(cache, 16, 0, 2, entrySize);
+    CHECK(inTailCache(cache, 0, 99));
+    CHECK(!inTailCache(cache, 0, 95));
+    CHECK(inTailCache(cache, 16, 0));
+
+    // The third ledger exceeds the budget: the least recently written one is evicted
+    putTailCache(cache, 32, 0, 2, entrySize);
+    CHECK(!inTailCache(cache, 0, 99));
+    CHECK(inTailCache(cache, 16, 2));
+    CHECK(inTailCache(cache, 32, 2));
+    CHECK(inTailCache(cache, 32, BookieConstant::LastAddConfirmed));
+
+    // Ledgers in other shards are not affected
+    putTailCache(cache, 1, 0, 2, entrySize);
+    CHECK(inTailCache(cache, 16, 2));
+    CHECK(inTailCache(cache, 1, 2));
+
+    // An entry larger than the budget is kept, since it's in the last written ledger
+    putTailCache(cache, 48, 0, 0, 32 * 1024);
+    CHECK(inTailCache(cache, 48, 0));
+    CHECK(!inTailCache(cache, 16, 2));
+    CHECK(!inTailCache(cache, 32, 2));
+
+    // Once invalidated, its memory is available again for two ledgers
+    cache.invalidate(48);
+    putTailCache(cache, 64, 0, 2, entrySize);
+    putTailCache(cache, 80, 0, 2, entrySize);
+    CHECK(!inTailCache(cache, 48, 0));
+    CHECK(inTailCache(cache, 64, 2));
+    CHECK(inTailCache(cache, 80, 2));
+}
+
+/**
+ * The tail cache shares the buffer of an entry, unless the buffer is much larger than the entry
+ */
+static void testTailCacheCopy() {
+    TailCache cache(4, 16, 16 * 16 * 1024);
+
+    IOBufPtr entry = IOBuf::copyBuffer(makeEntry(1, 0, 100));
+    cache.put(1, 0, *entry);
+    CHECK_EQ(cache.get(1, 0)->data(), entry->data());
+
+    // Like a socket read buffer holding many requests
+    IOBufPtr buffer = IOBuf::create(64 * 1024);
+    std::string data = makeEntry(1, 1, 100);
+    memcpy(buffer->writableTail(), data.data(), data.size());
+    buffer->append(data.size());
+    cache.put(1, 1, *buffer);
+
+    IOBufPtr cached = cache.get(1, 1);
+    CHECK_NE(cached->data(), buffer->data());
+    CHECK_LT(cached->capacity(), 4096);
+    CHECK_EQ(cached->moveToFbString().toStdString(), data);
+}
+
+/**
+ * Behavior tests of the bookie, each running an in-process bookie on an ephemeral loopback port.
+ *
+ * Failed checks abort the process.
+ */
+int main(int argc, char** argv) {
+    Logging::init();
+    google::InitGoogleLogging(argv[0]);
+
+    testFencedAdd();
+    testWrongMasterKey();
+    testTieringRoundTrip();
+    testZooKeeperWriteBatching();
+    testLocalMetadataStoreMultiRollback();
+    testLocalMetadataStorePersistFailure();
+    testTailCacheEviction();
+    testTailCacheCopy();
+
+    std::cout << "All tests passed" << std::endl;
+    return 0;
+}
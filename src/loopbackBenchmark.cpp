@@ -0,0 +1,107 @@
+/**
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "Bookie.h"
+#include "BookieConfig.h"
+#include "LoadGenerator.h"
+#include "Logging.h"
+#include "Metrics.h"
+
+#include <glog/logging.h>
+
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+DECLARE_LOG_OBJECT();
+
+struct Arguments {
+    int durationSeconds;
+    double rate;
+    int msgSize;
+    int numberOfConnections;
+    bool formatStatsJson;
+    std::string summaryFile;
+};
+
+/**
+ * In-process end-to-end benchmark.
+ *
+ * Starts a bookie with the local metadata store on an ephemeral loopback port and drives it with the perfClient
+ * load generator for a fixed duration, then prints the add entry latency stats in the perfClient format.
+ */
+int main(int argc, char** argv) {
+    Logging::init();
+    google::InitGoogleLogging(argv[0]);
+
+    Arguments args;
+
+    po::options_description options("Loopback benchmark options");
+    options.add_options() //
+    ("duration", po::value<int>(&args.durationSeconds)->default_value(60), "Benchmark duration in seconds") //
+    ("rate", po::value<double>(&args.rate)->default_value(100000), "Add entry rate") //
+    ("msg-size", po::value<int>(&args.msgSize)->default_value(1024), "Message size") //
+    ("num-connections", po::value<int>(&args.numberOfConnections)->default_value(16), "Number of connections") //
+    ("format-stats", po::value<bool>(&args.formatStatsJson)->default_value(true), "Format stats JSON output") //
+    ("summary-file", po::value<std::string>(&args.summaryFile)->default_value(""),
+            "Also write the final stats JSON to this file") //
+            ;
+
+    // The bookie options (dataDir, walDir, fsyncWal...) are accepted as well, so the benchmark can run against a
+    // tmpfs or a real data directory
+    BookieConfig config;
+    if (!config.parse(argc, argv, options)) {
+        return -1;
+    }
+
+    config.setBookiePort(0);
+    config.setBookieBindAddress("127.0.0.1");
+    config.setMetadataStore("local");
+
+    Bookie bookie(config);
+    bookie.start();
+
+    SocketAddress bookieAddress("127.0.0.1", bookie.getAddress().getPort());
+
+    MetricsManager metricsManager(seconds(0));
+    MetricPtr addEntryMetric = metricsManager.createMetric("add-entry-metric");
+
+    LoadGenerator generator(args.rate, args.msgSize, args.numberOfConnections, addEntryMetric);
+    generator.start(bookieAddress);
+
+    LOG_INFO("Running loopback benchmark for " << args.durationSeconds << " seconds");
+    std::this_thread::sleep_for(seconds(args.durationSeconds));
+    generator.stop(seconds(10));
+
+    std::string summary = metricsManager.collectJsonStats(seconds(args.durationSeconds), args.formatStatsJson);
+    std::cout << summary << std::endl;
+
+    if (!args.summaryFile.empty()) {
+        std::ofstream summaryFile(args.summaryFile);
+        summaryFile << summary << std::endl;
+        if (!summaryFile) {
+            LOG_ERROR("Failed to write summary to " << args.summaryFile);
+            return -1;
+        }
+    }
+
+    bookie.stop();
+    return 0;
+}
@@ -0,0 +1,358 @@
+/**
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "Logging.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/algorithm/string/replace.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+#include <folly/dynamic.h>
+#include <folly/json.h>
+
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+using namespace folly;
+
+DECLARE_LOG_OBJECT();
+
+/**
+ * Performance regression gate.
+ *
+ * Each benchmark is described by a JSON file in the benchmarks directory:
+ *
+ *  {
+ *    "command": "${BIN_DIR}/loopbackBenchmark --duration 30 --dataDir ${WORK_DIR}/data",
+ *    "throughput": [ "add-entry-metric.rate" ],
+ *    "latency": [ "add-entry-metric.pct99" ]
+ *  }
+ *
+ * The command is run multiple times, with "--summary-file <file>" appended, and must write its stats JSON there.
+ * The medians of the listed values are compared against the baseline stored with the same name in the baselines
+ * directory. Throughput values regress when they go down, latency values when they go up.
+ */
+
+struct Arguments {
+    std::string benchmarksDir;
+    std::string baselinesDir;
+    std::string binDir;
+    std::string workDir;
+    std::string filter;
+    int runs;
+    double thresholdPercent;
+    bool record;
+};
+
+struct Summary {
+    double median;
+    double ciLow;
+    double ciHigh;
+};
+
+/**
+ * Compute the median and the approximate 95% confidence interval of the median, based on the order statistics
+ */
+static Summary summarize(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    int n = values.size();
+
+    Summary summary;
+    summary.median = (n % 2 == 1) ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+
+    double halfWidth = 1.96 * std::sqrt(n) / 2;
+    int low = std::max(0, (int) std::floor(n / 2.0 - halfWidth));
+    int high = std::min(n - 1, (int) std::ceil(n / 2.0 + halfWidth));
+    summary.ciLow = values[low];
+    summary.ciHigh = values[high];
+    return summary;
+}
+
+static bool lookupValue(const dynamic& stats, const std::string& path, double& value) {
+    // Paths are in the form "<metric-name>.<stat>". Metric names can contain dots, so split on the last one.
+    size_t pos = path.rfind('.');
+    if (pos == std::string::npos) {
+        return false;
+    }
+
+    auto metric = stats.get_ptr(path.substr(0, pos));
+    if (!metric) {
+        return false;
+    }
+
+    auto stat = metric->get_ptr(path.substr(pos + 1));
+    if (!stat || !stat->isNumber()) {
+        return false;
+    }
+
+    value = stat->asDouble();
+    return true;
+}
+
+static dynamic readJson(const fs::path& path) {
+    std::ifstream file(path.string());
+    std::stringstream content;
+    content << file.rdbuf();
+    return parseJson(content.str());
+}
+
+static std::string formatValue(double value) {
+    std::ostringstream s;
+    s << std::fixed << std::setprecision(3) << value;
+    return s.str();
+}
+
+class BenchmarkRunner {
+public:
+    BenchmarkRunner(const Arguments& args, const std::string& name, const dynamic& definition) :
+            args_(args),
+            name_(name),
+            definition_(definition) {
+    }
+
+    /**
+     * Run the benchmark and collect the samples for all the tracked values
+     *
+     * @return false if any run failed
+     */
+    bool run() {
+        for (auto& kind : { "throughput", "latency" }) {
+            for (auto& path : definition_.getDefault(kind, dynamic::array())) {
+                paths_.push_back(path.asString());
+            }
+        }
+
+        for (int i = 0; i < args_.runs; i++) {
+            fs::path workDir = fs::path(args_.workDir) / fs::unique_path(name_ + "-%%%%-%%%%");
+            fs::create_directories(workDir);
+            fs::path summaryFile = workDir / "summary.json";
+
+            std::string command = definition_["command"].asString();
+            boost::replace_all(command, "${BIN_DIR}", args_.binDir);
+            boost::replace_all(command, "${WORK_DIR}", workDir.string());
+            command += " --summary-file " + summaryFile.string() + " > " + (workDir / "output.log").string() + " 2>&1";
+
+            std::cout << "[" << name_ << "] run " << (i + 1) << "/" << args_.runs << std::endl;
+            LOG_DEBUG("Running: " << command);
+
+            int rc = std::system(command.c_str());
+            bool ok = rc == 0 && fs::exists(summaryFile);
+            if (ok) {
+                dynamic stats = readJson(summaryFile);
+                for (auto& path : paths_) {
+                    double value;
+                    if (!lookupValue(stats, path, value)) {
+                        std::cerr << "[" << name_ << "] missing value '" << path << "' in benchmark summary" << std::endl;
+                        ok = false;
+                        break;
+                    }
+
+                    samples_[path].push_back(value);
+                }
+            } else {
+                std::cerr << "[" << name_ << "] benchmark failed with exit code " << rc << " -- output kept in "
+                        << workDir << std::endl;
+            }
+
+            if (!ok) {
+                return false;
+            }
+
+            fs::remove_all(workDir);
+        }
+
+        return true;
+    }
+
+    dynamic toBaseline() const {
+        dynamic baseline = dynamic::object();
+        for (auto& path : paths_) {
+            Summary summary = summarize(samples_.at(path));
+            baseline[path] = dynamic::object("median", summary.median)("ciLow", summary.ciLow) //
+            ("ciHigh", summary.ciHigh)("runs", args_.runs);
+        }
+        return baseline;
+    }
+
+    /**
+     * Print the comparison against the baseline
+     *
+     * @return false if any value regressed beyond the threshold, or has no baseline
+     */
+    bool compare(const dynamic& baseline) const {
+        bool passed = true;
+        auto throughput = definition_.getDefault("throughput", dynamic::array());
+
+        for (auto& path : paths_) {
+            bool higherIsBetter = std::find(throughput.begin(), throughput.end(), dynamic(path)) != throughput.end();
+            Summary current = summarize(samples_.at(path));
+
+            auto base = baseline.get_ptr(path);
+            if (!base) {
+                // A gate without baseline would never fail: record the baselines first, with --record
+                printRow(path, "-", current, "n/a", "NO BASELINE");
+                passed = false;
+                continue;
+            }
+
+            double baseMedian = (*base)["median"].asDouble();
+            double change = baseMedian == 0 ? 0 : (current.median - baseMedian) / baseMedian * 100;
+            double regression = higherIsBetter ? -change : change;
+
+            bool regressed = regression > args_.thresholdPercent;
+            passed &= !regressed;
+
+            std::ostringstream changeStr;
+            changeStr << std::showpos << std::fixed << std::setprecision(2) << change << "%";
+            printRow(path, formatValue(baseMedian), current, changeStr.str(), regressed ? "REGRESSION" : "OK");
+        }
+
+        return passed;
+    }
+
+private:
+    void printRow(const std::string& path, const std::string& baseline, const Summary& current,
+            const std::string& change, const std::string& status) const {
+        std::ostringstream currentStr;
+        currentStr << formatValue(current.median) << " [" << formatValue(current.ciLow) << ", "
+                << formatValue(current.ciHigh) << "]";
+
+        std::cout << std::left << std::setw(16) << name_ << std::setw(32) << path << std::setw(16) << baseline
+                << std::setw(40) << currentStr.str() << std::setw(12) << change << status << std::endl;
+    }
+
+    const Arguments& args_;
+    const std::string name_;
+    const dynamic definition_;
+
+    std::vector<std::string> paths_;
+    std::map<std::string, std::vector<double>> samples_;
+};
+
+int main(int argc, char** argv) {
+    Logging::init();
+
+    Arguments args;
+
+    po::options_description options("Allowed options");
+    options.add_options() //
+    ("help,h", "This help message") //
+    ("benchmarks-dir", po::value<std::string>(&args.benchmarksDir)->default_value("./benchmarks"),
+            "Directory with the benchmark definitions") //
+    ("baselines-dir", po::value<std::string>(&args.baselinesDir)->default_value("./benchmarks/baselines"),
+            "Directory with the baseline results") //
+    ("bin-dir", po::value<std::string>(&args.binDir)->default_value("."),
+            "Directory containing the benchmark executables") //
+    ("work-dir", po::value<std::string>(&args.workDir)->default_value("/tmp"),
+            "Directory where the benchmarks store their data. Use a tmpfs to reduce noise") //
+    ("filter", po::value<std::string>(&args.filter)->default_value(""), "Only run benchmarks containing this string") //
+    ("runs,n", po::value<int>(&args.runs)->default_value(5), "Number of runs for each benchmark") //
+    ("threshold,t", po::value<double>(&args.thresholdPercent)->default_value(10),
+            "Maximum allowed regression, in percent") //
+    ("record", po::value<bool>(&args.record)->default_value(false),
+            "Record the results as the new baselines instead of comparing") //
+            ;
+
+    po::variables_map map;
+    try {
+        po::store(po::command_line_parser(argc, argv).options(options).run(), map);
+        po::notify(map);
+
+        if (map.count("help")) {
+            std::cerr << options << std::endl;
+            exit(1);
+        }
+
+        if (args.runs < 1) {
+            throw std::invalid_argument("runs must be at least 1");
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error parsing parameters -- " << e.what() << std::endl << std::endl;
+        std::cerr << options << std::endl;
+        return -1;
+    }
+
+    std::vector<fs::path> definitions;
+    for (auto& entry : fs::directory_iterator(args.benchmarksDir)) {
+        if (entry.path().extension() == ".json"
+                && entry.path().stem().string().find(args.filter) != std::string::npos) {
+            definitions.push_back(entry.path());
+        }
+    }
+    std::sort(definitions.begin(), definitions.end());
+
+    if (definitions.empty()) {
+        std::cerr << "No benchmark definitions found in " << args.benchmarksDir << std::endl;
+        return -1;
+    }
+
+    std::vector<std::unique_ptr<BenchmarkRunner>> runners;
+    for (auto& path : definitions) {
+        auto runner = std::make_unique<BenchmarkRunner>(args, path.stem().string(), readJson(path));
+        if (!runner->run()) {
+            return 2;
+        }
+
+        runners.push_back(std::move(runner));
+    }
+
+    if (args.record) {
+        fs::create_directories(args.baselinesDir);
+        for (size_t i = 0; i < definitions.size(); i++) {
+            fs::path baselinePath = fs::path(args.baselinesDir) / definitions[i].filename();
+            json::serialization_opts opts;
+            opts.pretty_formatting = true;
+            opts.sort_keys = true;
+
+            std::ofstream baselineFile(baselinePath.string());
+            baselineFile << json::serialize(runners[i]->toBaseline(), opts) << std::endl;
+            std::cout << "Recorded baseline " << baselinePath << std::endl;
+        }
+
+        return 0;
+    }
+
+    std::cout << std::endl << std::left << std::setw(16) << "BENCHMARK" << std::setw(32) << "VALUE" << std::setw(16)
+            << "BASELINE" << std::setw(40) << "CURRENT [95% CI]" << std::setw(12) << "CHANGE" << "STATUS" << std::endl;
+
+    bool passed = true;
+    for (size_t i = 0; i < definitions.size(); i++) {
+        fs::path baselinePath = fs::path(args.baselinesDir) / definitions[i].filename();
+        dynamic baseline = fs::exists(baselinePath) ? readJson(baselinePath) : dynamic::object();
+        passed &= runners[i]->compare(baseline);
+    }
+
+    std::cout << std::endl << (passed ? "PASSED" : "FAILED") << " -- threshold: " << args.thresholdPercent << "%"
+            << std::endl;
+    return passed ? 0 : 1;
+}
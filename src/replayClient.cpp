@@ -0,0 +1,298 @@
+/**
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "BookieCodecV2.h"
+#include "Logging.h"
+#include "Metrics.h"
+#include "TrafficCapture.h"
+
+#include <atomic>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <tuple>
+
+#include <folly/MoveWrapper.h>
+#include <wangle/bootstrap/ClientBootstrap.h>
+#include <wangle/channel/AsyncSocketHandler.h>
+#include <wangle/codec/LengthFieldBasedFrameDecoder.h>
+
+#include <boost/program_options.hpp>
+namespace po = boost::program_options;
+
+DECLARE_LOG_OBJECT();
+
+struct Arguments {
+    std::string bookieAddress;
+    std::string captureFile;
+    double timeScale;
+    int64_t ledgerIdOffset;
+    int numberOfConnections;
+    int drainTimeoutSeconds;
+    bool formatStatsJson;
+};
+
+typedef Pipeline<IOBufQueue&, Request> BookieClientPipeline;
+
+/**
+ * Send the replayed requests on a single connection and track their latency
+ */
+class ReplayHandler: public HandlerAdapter<Response, Request> {
+public:
+    ReplayHandler(BookieClientPipeline::Ptr pipeline, MetricPtr addEntryMetric, MetricPtr readEntryMetric,
+            std::atomic<int64_t>& pendingRequests, std::atomic<int64_t>& errors) :
+            pipeline_(pipeline),
+            addEntryMetric_(addEntryMetric),
+            readEntryMetric_(readEntryMetric),
+            pendingRequests_(pendingRequests),
+            errors_(errors) {
+    }
+
+    void send(Request request) {
+        ++pendingRequests_;
+
+        auto req = makeMoveWrapper(std::move(request));
+        pipeline_->getTransport()->getEventBase()->runInEventBaseThread([this, req]() mutable {
+            Metric* metric = req->opCode == BookieOperation::AddEntry ? addEntryMetric_.get() : readEntryMetric_.get();
+            inflight_[key(req->opCode, req->ledgerId, req->entryId)].push_back(metric->startTimer());
+
+            LOG_DEBUG("Sending request " << *req);
+            pipeline_->write(std::move(*req));
+        });
+    }
+
+    virtual void read(Context* ctx, Response response) override {
+        LOG_DEBUG("Received response: " << response);
+        if (response.errorCode != BookieError::OK) {
+            ++errors_;
+        }
+
+        auto it = inflight_.find(key(response.opCode, response.ledgerId, response.entryId));
+        if (it == inflight_.end()) {
+            LOG_WARN("Received unexpected response: " << response);
+            return;
+        }
+
+        it->second.front().completed();
+        it->second.pop_front();
+        if (it->second.empty()) {
+            inflight_.erase(it);
+        }
+
+        --pendingRequests_;
+    }
+
+    virtual void readEOF(Context* ctx) override {
+        LOG_INFO("EOF received");
+        close(ctx);
+    }
+
+private:
+    typedef std::tuple<BookieOperation, int64_t, int64_t> RequestKey;
+
+    static RequestKey key(BookieOperation op, int64_t ledgerId, int64_t entryId) {
+        return std::make_tuple(op, ledgerId, entryId);
+    }
+
+    BookieClientPipeline::Ptr pipeline_;
+    MetricPtr addEntryMetric_;
+    MetricPtr readEntryMetric_;
+    std::atomic<int64_t>& pendingRequests_;
+    std::atomic<int64_t>& errors_;
+
+    // Only accessed from the connection event base thread. The same entry can be requested multiple times.
+    std::map<RequestKey, std::deque<Timer>> inflight_;
+};
+
+class ReplayPipelineFactory: public PipelineFactory<BookieClientPipeline> {
+public:
+    ReplayPipelineFactory(MetricPtr addEntryMetric, MetricPtr readEntryMetric, std::atomic<int64_t>& pendingRequests,
+            std::atomic<int64_t>& errors) :
+            addEntryMetric_(addEntryMetric),
+            readEntryMetric_(readEntryMetric),
+            pendingRequests_(pendingRequests),
+            errors_(errors) {
+    }
+
+    BookieClientPipeline::Ptr newPipeline(std::shared_ptr<AsyncTransportWrapper> sock) override {
+        auto pipeline = BookieClientPipeline::create();
+        auto handler = std::make_shared<ReplayHandler>(pipeline, addEntryMetric_, readEntryMetric_, pendingRequests_,
+                errors_);
+        pipeline->addBack(AsyncSocketHandler(sock));
+        pipeline->addBack(LengthFieldBasedFrameDecoder(4, BookieConstant::MaxFrameSize));
+        pipeline->addBack(BookieClientCodecV2());
+        pipeline->addBack(handler);
+        pipeline->finalize();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        handlers_.push_back(handler);
+        return pipeline;
+    }
+
+    std::vector<std::shared_ptr<ReplayHandler>> handlers() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return handlers_;
+    }
+
+private:
+    MetricPtr addEntryMetric_;
+    MetricPtr readEntryMetric_;
+    std::atomic<int64_t>& pendingRequests_;
+    std::atomic<int64_t>& errors_;
+
+    std::mutex mutex_;
+    std::vector<std::shared_ptr<ReplayHandler>> handlers_;
+};
+
+/**
+ * Re-issue the requests recorded in a bookie capture file (see --captureFile), reproducing the original
+ * inter-arrival times, optionally scaled.
+ */
+int main(int argc, char** argv) {
+    Logging::init();
+
+    Arguments args;
+
+    po::options_description options;
+    options.add_options() //
+    ("help,h", "This help message") //
+    ("bookieAddress,a", po::value<std::string>(&args.bookieAddress)->default_value("localhost:3181"),
+            "Boookie hostname and port") //
+    ("capture-file,f", po::value<std::string>(&args.captureFile)->required(), "Capture file to replay") //
+    ("time-scale", po::value<double>(&args.timeScale)->default_value(1.0),
+            "Multiplier applied to the recorded inter-arrival times. Eg: 0.5 replays the traffic twice as fast") //
+    ("ledger-id-offset", po::value<int64_t>(&args.ledgerIdOffset)->default_value(0),
+            "Offset added to all the ledger ids, to avoid overwriting existing ledgers") //
+    ("num-connections,c", po::value<int>(&args.numberOfConnections)->default_value(16),
+            "Number of connections. Recorded connections are mapped onto these") //
+    ("drain-timeout", po::value<int>(&args.drainTimeoutSeconds)->default_value(30),
+            "Time to wait for the outstanding responses at the end of the replay, in seconds") //
+    ("format-stats", po::value<bool>(&args.formatStatsJson)->default_value(true), "Format stats JSON output") //
+            ;
+
+    po::variables_map map;
+    try {
+        po::store(po::command_line_parser(argc, argv).options(options).run(), map);
+
+        if (map.count("help")) {
+            std::cerr << options << std::endl;
+            exit(1);
+        }
+
+        po::notify(map);
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error parsing parameters -- " << e.what() << std::endl << std::endl;
+        std::cerr << options << std::endl;
+        return -1;
+    }
+
+    MetricsManager metricsManager(seconds(0));
+    MetricPtr addEntryMetric = metricsManager.createMetric("replay-add-entry");
+    MetricPtr readEntryMetric = metricsManager.createMetric("replay-read-entry");
+    std::atomic<int64_t> pendingRequests(0);
+    std::atomic<int64_t> errors(0);
+
+    SocketAddress bookieAddress;
+    bookieAddress.setFromHostPort(args.bookieAddress);
+    LOG_INFO("Bookie address: " << bookieAddress);
+
+    auto pipelineFactory = std::make_shared<ReplayPipelineFactory>(addEntryMetric, readEntryMetric, pendingRequests,
+            errors);
+    ClientBootstrap<BookieClientPipeline> client;
+    client.group(std::make_shared<wangle::IOThreadPoolExecutor>(std::thread::hardware_concurrency()));
+    client.pipelineFactory(pipelineFactory);
+
+    std::vector<Future<BookieClientPipeline*>> connectFutures;
+    for (int i = 0; i < args.numberOfConnections; i++) {
+        connectFutures.push_back(client.connect(bookieAddress));
+    }
+
+    for (auto& future : connectFutures) {
+        future.get();
+    }
+
+    auto connections = pipelineFactory->handlers();
+
+    TrafficCaptureReader reader(args.captureFile);
+    CaptureRecord record;
+
+    // Payloads elided from the capture are replaced with slices of a shared filler buffer
+    std::shared_ptr<IOBuf> filler = IOBuf::create(0);
+    int64_t replayedRequests = 0;
+
+    steady_clock::time_point start = steady_clock::now();
+    bool corrupted = false;
+
+    while (true) {
+        try {
+            if (!reader.next(record)) {
+                break;
+            }
+        } catch (const std::exception& e) {
+            // Still drain the requests already sent, and report their stats
+            LOG_ERROR("Stopping the replay -- " << e.what());
+            corrupted = true;
+            break;
+        }
+
+        if (record.opCode != BookieOperation::AddEntry && record.opCode != BookieOperation::ReadEntry) {
+            continue;
+        }
+
+        std::this_thread::sleep_until(start + microseconds((int64_t) (record.timestampMicros * args.timeScale)));
+
+        IOBufPtr payload;
+        if (record.opCode == BookieOperation::AddEntry) {
+            if (record.payload) {
+                payload = std::move(record.payload);
+            } else {
+                if (filler->length() < record.payloadLength) {
+                    filler = IOBuf::create(record.payloadLength);
+                    memset(filler->writableData(), 'X', record.payloadLength);
+                    filler->append(record.payloadLength);
+                }
+
+                payload = filler->clone();
+                payload->trimEnd(filler->length() - record.payloadLength);
+            }
+        }
+
+        Request request { record.protocolVersion, record.opCode, record.ledgerId + args.ledgerIdOffset,
+                record.entryId, record.flags, std::move(payload) };
+        connections[record.connectionId % connections.size()]->send(std::move(request));
+        ++replayedRequests;
+    }
+
+    LOG_INFO("Replayed " << replayedRequests << " requests -- waiting for outstanding responses");
+
+    steady_clock::time_point deadline = steady_clock::now() + seconds(args.drainTimeoutSeconds);
+    while (pendingRequests > 0 && steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(milliseconds(10));
+    }
+
+    seconds elapsed = std::max(seconds(1), duration_cast<seconds>(steady_clock::now() - start));
+    std::cout << metricsManager.collectJsonStats(elapsed, args.formatStatsJson) << std::endl;
+
+    LOG_INFO("Errors: " << errors << " -- Unanswered requests: " << pendingRequests);
+    return corrupted ? -1 : 0;
+}